@@ -0,0 +1,502 @@
+/*
+ *    Stream processing tool
+ *
+ *    Copyright 2016 Zoltan Herczeg (hzmester@freemail.hu). All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are
+ * permitted provided that the following conditions are met:
+ *
+ *   1. Redistributions of source code must retain the above copyright notice, this list of
+ *      conditions and the following disclaimer.
+ *
+ *   2. Redistributions in binary form must reproduce the above copyright notice, this list
+ *      of conditions and the following disclaimer in the documentation and/or other materials
+ *      provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDER(S) AND CONTRIBUTORS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT
+ * SHALL THE COPYRIGHT HOLDER(S) OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "pcresp.h"
+
+#include <stdlib.h>
+
+/* Aggregation of matches by a key. The keys are stored in an open
+ * addressing hash table (linear probing), and the key strings are
+ * interned into large chunks, so an entry needs no allocation. */
+
+#define AGGREGATE_SUM 0
+#define AGGREGATE_MIN 1
+#define AGGREGATE_MAX 2
+#define AGGREGATE_VALUES 3
+
+#define STRING_CHUNK_SIZE (64 * 1024)
+
+typedef struct aggregate_entry {
+	const char *key;
+	size_t key_length;
+	uint32_t hash;
+	uint32_t value_flags;
+	uint64_t count;
+	double values[AGGREGATE_VALUES];
+} aggregate_entry;
+
+typedef struct string_chunk {
+	struct string_chunk *next;
+	size_t size;
+	size_t used;
+	char data[1];
+} string_chunk;
+
+struct aggregate {
+	const char *key_source;
+	const char *value_sources[AGGREGATE_VALUES];
+	hash_template *key;
+	hash_template *values[AGGREGATE_VALUES];
+	int unique;
+	int sort;
+	aggregate_entry *entries;
+	size_t capacity;
+	size_t count;
+	string_chunk *chunks;
+	string_buffer key_buffer;
+	string_buffer value_buffer;
+};
+
+int pcresp_add_aggregate(pcresp_ctx *ctx, int type, const char *source)
+{
+	aggregate *aggr = ctx->aggregate;
+
+	if (aggr == NULL) {
+		aggr = (aggregate*)malloc(sizeof(aggregate));
+		if (aggr == NULL) {
+			fprintf(stderr, "Cannot allocate memory\n");
+			return 0;
+		}
+
+		memset(aggr, 0, sizeof(aggregate));
+		ctx->aggregate = aggr;
+	}
+
+	switch (type) {
+	case PCRESP_GROUP_BY:
+	case PCRESP_UNIQUE:
+		if (aggr->key_source != NULL) {
+			fprintf(stderr, "Only one --group-by or --unique key is allowed\n");
+			return 0;
+		}
+		aggr->key_source = source;
+		aggr->unique = (type == PCRESP_UNIQUE);
+		return 1;
+	case PCRESP_SUM:
+		aggr->value_sources[AGGREGATE_SUM] = source;
+		return 1;
+	case PCRESP_MIN:
+		aggr->value_sources[AGGREGATE_MIN] = source;
+		return 1;
+	case PCRESP_MAX:
+		aggr->value_sources[AGGREGATE_MAX] = source;
+		return 1;
+	}
+
+	fprintf(stderr, "Unknown aggregate type\n");
+	return 0;
+}
+
+int pcresp_set_aggregate_sort(pcresp_ctx *ctx, int sort)
+{
+	if (ctx->aggregate == NULL) {
+		fprintf(stderr, "Sorting requires --group-by\n");
+		return 0;
+	}
+
+	ctx->aggregate->sort = sort;
+	return 1;
+}
+
+int init_aggregate(pcresp_ctx *ctx)
+{
+	aggregate *aggr = ctx->aggregate;
+	int i;
+
+	if (aggr->key_source == NULL) {
+		fprintf(stderr, "Aggregation requires --group-by\n");
+		return 0;
+	}
+
+	for (i = 0; i < AGGREGATE_VALUES; i++) {
+		if (aggr->value_sources[i] == NULL) {
+			continue;
+		}
+
+		if (aggr->unique) {
+			fprintf(stderr, "--unique cannot be combined with --sum, --min or --max\n");
+			return 0;
+		}
+
+		aggr->values[i] = compile_template(ctx, aggr->value_sources[i], strlen(aggr->value_sources[i]));
+		if (aggr->values[i] == NULL) {
+			return 0;
+		}
+	}
+
+	if (aggr->sort >= PCRESP_SORT_SUM && aggr->values[aggr->sort - PCRESP_SORT_SUM] == NULL) {
+		fprintf(stderr, "Sorting by a value requires the same aggregate (--sum, --min or --max)\n");
+		return 0;
+	}
+
+	aggr->key = compile_template(ctx, aggr->key_source, strlen(aggr->key_source));
+	if (aggr->key == NULL) {
+		return 0;
+	}
+
+	aggr->capacity = 1024;
+	aggr->entries = (aggregate_entry*)calloc(aggr->capacity, sizeof(aggregate_entry));
+	if (aggr->entries == NULL) {
+		fprintf(stderr, "Cannot allocate memory\n");
+		return 0;
+	}
+	return 1;
+}
+
+static void free_chunks(aggregate *aggr)
+{
+	string_chunk *chunk = aggr->chunks;
+	string_chunk *next;
+
+	while (chunk != NULL) {
+		next = chunk->next;
+		free(chunk);
+		chunk = next;
+	}
+	aggr->chunks = NULL;
+}
+
+void free_aggregate(pcresp_ctx *ctx)
+{
+	aggregate *aggr = ctx->aggregate;
+	int i;
+
+	if (aggr == NULL) {
+		return;
+	}
+
+	free_chunks(aggr);
+	for (i = 0; i < AGGREGATE_VALUES; i++) {
+		if (aggr->values[i] != NULL) {
+			free(aggr->values[i]);
+		}
+	}
+	if (aggr->key != NULL) {
+		free(aggr->key);
+	}
+	if (aggr->entries != NULL) {
+		free(aggr->entries);
+	}
+	if (aggr->key_buffer.data != NULL) {
+		free(aggr->key_buffer.data);
+	}
+	if (aggr->value_buffer.data != NULL) {
+		free(aggr->value_buffer.data);
+	}
+	free(aggr);
+	ctx->aggregate = NULL;
+}
+
+static const char *intern_key(aggregate *aggr, const char *key, size_t length)
+{
+	string_chunk *chunk = aggr->chunks;
+	size_t size;
+	char *result;
+
+	if (chunk == NULL || chunk->size - chunk->used < length) {
+		size = length > STRING_CHUNK_SIZE ? length : STRING_CHUNK_SIZE;
+		chunk = (string_chunk*)malloc(sizeof(string_chunk) + size);
+
+		if (chunk == NULL) {
+			fprintf(stderr, "Cannot allocate memory\n");
+			return NULL;
+		}
+
+		chunk->next = aggr->chunks;
+		chunk->size = size;
+		chunk->used = 0;
+		aggr->chunks = chunk;
+	}
+
+	result = chunk->data + chunk->used;
+	memcpy(result, key, length);
+	chunk->used += length;
+	return result;
+}
+
+static int grow_table(aggregate *aggr)
+{
+	size_t new_capacity = aggr->capacity * 2;
+	size_t mask = new_capacity - 1;
+	aggregate_entry *new_entries;
+	aggregate_entry *entry, *end;
+	size_t index;
+
+	new_entries = (aggregate_entry*)calloc(new_capacity, sizeof(aggregate_entry));
+	if (new_entries == NULL) {
+		fprintf(stderr, "Cannot allocate memory\n");
+		return 0;
+	}
+
+	entry = aggr->entries;
+	end = entry + aggr->capacity;
+
+	while (entry < end) {
+		if (entry->key != NULL) {
+			index = entry->hash & mask;
+			while (new_entries[index].key != NULL) {
+				index = (index + 1) & mask;
+			}
+			new_entries[index] = *entry;
+		}
+		entry++;
+	}
+
+	free(aggr->entries);
+	aggr->entries = new_entries;
+	aggr->capacity = new_capacity;
+	return 1;
+}
+
+void aggregate_match(pcresp_ctx *ctx, const char *subject, PCRE2_SIZE *ovector, const char *mark)
+{
+	aggregate *aggr = ctx->aggregate;
+	aggregate_entry *entry;
+	const char *key;
+	size_t length, mask, index;
+	uint32_t hash;
+	double value;
+	char *end;
+	int i;
+
+	if (!expand_template(ctx, aggr->key, subject, ovector, mark, &aggr->key_buffer)) {
+		return;
+	}
+
+	key = aggr->key_buffer.data;
+	length = aggr->key_buffer.length;
+	hash = hash_bytes(key, length);
+	mask = aggr->capacity - 1;
+	index = hash & mask;
+
+	while (1) {
+		entry = aggr->entries + index;
+
+		if (entry->key == NULL) {
+			break;
+		}
+
+		if (entry->hash == hash && entry->key_length == length
+				&& memcmp(entry->key, key, length) == 0) {
+			break;
+		}
+
+		index = (index + 1) & mask;
+	}
+
+	if (entry->key == NULL) {
+		/* The table is at most half full. */
+		if ((aggr->count + 1) * 2 > aggr->capacity) {
+			if (!grow_table(aggr)) {
+				return;
+			}
+
+			mask = aggr->capacity - 1;
+			index = hash & mask;
+			while (aggr->entries[index].key != NULL) {
+				index = (index + 1) & mask;
+			}
+			entry = aggr->entries + index;
+		}
+
+		entry->key = intern_key(aggr, key, length);
+		if (entry->key == NULL) {
+			return;
+		}
+
+		entry->key_length = length;
+		entry->hash = hash;
+		aggr->count++;
+
+		if (aggr->unique) {
+			fwrite(key, 1, length, ctx->output);
+			fputs("\n", ctx->output);
+		}
+	}
+
+	entry->count++;
+
+	for (i = 0; i < AGGREGATE_VALUES; i++) {
+		if (aggr->values[i] == NULL) {
+			continue;
+		}
+
+		if (!expand_template(ctx, aggr->values[i], subject, ovector, mark, &aggr->value_buffer)
+				|| !buffer_append(&aggr->value_buffer, "", 1)) {
+			return;
+		}
+
+		value = strtod(aggr->value_buffer.data, &end);
+
+		/* Values which are not numbers are ignored. */
+		if (end == aggr->value_buffer.data) {
+			continue;
+		}
+
+		if (!(entry->value_flags & (1u << i))) {
+			entry->values[i] = value;
+			entry->value_flags |= (1u << i);
+		}
+		else if (i == AGGREGATE_SUM) {
+			entry->values[i] += value;
+		}
+		else if ((i == AGGREGATE_MIN) ? (value < entry->values[i]) : (value > entry->values[i])) {
+			entry->values[i] = value;
+		}
+	}
+}
+
+static int compare_key(const void *left_ptr, const void *right_ptr)
+{
+	const aggregate_entry *left = *(const aggregate_entry * const *)left_ptr;
+	const aggregate_entry *right = *(const aggregate_entry * const *)right_ptr;
+	size_t length = left->key_length < right->key_length ? left->key_length : right->key_length;
+	int result = memcmp(left->key, right->key, length);
+
+	if (result != 0) {
+		return result;
+	}
+	return (left->key_length > right->key_length) - (left->key_length < right->key_length);
+}
+
+static int compare_count(const void *left_ptr, const void *right_ptr)
+{
+	const aggregate_entry *left = *(const aggregate_entry * const *)left_ptr;
+	const aggregate_entry *right = *(const aggregate_entry * const *)right_ptr;
+
+	if (left->count != right->count) {
+		return left->count < right->count ? 1 : -1;
+	}
+	return compare_key(left_ptr, right_ptr);
+}
+
+static int compare_value(const void *left_ptr, const void *right_ptr, int i)
+{
+	const aggregate_entry *left = *(const aggregate_entry * const *)left_ptr;
+	const aggregate_entry *right = *(const aggregate_entry * const *)right_ptr;
+	uint32_t left_set = left->value_flags & (1u << i);
+	uint32_t right_set = right->value_flags & (1u << i);
+
+	/* Entries without value are listed last. */
+	if (left_set != right_set) {
+		return left_set ? -1 : 1;
+	}
+
+	if (left_set && left->values[i] != right->values[i]) {
+		return left->values[i] < right->values[i] ? 1 : -1;
+	}
+	return compare_key(left_ptr, right_ptr);
+}
+
+static int compare_sum(const void *left_ptr, const void *right_ptr)
+{
+	return compare_value(left_ptr, right_ptr, AGGREGATE_SUM);
+}
+
+static int compare_min(const void *left_ptr, const void *right_ptr)
+{
+	return compare_value(left_ptr, right_ptr, AGGREGATE_MIN);
+}
+
+static int compare_max(const void *left_ptr, const void *right_ptr)
+{
+	return compare_value(left_ptr, right_ptr, AGGREGATE_MAX);
+}
+
+/* Prints the aggregates collected since the previous call. */
+void print_aggregate(pcresp_ctx *ctx)
+{
+	aggregate *aggr = ctx->aggregate;
+	aggregate_entry **list, **list_end, **current;
+	aggregate_entry *entry, *end;
+	int i;
+
+	if (aggr == NULL || aggr->unique || aggr->count == 0) {
+		return;
+	}
+
+	list = (aggregate_entry**)malloc(aggr->count * sizeof(aggregate_entry*));
+	if (list == NULL) {
+		fprintf(stderr, "Cannot allocate memory\n");
+		return;
+	}
+
+	list_end = list;
+	entry = aggr->entries;
+	end = entry + aggr->capacity;
+
+	while (entry < end) {
+		if (entry->key != NULL) {
+			*list_end++ = entry;
+		}
+		entry++;
+	}
+
+	switch (aggr->sort) {
+	case PCRESP_SORT_COUNT:
+		qsort(list, aggr->count, sizeof(aggregate_entry*), compare_count);
+		break;
+	case PCRESP_SORT_SUM:
+		qsort(list, aggr->count, sizeof(aggregate_entry*), compare_sum);
+		break;
+	case PCRESP_SORT_MIN:
+		qsort(list, aggr->count, sizeof(aggregate_entry*), compare_min);
+		break;
+	case PCRESP_SORT_MAX:
+		qsort(list, aggr->count, sizeof(aggregate_entry*), compare_max);
+		break;
+	default:
+		qsort(list, aggr->count, sizeof(aggregate_entry*), compare_key);
+		break;
+	}
+
+	for (current = list; current < list_end; current++) {
+		entry = *current;
+
+		fwrite(entry->key, 1, entry->key_length, ctx->output);
+		fprintf(ctx->output, "\t%lu", (unsigned long)entry->count);
+
+		for (i = 0; i < AGGREGATE_VALUES; i++) {
+			if (aggr->values[i] == NULL) {
+				continue;
+			}
+
+			if (entry->value_flags & (1u << i)) {
+				fprintf(ctx->output, "\t%.15g", entry->values[i]);
+			}
+			else {
+				fputs("\t", ctx->output);
+			}
+		}
+		fputs("\n", ctx->output);
+	}
+
+	free(list);
+
+	memset(aggr->entries, 0, aggr->capacity * sizeof(aggregate_entry));
+	aggr->count = 0;
+	free_chunks(aggr);
+}
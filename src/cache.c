@@ -0,0 +1,473 @@
+/*
+ *    Stream processing tool
+ *
+ *    Copyright 2016 Zoltan Herczeg (hzmester@freemail.hu). All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are
+ * permitted provided that the following conditions are met:
+ *
+ *   1. Redistributions of source code must retain the above copyright notice, this list of
+ *      conditions and the following disclaimer.
+ *
+ *   2. Redistributions in binary form must reproduce the above copyright notice, this list
+ *      of conditions and the following disclaimer in the documentation and/or other materials
+ *      provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDER(S) AND CONTRIBUTORS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT
+ * SHALL THE COPYRIGHT HOLDER(S) OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "pcresp.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+/* Match result cache. Each entry is stored in a separate file, which
+ * name is the hash of its key. The entry starts with a header, followed
+ * by the matches. Offsets and lengths are stored as variable length
+ * integers (7 bits per byte), where the offsets are encoded as value+1,
+ * so 0 represents an unset capture. The last use time of an entry is
+ * its modification time, and the least recently used entries are
+ * removed by pcresp_flush. */
+
+#define CACHE_MAGIC "PCRESPC1"
+#define CACHE_NAME_LENGTH 16
+
+typedef struct cache_header {
+	char magic[8];
+	uint64_t device;
+	uint64_t inode;
+	uint64_t size;
+	uint64_t mtime_sec;
+	uint64_t mtime_nsec;
+	uint64_t pattern_hash;
+	uint32_t match_count;
+	uint32_t pair_count;
+} cache_header;
+
+typedef struct cache_file {
+	struct timespec mtime;
+	char name[CACHE_NAME_LENGTH + 1];
+} cache_file;
+
+static uint64_t hash64(uint64_t hash, const void *data, size_t length)
+{
+	/* FNV-1a */
+	const uint8_t *chars = (const uint8_t*)data;
+	const uint8_t *end = chars + length;
+
+	while (chars < end) {
+		hash = (hash ^ *chars++) * 1099511628211ull;
+	}
+	return hash;
+}
+
+static void init_header(pcresp_ctx *ctx, cache_header *header, struct stat *st)
+{
+	memset(header, 0, sizeof(cache_header));
+	memcpy(header->magic, CACHE_MAGIC, sizeof(header->magic));
+	header->device = (uint64_t)st->st_dev;
+	header->inode = (uint64_t)st->st_ino;
+	header->size = (uint64_t)st->st_size;
+	header->mtime_sec = (uint64_t)st->st_mtim.tv_sec;
+	header->mtime_nsec = (uint64_t)st->st_mtim.tv_nsec;
+	header->pattern_hash = ctx->cache.pattern_hash;
+	header->pair_count = ctx->ovector_size;
+}
+
+static void get_name(cache_header *header, char *name)
+{
+	static const char hex_digits[] = "0123456789abcdef";
+	uint64_t hash = hash64(14695981039346656037ull, header, offsetof(cache_header, match_count));
+	int i;
+
+	for (i = CACHE_NAME_LENGTH - 1; i >= 0; i--) {
+		name[i] = hex_digits[hash & 0xf];
+		hash >>= 4;
+	}
+	name[CACHE_NAME_LENGTH] = '\0';
+}
+
+static int reserve_header(string_buffer *buffer)
+{
+	cache_header header;
+
+	memset(&header, 0, sizeof(cache_header));
+	return buffer_append(buffer, (const char*)&header, sizeof(cache_header));
+}
+
+static int append_number(string_buffer *buffer, uint64_t value)
+{
+	char data[10];
+	size_t length = 0;
+
+	while (value >= 0x80) {
+		data[length++] = (char)(value | 0x80);
+		value >>= 7;
+	}
+	data[length++] = (char)value;
+	return buffer_append(buffer, data, length);
+}
+
+static const uint8_t *read_number(const uint8_t *data, const uint8_t *end, uint64_t *value)
+{
+	uint64_t result = 0;
+	int shift = 0;
+
+	while (data < end && shift < 64) {
+		result |= (uint64_t)(*data & 0x7f) << shift;
+		if (!(*data++ & 0x80)) {
+			*value = result;
+			return data;
+		}
+		shift += 7;
+	}
+	return NULL;
+}
+
+/* Returns with the end of the match or NULL if the data is invalid. */
+static const uint8_t *read_match(pcresp_ctx *ctx, const uint8_t *data, const uint8_t *end,
+	PCRE2_SIZE *ovector, const char **mark)
+{
+	uint64_t value;
+	uint32_t i;
+
+	for (i = 0; i < ctx->ovector_size * 2; i++) {
+		data = read_number(data, end, &value);
+		if (data == NULL || value > (uint64_t)ctx->subject_size + 1) {
+			return NULL;
+		}
+		ovector[i] = (value == 0) ? PCRE2_UNSET : (PCRE2_SIZE)(value - 1);
+	}
+
+	data = read_number(data, end, &value);
+	if (data == NULL) {
+		return NULL;
+	}
+
+	*mark = NULL;
+	if (value > 0) {
+		/* The mark is followed by a NUL character. */
+		if (value > (uint64_t)(end - data) || data[value - 1] != '\0') {
+			return NULL;
+		}
+		*mark = (const char*)data;
+		data += value;
+	}
+	return data;
+}
+
+int pcresp_set_cache_dir(pcresp_ctx *ctx, const char *dir)
+{
+	if (ctx->cache.dir_fd >= 0) {
+		close(ctx->cache.dir_fd);
+	}
+
+	if (mkdir(dir, 0777) != 0 && errno != EEXIST) {
+		fprintf(stderr, "Cannot create cache directory: %s\n", dir);
+		ctx->cache.dir_fd = -1;
+		return 0;
+	}
+
+	ctx->cache.dir_fd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (ctx->cache.dir_fd < 0) {
+		fprintf(stderr, "Cannot open cache directory: %s\n", dir);
+		return 0;
+	}
+	return 1;
+}
+
+void pcresp_set_cache_size(pcresp_ctx *ctx, size_t max_entries)
+{
+	ctx->cache.max_entries = max_entries;
+}
+
+void init_cache(pcresp_ctx *ctx, const char *pattern, uint32_t options, int newline, int bsr)
+{
+	uint32_t settings[11];
+	const char *reason = NULL;
+
+	/* The replayed matches are not found by pcre2_match, so the
+	 * callout scripts are not run, and plugins may have side
+	 * effects which are not repeated. */
+	if (ctx->callout_count > 0) {
+		reason = "pattern has callouts";
+	}
+	else if (ctx->plugins != NULL) {
+		reason = "scripts use plugins";
+	}
+
+	if (reason != NULL) {
+		if (ctx->verbose) {
+			fprintf(stderr, "Verbose: cache is disabled, %s\n", reason);
+		}
+		close(ctx->cache.dir_fd);
+		ctx->cache.dir_fd = -1;
+		return;
+	}
+
+	settings[0] = options;
+	settings[1] = (uint32_t)newline;
+	settings[2] = (uint32_t)bsr;
+	settings[3] = (uint32_t)ctx->engine;
+	settings[4] = (uint32_t)ctx->match_limit;
+	settings[5] = ctx->backtrack_limit;
+	settings[6] = ctx->heap_limit;
+	settings[7] = ctx->ovector_size;
+	settings[8] = PCRE2_MAJOR;
+	settings[9] = PCRE2_MINOR;
+	settings[10] = (ctx->keywords != NULL) ? keyword_hash(ctx) : 0;
+
+	ctx->cache.pattern_hash = hash64(14695981039346656037ull, pattern, strlen(pattern));
+	ctx->cache.pattern_hash = hash64(ctx->cache.pattern_hash, settings, sizeof(settings));
+}
+
+int cache_lookup(pcresp_ctx *ctx, struct stat *st)
+{
+	cache_header expected;
+	cache_header *header;
+	struct stat entry_st;
+	char name[CACHE_NAME_LENGTH + 1];
+	const uint8_t *data, *end;
+	PCRE2_SIZE *ovector = pcre2_get_ovector_pointer(ctx->match_data);
+	const char *mark;
+	ssize_t length;
+	size_t size;
+	uint32_t i;
+	int fd;
+
+	ctx->cache.replay = NULL;
+	init_header(ctx, &expected, st);
+	get_name(&expected, name);
+
+	fd = openat(ctx->cache.dir_fd, name, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		return 0;
+	}
+
+	if (fstat(fd, &entry_st) != 0 || entry_st.st_size < (off_t)sizeof(cache_header)) {
+		close(fd);
+		return 0;
+	}
+
+	size = (size_t)entry_st.st_size;
+	if (size > ctx->cache.entry_max) {
+		free(ctx->cache.entry);
+		ctx->cache.entry = (char*)malloc(size);
+		ctx->cache.entry_max = (ctx->cache.entry != NULL) ? size : 0;
+		if (ctx->cache.entry == NULL) {
+			close(fd);
+			return 0;
+		}
+	}
+
+	length = read(fd, ctx->cache.entry, size);
+	close(fd);
+
+	header = (cache_header*)ctx->cache.entry;
+	if (length != (ssize_t)size || memcmp(header, &expected, offsetof(cache_header, match_count)) != 0
+			|| header->pair_count != ctx->ovector_size) {
+		return 0;
+	}
+
+	/* Validate the matches before they are replayed. */
+	data = (const uint8_t*)(header + 1);
+	end = (const uint8_t*)ctx->cache.entry + size;
+	ctx->subject_size = (size_t)st->st_size;
+
+	for (i = 0; i < header->match_count; i++) {
+		data = read_match(ctx, data, end, ovector, &mark);
+		if (data == NULL) {
+			return 0;
+		}
+	}
+
+	if (data != end) {
+		return 0;
+	}
+
+	/* Mark the entry as recently used. */
+	utimensat(ctx->cache.dir_fd, name, NULL, 0);
+
+	ctx->cache.replay = (const uint8_t*)(header + 1);
+	ctx->cache.replay_end = end;
+	ctx->cache.match_count = header->match_count;
+
+	return 1;
+}
+
+int cache_next(pcresp_ctx *ctx, PCRE2_SIZE *ovector, const char **mark)
+{
+	if (ctx->cache.replay >= ctx->cache.replay_end) {
+		return 0;
+	}
+
+	ctx->cache.replay = read_match(ctx, ctx->cache.replay, ctx->cache.replay_end, ovector, mark);
+	return ctx->cache.replay != NULL;
+}
+
+void cache_record(pcresp_ctx *ctx, PCRE2_SIZE *ovector, const char *mark)
+{
+	string_buffer *record = &ctx->cache.record;
+	size_t length;
+	uint32_t i;
+
+	if (record->length == 0 && !reserve_header(record)) {
+		ctx->cache.recording = 0;
+		return;
+	}
+
+	for (i = 0; i < ctx->ovector_size * 2; i++) {
+		if (!append_number(record, (ovector[i] == PCRE2_UNSET) ? 0 : (uint64_t)ovector[i] + 1)) {
+			ctx->cache.recording = 0;
+			return;
+		}
+	}
+
+	length = (mark != NULL) ? strlen(mark) + 1 : 0;
+	if (!append_number(record, length) || (length > 0 && !buffer_append(record, mark, length))) {
+		ctx->cache.recording = 0;
+		return;
+	}
+
+	ctx->cache.match_count++;
+}
+
+void cache_start(pcresp_ctx *ctx)
+{
+	ctx->cache.recording = 1;
+	ctx->cache.record.length = 0;
+	ctx->cache.match_count = 0;
+}
+
+void cache_store(pcresp_ctx *ctx, struct stat *st)
+{
+	string_buffer *record = &ctx->cache.record;
+	cache_header header;
+	char name[CACHE_NAME_LENGTH + 1];
+	char tmp_name[32];
+	ssize_t length;
+	int fd;
+
+	if (!ctx->cache.recording) {
+		return;
+	}
+
+	ctx->cache.recording = 0;
+
+	if (record->length == 0 && !reserve_header(record)) {
+		return;
+	}
+
+	init_header(ctx, &header, st);
+	header.match_count = ctx->cache.match_count;
+	memcpy(record->data, &header, sizeof(cache_header));
+	get_name(&header, name);
+
+	/* Concurrent runs never see partially written entries. */
+	sprintf(tmp_name, ".tmp%ld", (long)getpid());
+	fd = openat(ctx->cache.dir_fd, tmp_name, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+	if (fd < 0) {
+		return;
+	}
+
+	length = write(fd, record->data, record->length);
+	close(fd);
+
+	if (length != (ssize_t)record->length
+			|| renameat(ctx->cache.dir_fd, tmp_name, ctx->cache.dir_fd, name) != 0) {
+		unlinkat(ctx->cache.dir_fd, tmp_name, 0);
+		return;
+	}
+
+	ctx->cache.stored++;
+}
+
+static int compare_files(const void *left, const void *right)
+{
+	const struct timespec *left_mtime = &((const cache_file*)left)->mtime;
+	const struct timespec *right_mtime = &((const cache_file*)right)->mtime;
+
+	if (left_mtime->tv_sec != right_mtime->tv_sec) {
+		return (left_mtime->tv_sec > right_mtime->tv_sec) ? 1 : -1;
+	}
+	return (left_mtime->tv_nsec > right_mtime->tv_nsec) - (left_mtime->tv_nsec < right_mtime->tv_nsec);
+}
+
+void evict_cache(pcresp_ctx *ctx)
+{
+	cache_file *files = NULL;
+	cache_file *new_files;
+	size_t count = 0, max = 0, i;
+	struct dirent *entry;
+	struct stat st;
+	DIR *dir;
+	int fd;
+
+	if (ctx->cache.stored == 0) {
+		return;
+	}
+
+	ctx->cache.stored = 0;
+
+	fd = fcntl(ctx->cache.dir_fd, F_DUPFD_CLOEXEC, 0);
+	dir = (fd >= 0) ? fdopendir(fd) : NULL;
+	if (dir == NULL) {
+		if (fd >= 0) {
+			close(fd);
+		}
+		return;
+	}
+
+	rewinddir(dir);
+	while ((entry = readdir(dir)) != NULL) {
+		if (strlen(entry->d_name) != CACHE_NAME_LENGTH
+				|| fstatat(ctx->cache.dir_fd, entry->d_name, &st, 0) != 0) {
+			continue;
+		}
+
+		if (count >= max) {
+			max = (max == 0) ? 256 : max * 2;
+			new_files = (cache_file*)realloc(files, max * sizeof(cache_file));
+			if (new_files == NULL) {
+				break;
+			}
+			files = new_files;
+		}
+
+		files[count].mtime = st.st_mtim;
+		memcpy(files[count].name, entry->d_name, CACHE_NAME_LENGTH + 1);
+		count++;
+	}
+
+	closedir(dir);
+
+	if (count > ctx->cache.max_entries) {
+		qsort(files, count, sizeof(cache_file), compare_files);
+
+		for (i = 0; i < count - ctx->cache.max_entries; i++) {
+			unlinkat(ctx->cache.dir_fd, files[i].name, 0);
+		}
+	}
+
+	free(files);
+}
+
+void free_cache(pcresp_ctx *ctx)
+{
+	if (ctx->cache.dir_fd >= 0) {
+		close(ctx->cache.dir_fd);
+	}
+	free(ctx->cache.entry);
+	free(ctx->cache.record.data);
+}
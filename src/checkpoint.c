@@ -0,0 +1,198 @@
+/*
+ *    Stream processing tool
+ *
+ *    Copyright 2016 Zoltan Herczeg (hzmester@freemail.hu). All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are
+ * permitted provided that the following conditions are met:
+ *
+ *   1. Redistributions of source code must retain the above copyright notice, this list of
+ *      conditions and the following disclaimer.
+ *
+ *   2. Redistributions in binary form must reproduce the above copyright notice, this list
+ *      of conditions and the following disclaimer in the documentation and/or other materials
+ *      provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDER(S) AND CONTRIBUTORS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT
+ * SHALL THE COPYRIGHT HOLDER(S) OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "pcresp.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+/* Checkpoint file of incremental scans. Each line contains the inode
+ * of an input file, the offset after its last processed line, and
+ * its path, separated by spaces. */
+
+static checkpoint_entry *add_entry(checkpoint_list *checkpoint, const char *path,
+	size_t length, uint64_t inode, uint64_t offset)
+{
+	checkpoint_entry *entries = checkpoint->entries;
+	checkpoint_entry *entry;
+
+	if (checkpoint->count >= checkpoint->max) {
+		checkpoint->max = (checkpoint->max == 0) ? 64 : checkpoint->max * 2;
+		entries = (checkpoint_entry*)realloc(entries, checkpoint->max * sizeof(checkpoint_entry));
+		if (entries == NULL) {
+			fprintf(stderr, "Cannot allocate memory\n");
+			return NULL;
+		}
+		checkpoint->entries = entries;
+	}
+
+	entry = entries + checkpoint->count;
+	entry->path = (char*)malloc(length + 1);
+	if (entry->path == NULL) {
+		fprintf(stderr, "Cannot allocate memory\n");
+		return NULL;
+	}
+
+	memcpy(entry->path, path, length);
+	entry->path[length] = '\0';
+	entry->inode = inode;
+	entry->offset = offset;
+	checkpoint->count++;
+	return entry;
+}
+
+int pcresp_set_checkpoint(pcresp_ctx *ctx, const char *file_name)
+{
+	checkpoint_list *checkpoint = &ctx->checkpoint;
+	char line[4096 + 64];
+	unsigned long long inode, offset;
+	int path_start;
+	size_t length;
+	FILE *f;
+
+	checkpoint->file_name = file_name;
+
+	f = fopen(file_name, "r");
+	if (f == NULL) {
+		if (errno == ENOENT) {
+			return 1;
+		}
+		fprintf(stderr, "Cannot open checkpoint file: %s\n", file_name);
+		return 0;
+	}
+
+	while (fgets(line, sizeof(line), f) != NULL) {
+		length = strlen(line);
+		path_start = 0;
+
+		if (length == 0 || line[length - 1] != '\n'
+				|| sscanf(line, "%llu %llu %n", &inode, &offset, &path_start) != 2
+				|| path_start == 0 || (size_t)path_start >= length - 1) {
+			fprintf(stderr, "Invalid checkpoint file: %s\n", file_name);
+			fclose(f);
+			return 0;
+		}
+
+		if (add_entry(checkpoint, line + path_start, length - 1 - (size_t)path_start,
+				(uint64_t)inode, (uint64_t)offset) == NULL) {
+			fclose(f);
+			return 0;
+		}
+	}
+
+	fclose(f);
+	return 1;
+}
+
+checkpoint_entry *get_checkpoint(pcresp_ctx *ctx, const char *path)
+{
+	checkpoint_list *checkpoint = &ctx->checkpoint;
+	size_t i, index;
+
+	/* Inputs are usually processed in the same order as in the previous run. */
+	for (i = 0; i < checkpoint->count; i++) {
+		index = checkpoint->next + i;
+		if (index >= checkpoint->count) {
+			index -= checkpoint->count;
+		}
+
+		if (strcmp(checkpoint->entries[index].path, path) == 0) {
+			checkpoint->next = index + 1;
+			return checkpoint->entries + index;
+		}
+	}
+
+	/* Paths containing newlines cannot be stored. */
+	if (strchr(path, '\n') != NULL) {
+		return NULL;
+	}
+
+	return add_entry(checkpoint, path, strlen(path), 0, 0);
+}
+
+void commit_checkpoint(pcresp_ctx *ctx)
+{
+	checkpoint_list *checkpoint = &ctx->checkpoint;
+	string_buffer *tmp_name = &checkpoint->tmp_name;
+	checkpoint_entry *entry, *end;
+	FILE *f;
+	int result;
+
+	if (!checkpoint->modified) {
+		return;
+	}
+
+	/* Results which are not written must be processed again. */
+	if (ferror(ctx->output) || ctx->cancelled == CANCEL_OUTPUT) {
+		fprintf(stderr, "Output error: checkpoint file is not updated\n");
+		return;
+	}
+
+	tmp_name->length = 0;
+	if (!buffer_append(tmp_name, checkpoint->file_name, strlen(checkpoint->file_name))
+			|| !buffer_append(tmp_name, ".tmp", 5)) {
+		return;
+	}
+
+	f = fopen(tmp_name->data, "w");
+	if (f == NULL) {
+		fprintf(stderr, "Cannot create checkpoint file: %s\n", tmp_name->data);
+		return;
+	}
+
+	entry = checkpoint->entries;
+	end = entry + checkpoint->count;
+
+	while (entry < end) {
+		fprintf(f, "%llu %llu %s\n", (unsigned long long)entry->inode,
+			(unsigned long long)entry->offset, entry->path);
+		entry++;
+	}
+
+	result = (fflush(f) == 0 && !ferror(f) && fsync(fileno(f)) == 0);
+	result = (fclose(f) == 0) && result;
+
+	if (!result || rename(tmp_name->data, checkpoint->file_name) != 0) {
+		fprintf(stderr, "Cannot write checkpoint file: %s\n", checkpoint->file_name);
+		unlink(tmp_name->data);
+		return;
+	}
+
+	checkpoint->modified = 0;
+}
+
+void free_checkpoint(pcresp_ctx *ctx)
+{
+	checkpoint_list *checkpoint = &ctx->checkpoint;
+	size_t i;
+
+	for (i = 0; i < checkpoint->count; i++) {
+		free(checkpoint->entries[i].path);
+	}
+	free(checkpoint->entries);
+	free(checkpoint->tmp_name.data);
+}
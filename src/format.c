@@ -0,0 +1,378 @@
+/*
+ *    Stream processing tool
+ *
+ *    Copyright 2016 Zoltan Herczeg (hzmester@freemail.hu). All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are
+ * permitted provided that the following conditions are met:
+ *
+ *   1. Redistributions of source code must retain the above copyright notice, this list of
+ *      conditions and the following disclaimer.
+ *
+ *   2. Redistributions in binary form must reproduce the above copyright notice, this list
+ *      of conditions and the following disclaimer in the documentation and/or other materials
+ *      provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDER(S) AND CONTRIBUTORS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT
+ * SHALL THE COPYRIGHT HOLDER(S) OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "pcresp.h"
+
+/* Structured output of the matches. Each record is
+ * serialized into a buffer, and written by a single call. */
+
+/* Non-zero for characters which need escaping. The bytes of
+ * non-ASCII characters are checked by utf8_length. */
+static const uint8_t json_escape[256] = {
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+	0, 0, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1,
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+};
+
+static const char hex_digits[] = "0123456789abcdef";
+
+/* Returns the length of the valid UTF-8 character at chars,
+ * or zero if the byte sequence is invalid. */
+static size_t utf8_length(const uint8_t *chars, const uint8_t *end)
+{
+	uint8_t chr = chars[0];
+	uint8_t min = 0x80, max = 0xbf;
+	size_t length, i;
+
+	if (chr < 0xc2 || chr > 0xf4) {
+		return 0;
+	}
+
+	if (chr < 0xe0) {
+		length = 2;
+	}
+	else if (chr < 0xf0) {
+		length = 3;
+		/* Overlong forms and surrogates. */
+		if (chr == 0xe0) {
+			min = 0xa0;
+		}
+		else if (chr == 0xed) {
+			max = 0x9f;
+		}
+	}
+	else {
+		length = 4;
+		/* Overlong forms and characters above U+10FFFF. */
+		if (chr == 0xf0) {
+			min = 0x90;
+		}
+		else if (chr == 0xf4) {
+			max = 0x8f;
+		}
+	}
+
+	if ((size_t)(end - chars) < length || chars[1] < min || chars[1] > max) {
+		return 0;
+	}
+
+	for (i = 2; i < length; i++) {
+		if (chars[i] < 0x80 || chars[i] > 0xbf) {
+			return 0;
+		}
+	}
+	return length;
+}
+
+static int append_json_string(string_buffer *buffer, const char *chars, size_t length)
+{
+	const char *end = chars + length;
+	const char *start;
+	char escape[6];
+	size_t escape_length, char_length;
+	uint8_t chr;
+
+	if (!buffer_append(buffer, "\"", 1)) {
+		return 0;
+	}
+
+	while (chars < end) {
+		start = chars;
+		while (chars < end && !json_escape[(uint8_t)*chars]) {
+			chars++;
+		}
+
+		if (chars > start && !buffer_append(buffer, start, chars - start)) {
+			return 0;
+		}
+
+		if (chars >= end) {
+			break;
+		}
+
+		chr = (uint8_t)*chars;
+
+		if (chr >= 0x80) {
+			/* Invalid UTF-8 bytes are replaced by U+FFFD. */
+			char_length = utf8_length((const uint8_t*)chars, (const uint8_t*)end);
+			if (char_length == 0) {
+				if (!buffer_append(buffer, "\\ufffd", 6)) {
+					return 0;
+				}
+				chars++;
+				continue;
+			}
+
+			if (!buffer_append(buffer, chars, char_length)) {
+				return 0;
+			}
+			chars += char_length;
+			continue;
+		}
+
+		chars++;
+		escape[0] = '\\';
+		escape_length = 2;
+
+		switch (chr) {
+		case '"':
+		case '\\':
+			escape[1] = (char)chr;
+			break;
+		case '\n':
+			escape[1] = 'n';
+			break;
+		case '\r':
+			escape[1] = 'r';
+			break;
+		case '\t':
+			escape[1] = 't';
+			break;
+		default:
+			escape[1] = 'u';
+			escape[2] = '0';
+			escape[3] = '0';
+			escape[4] = hex_digits[chr >> 4];
+			escape[5] = hex_digits[chr & 0xf];
+			escape_length = 6;
+			break;
+		}
+
+		if (!buffer_append(buffer, escape, escape_length)) {
+			return 0;
+		}
+	}
+
+	return buffer_append(buffer, "\"", 1);
+}
+
+static int append_tsv_field(string_buffer *buffer, const char *chars, size_t length)
+{
+	const char *end = chars + length;
+	const char *start;
+	char escape[2];
+
+	while (chars < end) {
+		start = chars;
+		while (chars < end && *chars != '\t' && *chars != '\n' && *chars != '\r' && *chars != '\\') {
+			chars++;
+		}
+
+		if (chars > start && !buffer_append(buffer, start, chars - start)) {
+			return 0;
+		}
+
+		if (chars >= end) {
+			break;
+		}
+
+		escape[0] = '\\';
+		switch (*chars++) {
+		case '\t':
+			escape[1] = 't';
+			break;
+		case '\n':
+			escape[1] = 'n';
+			break;
+		case '\r':
+			escape[1] = 'r';
+			break;
+		default:
+			escape[1] = '\\';
+			break;
+		}
+
+		if (!buffer_append(buffer, escape, 2)) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+static int append_field(pcresp_ctx *ctx, const char *chars, size_t length, int is_set)
+{
+	string_buffer *buffer = &ctx->format_buffer;
+
+	switch (ctx->format) {
+	case PCRESP_FORMAT_JSONL:
+		if (!is_set) {
+			return buffer_append(buffer, "null", 4);
+		}
+		return append_json_string(buffer, chars, length);
+	case PCRESP_FORMAT_TSV:
+		return append_tsv_field(buffer, chars, length);
+	default:
+		/* Each field is terminated by a NUL character. */
+		return buffer_append(buffer, chars, length) && buffer_append(buffer, "", 1);
+	}
+}
+
+static int append_capture(pcresp_ctx *ctx, const char *subject, PCRE2_SIZE *ovector, uint32_t capture_id)
+{
+	PCRE2_SIZE start = ovector[capture_id * 2];
+	PCRE2_SIZE end = ovector[capture_id * 2 + 1];
+
+	if (start == PCRE2_UNSET) {
+		return append_field(ctx, NULL, 0, 0);
+	}
+
+	return append_field(ctx, subject + start, end > start ? end - start : 0, 1);
+}
+
+int init_format(pcresp_ctx *ctx)
+{
+	if (ctx->default_script != NULL || ctx->aggregate != NULL || ctx->sketch != NULL) {
+		fprintf(stderr, "--format cannot be combined with scripts or aggregation\n");
+		return 0;
+	}
+
+	pcre2_pattern_info(ctx->re_code, PCRE2_INFO_NAMECOUNT, &ctx->name_count);
+	pcre2_pattern_info(ctx->re_code, PCRE2_INFO_NAMEENTRYSIZE, &ctx->name_entry_size);
+	pcre2_pattern_info(ctx->re_code, PCRE2_INFO_NAMETABLE, &ctx->name_table);
+	return 1;
+}
+
+void print_formatted(pcresp_ctx *ctx, const char *subject, PCRE2_SIZE *ovector, const char *mark)
+{
+	string_buffer *buffer = &ctx->format_buffer;
+	const char *name = ctx->input_name != NULL ? ctx->input_name : "";
+	const uint8_t *entry;
+	char number[32];
+	char line[32];
+	uint32_t i, capture_id;
+	int separator, length, line_length = 0;
+
+	buffer->length = 0;
+	separator = (ctx->format == PCRESP_FORMAT_TSV) ? '\t' : '\0';
+	length = sprintf(number, "%lu", (unsigned long)(ctx->input_offset + ovector[0]));
+	if (ctx->print_line_number) {
+		line_length = sprintf(line, "%lu", (unsigned long)ctx->line_number);
+	}
+
+	if (ctx->format == PCRESP_FORMAT_JSONL) {
+		if (!buffer_append(buffer, "{\"file\":", 8)
+				|| !append_json_string(buffer, name, strlen(name))
+				|| !buffer_append(buffer, ",\"offset\":", 10)
+				|| !buffer_append(buffer, number, (size_t)length)
+				|| (line_length > 0 && (!buffer_append(buffer, ",\"line\":", 8)
+					|| !buffer_append(buffer, line, (size_t)line_length)))
+				|| !buffer_append(buffer, ",\"match\":", 9)
+				|| !append_capture(ctx, subject, ovector, 0)
+				|| !buffer_append(buffer, ",\"captures\":[", 13)) {
+			return;
+		}
+
+		for (i = 1; i < ctx->ovector_size; i++) {
+			if ((i > 1 && !buffer_append(buffer, ",", 1))
+					|| !append_capture(ctx, subject, ovector, i)) {
+				return;
+			}
+		}
+
+		if (ctx->name_count > 0) {
+			if (!buffer_append(buffer, "],\"names\":{", 11)) {
+				return;
+			}
+
+			/* Each entry starts with a 16 bit big endian group number. */
+			entry = (const uint8_t*)ctx->name_table;
+			for (i = 0; i < ctx->name_count; i++) {
+				capture_id = ((uint32_t)entry[0] << 8) | entry[1];
+				if ((i > 0 && !buffer_append(buffer, ",", 1))
+						|| !append_json_string(buffer, (const char*)entry + 2, strlen((const char*)entry + 2))
+						|| !buffer_append(buffer, ":", 1)
+						|| !append_capture(ctx, subject, ovector, capture_id)) {
+					return;
+				}
+				entry += ctx->name_entry_size;
+			}
+
+			if (!buffer_append(buffer, "}", 1)) {
+				return;
+			}
+		}
+		else if (!buffer_append(buffer, "]", 1)) {
+			return;
+		}
+
+		if (!buffer_append(buffer, ",\"mark\":", 8)
+				|| !append_field(ctx, mark, mark != NULL ? strlen(mark) : 0, mark != NULL)
+				|| !buffer_append(buffer, "}\n", 2)) {
+			return;
+		}
+	}
+	else {
+		/* TSV and NUL: file, offset, line (--line-number), captures, mark. */
+		if (!append_field(ctx, name, strlen(name), 1)) {
+			return;
+		}
+
+		if (separator == '\t' && !buffer_append(buffer, "\t", 1)) {
+			return;
+		}
+
+		if (!append_field(ctx, number, (size_t)length, 1)) {
+			return;
+		}
+
+		if (line_length > 0 && ((separator == '\t' && !buffer_append(buffer, "\t", 1))
+				|| !append_field(ctx, line, (size_t)line_length, 1))) {
+			return;
+		}
+
+		for (i = 0; i < ctx->ovector_size; i++) {
+			if ((separator == '\t' && !buffer_append(buffer, "\t", 1))
+					|| !append_capture(ctx, subject, ovector, i)) {
+				return;
+			}
+		}
+
+		if ((separator == '\t' && !buffer_append(buffer, "\t", 1))
+				|| !append_field(ctx, mark, mark != NULL ? strlen(mark) : 0, mark != NULL)) {
+			return;
+		}
+
+		/* The records are terminated by a newline or an extra NUL. */
+		if (!buffer_append(buffer, separator == '\t' ? "\n" : "", 1)) {
+			return;
+		}
+	}
+
+	fwrite(buffer->data, 1, buffer->length, ctx->output);
+}
@@ -0,0 +1,195 @@
+/*
+ *    Stream processing tool
+ *
+ *    Copyright 2016 Zoltan Herczeg (hzmester@freemail.hu). All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are
+ * permitted provided that the following conditions are met:
+ *
+ *   1. Redistributions of source code must retain the above copyright notice, this list of
+ *      conditions and the following disclaimer.
+ *
+ *   2. Redistributions in binary form must reproduce the above copyright notice, this list
+ *      of conditions and the following disclaimer in the documentation and/or other materials
+ *      provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDER(S) AND CONTRIBUTORS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT
+ * SHALL THE COPYRIGHT HOLDER(S) OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "pcresp.h"
+
+#include <pthread.h>
+
+/* Adaptive JIT compilation (--jit auto). Small inputs are matched by
+ * the interpreter, since compiling large patterns may take longer than
+ * matching them. When the total input of a context is large enough,
+ * a copy of the pattern is compiled by a background thread, and the
+ * matching continues with the copy after the compilation is finished.
+ * The copy is used, because the compilation modifies the code, which
+ * is used by the interpreter in the meantime. The compilation is
+ * started by match() when the input reaches JIT_AUTO_MIN_SIZE. */
+
+struct jit_compiler {
+	pcre2_code *code;
+	pthread_mutex_t lock;
+	/* Read without locking by poll_jit. */
+	volatile int finished;
+	int compiled;
+	/* The context is freed before the compilation is finished,
+	 * and the thread frees the compiler. */
+	int abandoned;
+};
+
+void pcresp_set_jit(pcresp_ctx *ctx, int mode)
+{
+	ctx->jit_mode = mode;
+}
+
+static void free_compiler(jit_compiler *compiler)
+{
+	pcre2_code_free(compiler->code);
+	pthread_mutex_destroy(&compiler->lock);
+	free(compiler);
+}
+
+static void *compiler_thread(void *data)
+{
+	jit_compiler *compiler = (jit_compiler*)data;
+	int compiled, abandoned;
+
+	compiled = (pcre2_jit_compile(compiler->code, PCRE2_JIT_COMPLETE) == 0);
+
+	pthread_mutex_lock(&compiler->lock);
+	compiler->compiled = compiled;
+	compiler->finished = 1;
+	abandoned = compiler->abandoned;
+	pthread_mutex_unlock(&compiler->lock);
+
+	if (abandoned) {
+		free_compiler(compiler);
+	}
+	return NULL;
+}
+
+void init_jit(pcresp_ctx *ctx)
+{
+	ctx->match_code = ctx->re_code;
+
+	/* The DFA engine does not use JIT. */
+	if (ctx->jit_mode == PCRESP_JIT_NEVER || ctx->engine == PCRESP_ENGINE_DFA) {
+		return;
+	}
+
+	ctx->jit_stack = pcre2_jit_stack_create(64 * 1024, 8 * 1024 * 1024, NULL);
+	if (ctx->jit_stack == NULL) {
+		return;
+	}
+
+	pcre2_jit_stack_assign(ctx->match_context, NULL, ctx->jit_stack);
+
+	if (ctx->jit_mode == PCRESP_JIT_ALWAYS) {
+		/* Silently ignored if JIT compilation is failed */
+		pcre2_jit_compile(ctx->re_code, PCRE2_JIT_COMPLETE);
+		return;
+	}
+
+	ctx->jit_pending = 1;
+}
+
+void start_jit(pcresp_ctx *ctx)
+{
+	jit_compiler *compiler;
+	pthread_t thread;
+
+	/* Not tried again if the compilation cannot be started. */
+	ctx->jit_pending = 0;
+
+	compiler = (jit_compiler*)malloc(sizeof(jit_compiler));
+	if (compiler == NULL) {
+		return;
+	}
+
+	memset(compiler, 0, sizeof(jit_compiler));
+	compiler->code = pcre2_code_copy(ctx->re_code);
+	if (compiler->code == NULL) {
+		free(compiler);
+		return;
+	}
+
+	pthread_mutex_init(&compiler->lock, NULL);
+
+	if (pthread_create(&thread, NULL, compiler_thread, compiler) != 0) {
+		free_compiler(compiler);
+		return;
+	}
+
+	pthread_detach(thread);
+	ctx->jit_compiler = compiler;
+
+	if (ctx->verbose) {
+		fprintf(stderr, "Verbose: JIT compilation started in the background\n");
+	}
+}
+
+void poll_jit(pcresp_ctx *ctx)
+{
+	jit_compiler *compiler = ctx->jit_compiler;
+	int compiled;
+
+	if (!compiler->finished) {
+		return;
+	}
+
+	/* The lock makes the compiled code visible to this thread. */
+	pthread_mutex_lock(&compiler->lock);
+	compiled = compiler->compiled;
+	pthread_mutex_unlock(&compiler->lock);
+
+	if (compiled) {
+		ctx->match_code = compiler->code;
+		ctx->jit_code = compiler->code;
+		compiler->code = NULL;
+	}
+
+	free_compiler(compiler);
+	ctx->jit_compiler = NULL;
+
+	if (ctx->verbose) {
+		fprintf(stderr, compiled ? "Verbose: matching continues with JIT code\n"
+			: "Verbose: JIT compilation failed\n");
+	}
+}
+
+void free_jit(pcresp_ctx *ctx)
+{
+	jit_compiler *compiler = ctx->jit_compiler;
+	int finished;
+
+	if (ctx->jit_code != NULL) {
+		pcre2_code_free(ctx->jit_code);
+		ctx->jit_code = NULL;
+	}
+
+	if (compiler == NULL) {
+		return;
+	}
+
+	/* The running compilation cannot be stopped, and it is not waited for. */
+	pthread_mutex_lock(&compiler->lock);
+	finished = compiler->finished;
+	compiler->abandoned = 1;
+	pthread_mutex_unlock(&compiler->lock);
+
+	if (finished) {
+		free_compiler(compiler);
+	}
+	ctx->jit_compiler = NULL;
+}
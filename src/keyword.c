@@ -0,0 +1,495 @@
+/*
+ *    Stream processing tool
+ *
+ *    Copyright 2016 Zoltan Herczeg (hzmester@freemail.hu). All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are
+ * permitted provided that the following conditions are met:
+ *
+ *   1. Redistributions of source code must retain the above copyright notice, this list of
+ *      conditions and the following disclaimer.
+ *
+ *   2. Redistributions in binary form must reproduce the above copyright notice, this list
+ *      of conditions and the following disclaimer in the documentation and/or other materials
+ *      provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDER(S) AND CONTRIBUTORS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT
+ * SHALL THE COPYRIGHT HOLDER(S) OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "pcresp.h"
+
+/* Fixed string matching of many keywords with an Aho-Corasick
+ * automaton. The states are numbered in breadth first order, and
+ * the first (most frequently visited) states have a full transition
+ * table. The transitions of the other states are sorted by their
+ * character, and the failure links are followed when no transition
+ * is found. */
+
+#define KEYWORD_MAX_DENSE_STATES 4096
+
+typedef struct keyword_state {
+	uint32_t fail;
+	uint32_t first_edge;
+	uint32_t edge_count;
+	/* Length of the longest keyword ending in this state. */
+	uint32_t match_length;
+} keyword_state;
+
+struct keyword_set {
+	keyword_state *states;
+	uint32_t state_count;
+	uint32_t dense_count;
+	uint8_t *edge_chars;
+	uint32_t *edge_targets;
+	uint32_t *dense_rows;
+	size_t max_length;
+	int first_char;
+	uint32_t hash;
+	uint8_t fold[256];
+	uint8_t is_first_char[256];
+};
+
+typedef struct keyword {
+	const uint8_t *chars;
+	size_t length;
+} keyword;
+
+/* Temporary trie, the children are stored in a sorted list. */
+typedef struct trie_node {
+	uint32_t first_child;
+	uint32_t last_child;
+	uint32_t next_sibling;
+	uint32_t depth;
+	uint8_t chr;
+	uint8_t is_terminal;
+} trie_node;
+
+static int compare_keywords(const void *left, const void *right)
+{
+	const keyword *left_keyword = (const keyword*)left;
+	const keyword *right_keyword = (const keyword*)right;
+	size_t length = left_keyword->length;
+	int result;
+
+	if (length > right_keyword->length) {
+		length = right_keyword->length;
+	}
+
+	result = memcmp(left_keyword->chars, right_keyword->chars, length);
+	if (result != 0) {
+		return result;
+	}
+	return (left_keyword->length > right_keyword->length) - (left_keyword->length < right_keyword->length);
+}
+
+static uint32_t next_state(keyword_set *set, uint32_t state, uint8_t chr)
+{
+	const uint8_t *chars;
+	uint32_t low, high, mid;
+
+	while (1) {
+		if (state < set->dense_count) {
+			return set->dense_rows[(size_t)state * 256 + chr];
+		}
+
+		chars = set->edge_chars + set->states[state].first_edge;
+		low = 0;
+		high = set->states[state].edge_count;
+
+		while (low < high) {
+			mid = (low + high) >> 1;
+			if (chars[mid] == chr) {
+				return set->edge_targets[set->states[state].first_edge + mid];
+			}
+
+			if (chars[mid] < chr) {
+				low = mid + 1;
+			}
+			else {
+				high = mid;
+			}
+		}
+
+		state = set->states[state].fail;
+	}
+}
+
+static trie_node *build_trie(keyword *keywords, size_t keyword_count, uint32_t *node_count)
+{
+	trie_node *nodes;
+	trie_node *node;
+	uint32_t *path;
+	size_t max_nodes = 1, max_length = 0, i, depth, common;
+	uint32_t count = 1;
+
+	for (i = 0; i < keyword_count; i++) {
+		max_nodes += keywords[i].length;
+		if (keywords[i].length > max_length) {
+			max_length = keywords[i].length;
+		}
+	}
+
+	if (max_nodes > UINT32_MAX / 2) {
+		fprintf(stderr, "Too many keywords\n");
+		return NULL;
+	}
+
+	nodes = (trie_node*)malloc(max_nodes * sizeof(trie_node));
+	path = (uint32_t*)malloc((max_length + 1) * sizeof(uint32_t));
+
+	if (nodes == NULL || path == NULL) {
+		fprintf(stderr, "Cannot allocate memory\n");
+		free(nodes);
+		free(path);
+		return NULL;
+	}
+
+	memset(nodes, 0, sizeof(trie_node));
+	path[0] = 0;
+
+	/* The keywords are sorted, so the new nodes are always
+	 * appended after the last child of the nodes. */
+	for (i = 0; i < keyword_count; i++) {
+		common = 0;
+
+		if (i > 0) {
+			while (common < keywords[i].length && common < keywords[i - 1].length
+					&& keywords[i].chars[common] == keywords[i - 1].chars[common]) {
+				common++;
+			}
+		}
+
+		for (depth = common; depth < keywords[i].length; depth++) {
+			node = nodes + count;
+			node->first_child = 0;
+			node->last_child = 0;
+			node->next_sibling = 0;
+			node->depth = (uint32_t)depth + 1;
+			node->chr = keywords[i].chars[depth];
+			node->is_terminal = 0;
+
+			if (nodes[path[depth]].first_child == 0) {
+				nodes[path[depth]].first_child = count;
+			}
+			else {
+				nodes[nodes[path[depth]].last_child].next_sibling = count;
+			}
+
+			nodes[path[depth]].last_child = count;
+			path[depth + 1] = count;
+			count++;
+		}
+
+		nodes[path[keywords[i].length]].is_terminal = 1;
+	}
+
+	free(path);
+	*node_count = count;
+	return nodes;
+}
+
+static int build_automaton(keyword_set *set, trie_node *nodes, uint32_t node_count)
+{
+	uint32_t *queue, *row;
+	keyword_state *state;
+	uint32_t head, tail, child, edge, fail;
+	int chr;
+
+	queue = (uint32_t*)malloc(node_count * sizeof(uint32_t));
+	set->states = (keyword_state*)malloc(node_count * sizeof(keyword_state));
+	set->edge_chars = (uint8_t*)malloc(node_count);
+	set->edge_targets = (uint32_t*)malloc(node_count * sizeof(uint32_t));
+
+	set->state_count = node_count;
+	set->dense_count = (node_count < KEYWORD_MAX_DENSE_STATES) ? node_count : KEYWORD_MAX_DENSE_STATES;
+	set->dense_rows = (uint32_t*)malloc((size_t)set->dense_count * 256 * sizeof(uint32_t));
+
+	if (queue == NULL || set->states == NULL || set->edge_chars == NULL
+			|| set->edge_targets == NULL || set->dense_rows == NULL) {
+		fprintf(stderr, "Cannot allocate memory\n");
+		free(queue);
+		return 0;
+	}
+
+	/* Breadth first numbering of the states: the children of
+	 * the queue[head] node are numbered from tail. */
+	queue[0] = 0;
+	tail = 1;
+	edge = 0;
+
+	for (head = 0; head < node_count; head++) {
+		state = set->states + head;
+		state->first_edge = edge;
+
+		for (child = nodes[queue[head]].first_child; child != 0; child = nodes[child].next_sibling) {
+			set->edge_chars[edge] = nodes[child].chr;
+			set->edge_targets[edge] = tail;
+			queue[tail++] = child;
+			edge++;
+		}
+
+		state->edge_count = edge - state->first_edge;
+	}
+
+	/* The failure links point to states with lower depth, which are
+	 * already processed, and all of their transitions are known. */
+	set->states[0].fail = 0;
+	set->states[0].match_length = 0;
+
+	for (head = 0; head < node_count; head++) {
+		state = set->states + head;
+
+		if (head < set->dense_count) {
+			row = set->dense_rows + (size_t)head * 256;
+
+			for (chr = 0; chr < 256; chr++) {
+				row[chr] = (head == 0) ? 0 : next_state(set, state->fail, (uint8_t)chr);
+			}
+
+			for (edge = 0; edge < state->edge_count; edge++) {
+				row[set->edge_chars[state->first_edge + edge]] = set->edge_targets[state->first_edge + edge];
+			}
+		}
+
+		for (edge = state->first_edge; edge < state->first_edge + state->edge_count; edge++) {
+			child = set->edge_targets[edge];
+			fail = (head == 0) ? 0 : next_state(set, state->fail, set->edge_chars[edge]);
+
+			set->states[child].fail = fail;
+			set->states[child].match_length = nodes[queue[child]].is_terminal
+				? nodes[queue[child]].depth : set->states[fail].match_length;
+		}
+	}
+
+	free(queue);
+	return 1;
+}
+
+int pcresp_compile_keywords(pcresp_ctx *ctx, const char *keywords, size_t size, uint32_t options)
+{
+	keyword_set *set;
+	keyword *list = NULL;
+	uint8_t *folded = NULL;
+	trie_node *nodes;
+	const char *end = keywords + size;
+	const char *line_end;
+	size_t count = 0, max = 0, length, i;
+	uint32_t node_count;
+	int chr, first_count;
+
+	if (ctx->keywords != NULL || ctx->re_code != NULL) {
+		fprintf(stderr, "The pattern has been compiled\n");
+		return 0;
+	}
+
+	set = (keyword_set*)malloc(sizeof(keyword_set));
+	if (set == NULL) {
+		fprintf(stderr, "Cannot allocate memory\n");
+		return 0;
+	}
+
+	memset(set, 0, sizeof(keyword_set));
+	ctx->keywords = set;
+
+	for (chr = 0; chr < 256; chr++) {
+		set->fold[chr] = (uint8_t)chr;
+		if ((options & PCRESP_CASELESS) && chr >= 'A' && chr <= 'Z') {
+			set->fold[chr] = (uint8_t)(chr + ('a' - 'A'));
+		}
+	}
+
+	if (size > 0) {
+		folded = (uint8_t*)malloc(size);
+		if (folded == NULL) {
+			fprintf(stderr, "Cannot allocate memory\n");
+			return 0;
+		}
+
+		for (i = 0; i < size; i++) {
+			folded[i] = set->fold[(uint8_t)keywords[i]];
+		}
+	}
+
+	/* One keyword per line, empty lines are ignored. */
+	while (keywords < end) {
+		line_end = (const char*)memchr(keywords, '\n', (size_t)(end - keywords));
+		if (line_end == NULL) {
+			line_end = end;
+		}
+
+		length = (size_t)(line_end - keywords);
+		if (length > 0 && keywords[length - 1] == '\r') {
+			length--;
+		}
+
+		if (length > 0) {
+			if (count >= max) {
+				keyword *new_list;
+
+				max = (max == 0) ? 64 : max * 2;
+				new_list = (keyword*)realloc(list, max * sizeof(keyword));
+				if (new_list == NULL) {
+					fprintf(stderr, "Cannot allocate memory\n");
+					free(list);
+					free(folded);
+					return 0;
+				}
+				list = new_list;
+			}
+
+			list[count].chars = folded + (size_t)(keywords - (end - size));
+			list[count].length = length;
+			count++;
+
+			if (length > set->max_length) {
+				set->max_length = length;
+			}
+		}
+
+		keywords = line_end + 1;
+	}
+
+	if (count == 0) {
+		fprintf(stderr, "No keywords are specified\n");
+		free(folded);
+		return 0;
+	}
+
+	qsort(list, count, sizeof(keyword), compare_keywords);
+
+	nodes = build_trie(list, count, &node_count);
+
+	/* The cache entries depend on the keywords. */
+	set->hash = 2166136261u;
+	for (i = 0; i < count; i++) {
+		set->hash = (set->hash ^ hash_bytes((const char*)list[i].chars, list[i].length)) * 16777619u;
+	}
+
+	set->hash = (set->hash ^ (options & PCRESP_CASELESS)) * 16777619u;
+
+	free(list);
+	free(folded);
+
+	if (nodes == NULL) {
+		return 0;
+	}
+
+	if (!build_automaton(set, nodes, node_count)) {
+		free(nodes);
+		return 0;
+	}
+
+	free(nodes);
+
+	first_count = 0;
+	set->first_char = -1;
+	for (chr = 0; chr < 256; chr++) {
+		set->is_first_char[chr] = (set->dense_rows[set->fold[chr]] != 0);
+		if (set->is_first_char[chr]) {
+			set->first_char = chr;
+			first_count++;
+		}
+	}
+
+	if (first_count > 1) {
+		set->first_char = -1;
+	}
+
+	if (ctx->verbose) {
+		fprintf(stderr, "Verbose: %lu keywords, %lu states (%lu with full transition table)\n",
+			(unsigned long)count, (unsigned long)set->state_count, (unsigned long)set->dense_count);
+	}
+
+	/* The empty pattern provides the match data for the rest of the code. */
+	return pcresp_compile(ctx, "", 0, -1, -1);
+}
+
+int keyword_match(pcresp_ctx *ctx, const char *buffer, size_t size, PCRE2_SIZE start_offset)
+{
+	keyword_set *set = ctx->keywords;
+	PCRE2_SIZE *ovector = pcre2_get_ovector_pointer(ctx->match_data);
+	const uint8_t *subject = (const uint8_t*)buffer;
+	const uint8_t *current = subject + start_offset;
+	const uint8_t *end = subject + size;
+	const uint8_t *match_start = NULL;
+	const uint8_t *match_end = NULL;
+	const uint8_t *start;
+	uint32_t state = 0;
+	uint32_t length;
+
+	while (current < end) {
+		if (state == 0) {
+			/* No keyword can start before current. */
+			if (match_start != NULL) {
+				break;
+			}
+
+			/* Skip the characters which cannot start a keyword. */
+			if (set->first_char >= 0) {
+				current = (const uint8_t*)memchr(current, set->first_char, (size_t)(end - current));
+				if (current == NULL) {
+					break;
+				}
+			}
+			else {
+				while (!set->is_first_char[*current]) {
+					if (++current >= end) {
+						return PCRE2_ERROR_NOMATCH;
+					}
+				}
+			}
+		}
+
+		state = next_state(set, state, set->fold[*current++]);
+		length = set->states[state].match_length;
+
+		if (length > 0) {
+			/* Leftmost, then longest match. */
+			start = current - length;
+			if (match_start == NULL || start <= match_start) {
+				match_start = start;
+				match_end = current;
+			}
+		}
+
+		if (match_start != NULL && (size_t)(current - match_start) >= set->max_length) {
+			break;
+		}
+	}
+
+	if (match_start == NULL) {
+		return PCRE2_ERROR_NOMATCH;
+	}
+
+	ovector[0] = (PCRE2_SIZE)(match_start - subject);
+	ovector[1] = (PCRE2_SIZE)(match_end - subject);
+	return 1;
+}
+
+uint32_t keyword_hash(pcresp_ctx *ctx)
+{
+	return ctx->keywords->hash;
+}
+
+void free_keywords(pcresp_ctx *ctx)
+{
+	keyword_set *set = ctx->keywords;
+
+	if (set == NULL) {
+		return;
+	}
+
+	free(set->states);
+	free(set->edge_chars);
+	free(set->edge_targets);
+	free(set->dense_rows);
+	free(set);
+}
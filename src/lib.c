@@ -0,0 +1,499 @@
+/*
+ *    Stream processing tool
+ *
+ *    Copyright 2016 Zoltan Herczeg (hzmester@freemail.hu). All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are
+ * permitted provided that the following conditions are met:
+ *
+ *   1. Redistributions of source code must retain the above copyright notice, this list of
+ *      conditions and the following disclaimer.
+ *
+ *   2. Redistributions in binary form must reproduce the above copyright notice, this list
+ *      of conditions and the following disclaimer in the documentation and/or other materials
+ *      provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDER(S) AND CONTRIBUTORS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT
+ * SHALL THE COPYRIGHT HOLDER(S) OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "pcresp.h"
+
+pcresp_ctx *pcresp_ctx_create(void)
+{
+	pcresp_ctx *ctx = (pcresp_ctx*)malloc(sizeof(pcresp_ctx));
+
+	if (ctx == NULL) {
+		fprintf(stderr, "Cannot allocate memory\n");
+		return NULL;
+	}
+
+	memset(ctx, 0, sizeof(pcresp_ctx));
+	ctx->input_fd = -1;
+	ctx->subject_fd = -1;
+	ctx->cache.dir_fd = -1;
+	ctx->cache.max_entries = 16384;
+	ctx->output = stdout;
+	ctx->line_number = 1;
+	ctx->column = 1;
+	return ctx;
+}
+
+void pcresp_ctx_free(pcresp_ctx *ctx)
+{
+	if (ctx == NULL) {
+		return;
+	}
+
+	free_jit(ctx);
+	if (ctx->jit_stack != NULL) {
+		pcre2_jit_stack_free(ctx->jit_stack);
+	}
+	if (ctx->dfa_workspace != NULL) {
+		free(ctx->dfa_workspace);
+	}
+	if (ctx->match_context != NULL) {
+		pcre2_match_context_free(ctx->match_context);
+	}
+	if (ctx->dfa_match_context != NULL) {
+		pcre2_match_context_free(ctx->dfa_match_context);
+	}
+	if (ctx->match_data != NULL) {
+		pcre2_match_data_free(ctx->match_data);
+	}
+	if (ctx->re_code != NULL) {
+		pcre2_code_free(ctx->re_code);
+	}
+	if (ctx->ext_string_list != NULL) {
+		free(ctx->ext_string_list);
+	}
+	if (ctx->shell != NULL) {
+		free(ctx->shell);
+	}
+	if (ctx->batch.data != NULL) {
+		free(ctx->batch.data);
+	}
+	close_write_files(ctx);
+	stop_pipeline(ctx);
+	free_aggregate(ctx);
+	free_sketch(ctx);
+	free_cache(ctx);
+	free_checkpoint(ctx);
+	free_keywords(ctx);
+	free_plugins(ctx);
+	free_print_script(ctx);
+	free_stages(ctx);
+	if (ctx->script_output != NULL) {
+		fclose(ctx->script_output);
+	}
+	close_trace(ctx);
+	if (ctx->format_buffer.data != NULL) {
+		free(ctx->format_buffer.data);
+	}
+	if (ctx->transform_buffers[0].data != NULL) {
+		free(ctx->transform_buffers[0].data);
+	}
+	if (ctx->transform_buffers[1].data != NULL) {
+		free(ctx->transform_buffers[1].data);
+	}
+	free(ctx);
+}
+
+int pcresp_set_script(pcresp_ctx *ctx, const char *script)
+{
+	ctx->default_script = script;
+	ctx->default_script_size = (size_t)strlen(script);
+	return check_script(ctx, ctx->default_script, ctx->default_script_size);
+}
+
+int pcresp_set_shell(pcresp_ctx *ctx, const char *shell)
+{
+	return parse_shell(ctx, shell);
+}
+
+int pcresp_add_string(pcresp_ctx *ctx, const char *name, const char *chars)
+{
+	ext_string *new_ext_string_list;
+	const char *cptr = name;
+
+	if (ctx->ext_string_count == 65535) {
+		fprintf(stderr, "Maximum number of scripts reached\n");
+		return 0;
+	}
+
+	if (cptr == NULL || *cptr == '\0') {
+		fprintf(stderr, "String name cannot be empty\n");
+		return 0;
+	}
+
+	while (*cptr != '\0') {
+		if (*cptr == ']') {
+			fprintf(stderr, "The ']' character is not allowed in string name: %s\n", cptr);
+			return 0;
+		}
+		cptr++;
+	}
+
+	if (ctx->ext_string_count >= ctx->ext_string_max) {
+		const int growth = 16;
+
+		new_ext_string_list = (ext_string*)malloc((ctx->ext_string_max + growth) * sizeof(ext_string));
+		if (new_ext_string_list == NULL) {
+			fprintf(stderr, "Cannot allocate memory\n");
+			return 0;
+		}
+
+		if (ctx->ext_string_max > 0) {
+			memcpy(new_ext_string_list, ctx->ext_string_list, ctx->ext_string_max * sizeof(ext_string));
+			free(ctx->ext_string_list);
+		}
+		ctx->ext_string_list = new_ext_string_list;
+		ctx->ext_string_max += growth;
+	}
+
+	ctx->ext_string_list[ctx->ext_string_count].name = name;
+	ctx->ext_string_list[ctx->ext_string_count].name_length = strlen(name);
+	ctx->ext_string_list[ctx->ext_string_count].chars = chars;
+	ctx->ext_string_list[ctx->ext_string_count].chars_length = strlen(chars);
+	ctx->ext_string_count++;
+	return 1;
+}
+
+int pcresp_set_output(pcresp_ctx *ctx, FILE *output)
+{
+	if (ctx->next_stage != NULL || ctx->pipeline != NULL) {
+		fprintf(stderr, "The output cannot be changed\n");
+		return 0;
+	}
+
+	ctx->output = (output != NULL) ? output : stdout;
+	/* The type of the output is changed. */
+	ctx->zero_copy = 0;
+	return 1;
+}
+
+void pcresp_set_print_text(pcresp_ctx *ctx, int enable)
+{
+	ctx->print_text = enable;
+}
+
+void pcresp_set_limit(pcresp_ctx *ctx, int limit)
+{
+	ctx->match_limit = limit;
+}
+
+void pcresp_set_total_limit(pcresp_ctx *ctx, int limit)
+{
+	ctx->total_limit = limit;
+}
+
+void pcresp_set_verbose(pcresp_ctx *ctx, int enable)
+{
+	ctx->verbose = enable;
+}
+
+void pcresp_set_engine(pcresp_ctx *ctx, int engine)
+{
+	ctx->engine = engine;
+}
+
+void pcresp_set_match_limit(pcresp_ctx *ctx, uint32_t match_limit, uint32_t heap_limit)
+{
+	ctx->backtrack_limit = match_limit;
+	ctx->heap_limit = heap_limit;
+}
+
+void pcresp_set_max_open_files(pcresp_ctx *ctx, int max_open_files)
+{
+	ctx->max_open_files = max_open_files;
+}
+
+void pcresp_set_hugepages(pcresp_ctx *ctx, int enable)
+{
+	ctx->hugepages = enable;
+}
+
+void pcresp_set_line_number(pcresp_ctx *ctx, int enable)
+{
+	ctx->print_line_number = enable;
+	if (enable) {
+		ctx->line_positions = 1;
+	}
+}
+
+void pcresp_set_format(pcresp_ctx *ctx, int format)
+{
+	ctx->format = format;
+}
+
+void pcresp_set_match_callback(pcresp_ctx *ctx, pcresp_match_callback callback, void *user_data)
+{
+	ctx->match_callback = callback;
+	ctx->match_callback_data = user_data;
+}
+
+static int callout_function(pcre2_callout_block *callout_block, void *data)
+{
+	pcresp_ctx *ctx = (pcresp_ctx*)data;
+	uint64_t start = 0;
+	int result;
+
+	/* The match is abandoned. */
+	if (ctx->cancelled > CANCEL_LIMIT) {
+		return PCRE2_ERROR_CALLOUT;
+	}
+
+	if (ctx->trace != NULL) {
+		start = trace_time();
+	}
+
+	result = run_script(ctx, (char*)callout_block->callout_string, callout_block->callout_string_length,
+			(const char*)callout_block->subject, callout_block->offset_vector, (char*)callout_block->mark);
+
+	if (ctx->trace != NULL) {
+		trace_event_end(ctx, TRACE_CALLOUT, start, NULL, (long)callout_block->callout_number,
+			(long)callout_block->current_position);
+	}
+	return result;
+}
+
+static int enumerate_callback(pcre2_callout_enumerate_block *callout_block, void *data)
+{
+	((pcresp_ctx*)data)->callout_count++;
+
+	if (!check_script((pcresp_ctx*)data, (const char*)callout_block->callout_string, callout_block->callout_string_length)) {
+		return 1;
+	}
+	return 0;
+}
+
+static int init_dfa(pcresp_ctx *ctx)
+{
+	const char *reason = NULL;
+	uint32_t backref_max = 0;
+
+	pcre2_pattern_info(ctx->re_code, PCRE2_INFO_BACKREFMAX, &backref_max);
+
+	if (backref_max > 0) {
+		reason = "backreferences";
+	}
+	else if (ctx->callout_count > 0) {
+		/* The DFA engine ignores the return value of callouts. */
+		reason = "callouts";
+	}
+
+	if (reason != NULL) {
+		if (ctx->engine == PCRESP_ENGINE_DFA) {
+			fprintf(stderr, "The DFA engine does not support %s\n", reason);
+			return 0;
+		}
+
+		if (ctx->verbose) {
+			fprintf(stderr, "Verbose: DFA fallback is disabled, pattern has %s\n", reason);
+		}
+		return 1;
+	}
+
+	ctx->dfa_workspace_size = 1024;
+	ctx->dfa_workspace = (int*)malloc(ctx->dfa_workspace_size * sizeof(int));
+
+	if (ctx->dfa_workspace == NULL) {
+		fprintf(stderr, "Cannot allocate memory\n");
+		return 0;
+	}
+
+	if (ctx->engine == PCRESP_ENGINE_AUTO) {
+		ctx->dfa_match_context = pcre2_match_context_create(NULL);
+		if (ctx->dfa_match_context == NULL) {
+			fprintf(stderr, "Cannot create match context\n");
+			return 0;
+		}
+		ctx->dfa_fallback = 1;
+	}
+	return 1;
+}
+
+/* Frees the compiled pattern after a failure, so the
+ * context can compile another pattern. */
+static void free_compiled(pcresp_ctx *ctx)
+{
+	pcre2_code_free(ctx->re_code);
+	ctx->re_code = NULL;
+	ctx->callout_count = 0;
+
+	if (ctx->dfa_workspace != NULL) {
+		free(ctx->dfa_workspace);
+		ctx->dfa_workspace = NULL;
+	}
+
+	if (ctx->dfa_match_context != NULL) {
+		pcre2_match_context_free(ctx->dfa_match_context);
+		ctx->dfa_match_context = NULL;
+	}
+}
+
+int pcresp_compile(pcresp_ctx *ctx, const char *pattern, uint32_t options, int newline, int bsr)
+{
+	int error_code;
+	PCRE2_SIZE error_offset;
+	pcre2_compile_context *compile_context;
+	uint32_t pcre2_options = 0;
+
+	if (ctx->re_code != NULL) {
+		fprintf(stderr, "The pattern has been compiled\n");
+		return 0;
+	}
+
+	if (options & PCRESP_CASELESS) {
+		pcre2_options |= PCRE2_CASELESS;
+	}
+	if (options & PCRESP_MULTILINE) {
+		pcre2_options |= PCRE2_MULTILINE;
+	}
+	if (options & PCRESP_EXTENDED) {
+		pcre2_options |= PCRE2_EXTENDED;
+	}
+	if (options & PCRESP_UTF) {
+		pcre2_options |= PCRE2_UTF | PCRE2_UCP;
+		ctx->utf = 1;
+	}
+	if (options & PCRESP_DOTALL) {
+		pcre2_options |= PCRE2_DOTALL;
+	}
+
+	compile_context = pcre2_compile_context_create(NULL);
+	if (!compile_context) {
+		fprintf(stderr, "Cannot create context\n");
+		return 0;
+	}
+	if (newline != -1) {
+		pcre2_set_newline(compile_context, (uint32_t)newline);
+	}
+	if (bsr != -1) {
+		pcre2_set_bsr(compile_context, (uint32_t)bsr);
+	}
+
+	if (ctx->verbose && ctx->keywords == NULL) {
+		fprintf(stderr, "Verbose: compiling '%s'\n", pattern);
+	}
+
+	ctx->re_code = pcre2_compile((uint8_t*)pattern, PCRE2_ZERO_TERMINATED, pcre2_options,
+				&error_code, &error_offset, compile_context);
+	pcre2_compile_context_free(compile_context);
+
+	if (ctx->re_code == NULL) {
+		char *buffer = (char *)malloc(256);
+
+		if (buffer != NULL) {
+			pcre2_get_error_message(error_code, (uint8_t*)buffer, 256);
+		}
+
+		fprintf(stderr, "Cannot compile /%s/\n    Error at offset %d : %s\n",
+			pattern, (int)error_offset, buffer != NULL ? buffer : "<no memory for error string>");
+
+		if (buffer != NULL) {
+			free(buffer);
+		}
+
+		return 0;
+	}
+
+	if (pcre2_callout_enumerate(ctx->re_code, enumerate_callback, ctx)
+			|| (ctx->engine != PCRESP_ENGINE_BACKTRACK && !init_dfa(ctx))) {
+		free_compiled(ctx);
+		return 0;
+	}
+
+	ctx->match_context = pcre2_match_context_create(NULL);
+	ctx->match_data = pcre2_match_data_create_from_pattern(ctx->re_code, NULL);
+
+	if (ctx->match_context == NULL || ctx->match_data == NULL) {
+		fprintf(stderr, "Cannot create match context\n");
+		return 0;
+	}
+
+	if (ctx->backtrack_limit > 0) {
+		pcre2_set_match_limit(ctx->match_context, ctx->backtrack_limit);
+	}
+	if (ctx->heap_limit > 0) {
+		pcre2_set_heap_limit(ctx->match_context, ctx->heap_limit);
+	}
+
+	init_jit(ctx);
+
+	pcre2_set_callout(ctx->match_context, callout_function, ctx);
+	ctx->ovector_size = pcre2_get_ovector_count(ctx->match_data);
+
+	if (ctx->aggregate != NULL && !init_aggregate(ctx)) {
+		return 0;
+	}
+
+	if (ctx->sketch != NULL && !init_sketch(ctx)) {
+		return 0;
+	}
+
+	if (ctx->format != PCRESP_FORMAT_TEXT && !init_format(ctx)) {
+		return 0;
+	}
+
+	if (ctx->default_script != NULL && !init_print_script(ctx)) {
+		return 0;
+	}
+
+	if (ctx->cache.dir_fd >= 0) {
+		init_cache(ctx, pattern, options, newline, bsr);
+	}
+	return 1;
+}
+
+void pcresp_match_buffer(pcresp_ctx *ctx, const char *buffer, size_t size)
+{
+	if (ctx->re_code == NULL) {
+		fprintf(stderr, "Pattern is not compiled\n");
+		return;
+	}
+
+	match(ctx, buffer, size);
+}
+
+void pcresp_flush(pcresp_ctx *ctx)
+{
+	flush_batch(ctx);
+	close_write_files(ctx);
+	print_aggregate(ctx);
+	print_sketch(ctx);
+	evict_cache(ctx);
+	fflush(ctx->output);
+	flush_stages(ctx);
+	stop_pipeline(ctx);
+
+	/* The buffers passed after the flush are a new input. */
+	ctx->match_count = 0;
+	reset_line_position(ctx);
+
+	if (ctx->checkpoint.file_name != NULL) {
+		commit_checkpoint(ctx);
+	}
+}
+
+int pcresp_match_found(pcresp_ctx *ctx)
+{
+	return ctx->match_found;
+}
+
+void pcresp_cancel(pcresp_ctx *ctx)
+{
+	ctx->cancelled = CANCEL_REQUEST;
+}
+
+int pcresp_cancelled(pcresp_ctx *ctx)
+{
+	return ctx->cancelled > CANCEL_LIMIT;
+}
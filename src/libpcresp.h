@@ -0,0 +1,221 @@
+/*
+ *    Stream processing tool
+ *
+ *    Copyright 2016 Zoltan Herczeg (hzmester@freemail.hu). All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are
+ * permitted provided that the following conditions are met:
+ *
+ *   1. Redistributions of source code must retain the above copyright notice, this list of
+ *      conditions and the following disclaimer.
+ *
+ *   2. Redistributions in binary form must reproduce the above copyright notice, this list
+ *      of conditions and the following disclaimer in the documentation and/or other materials
+ *      provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDER(S) AND CONTRIBUTORS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT
+ * SHALL THE COPYRIGHT HOLDER(S) OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef LIBPCRESP_H
+#define LIBPCRESP_H
+
+/* Public interface of the pcresp library.
+ *
+ * Every piece of state is stored in a pcresp_ctx object, so independent
+ * contexts can be used by different threads at the same time. A single
+ * context must not be used by more than one thread at a time.
+ *
+ * Functions returning int return with non-zero on success and zero
+ * on failure. Error messages are printed to stderr. */
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct pcresp_ctx pcresp_ctx;
+
+/* Called after each successful match instead of the default action
+ * (printing the match or running the script). The ovector contains
+ * pair_count (start, end) offset pairs, unset pairs are (size_t)-1.
+ * The mark is NULL if no MARK is set. A non-zero return value stops
+ * the matching of the current input. */
+typedef int (*pcresp_match_callback)(void *user_data, const char *subject,
+	size_t subject_size, const size_t *ovector, uint32_t pair_count, const char *mark);
+
+/* Argument of the functions called by the *dl script flag. The ovector
+ * has the same layout as in pcresp_match_callback, and argv contains the
+ * expanded script arguments after the library:function argument. In
+ * callouts the return value is the callout result (zero continues the
+ * match). The optional <function>_init(void) hook returns the state
+ * pointer, which is passed to <function>_fini(void *state) when the
+ * context is freed. New fields are only added to the end of the
+ * structure, and size is the size of the structure. */
+typedef struct pcresp_plugin_call {
+	size_t size;
+	const char *subject;
+	size_t subject_size;
+	const size_t *ovector;
+	uint32_t pair_count;
+	const char *mark;
+	int argc;
+	const char *const *argv;
+	void *state;
+} pcresp_plugin_call;
+
+typedef int (*pcresp_plugin_function)(pcresp_plugin_call *call);
+
+/* Compile options. */
+#define PCRESP_CASELESS   0x01
+#define PCRESP_MULTILINE  0x02
+#define PCRESP_EXTENDED   0x04
+#define PCRESP_UTF        0x08
+#define PCRESP_DOTALL     0x10
+
+/* Matching engines. The auto engine uses the backtracking engine
+ * and retries the match with the DFA engine when a limit is reached. */
+#define PCRESP_ENGINE_BACKTRACK  0
+#define PCRESP_ENGINE_DFA        1
+#define PCRESP_ENGINE_AUTO       2
+
+/* Aggregate types (see pcresp_add_aggregate). */
+#define PCRESP_GROUP_BY  0
+#define PCRESP_UNIQUE    1
+#define PCRESP_SUM       2
+#define PCRESP_MIN       3
+#define PCRESP_MAX       4
+
+/* JIT compilation modes. The auto mode uses the interpreter for small
+ * inputs, and compiles the pattern on a background thread for large ones. */
+#define PCRESP_JIT_AUTO    0
+#define PCRESP_JIT_ALWAYS  1
+#define PCRESP_JIT_NEVER   2
+
+/* Sorting order of the aggregates. */
+#define PCRESP_SORT_KEY    0
+#define PCRESP_SORT_COUNT  1
+#define PCRESP_SORT_SUM    2
+#define PCRESP_SORT_MIN    3
+#define PCRESP_SORT_MAX    4
+
+/* Output formats of the matches. */
+#define PCRESP_FORMAT_TEXT   0
+#define PCRESP_FORMAT_JSONL  1
+#define PCRESP_FORMAT_TSV    2
+#define PCRESP_FORMAT_NUL    3
+
+pcresp_ctx *pcresp_ctx_create(void);
+void pcresp_ctx_free(pcresp_ctx *ctx);
+
+/* Configuration. Must be called before pcresp_compile. The strings
+ * passed to these functions must be valid until the context is freed. */
+int pcresp_set_script(pcresp_ctx *ctx, const char *script);
+int pcresp_set_shell(pcresp_ctx *ctx, const char *shell);
+int pcresp_add_string(pcresp_ctx *ctx, const char *name, const char *chars);
+void pcresp_set_print_text(pcresp_ctx *ctx, int enable);
+void pcresp_set_limit(pcresp_ctx *ctx, int limit);
+void pcresp_set_total_limit(pcresp_ctx *ctx, int limit);
+void pcresp_set_verbose(pcresp_ctx *ctx, int enable);
+void pcresp_set_engine(pcresp_ctx *ctx, int engine);
+void pcresp_set_jit(pcresp_ctx *ctx, int mode);
+void pcresp_set_match_limit(pcresp_ctx *ctx, uint32_t match_limit, uint32_t heap_limit);
+void pcresp_set_max_open_files(pcresp_ctx *ctx, int max_open_files);
+int pcresp_add_aggregate(pcresp_ctx *ctx, int type, const char *source);
+int pcresp_set_aggregate_sort(pcresp_ctx *ctx, int sort);
+
+/* Approximate aggregation with fixed memory, which cannot be combined
+ * with the aggregates above. The k most frequent expansions of the
+ * template are printed as key, count and error (the count is an upper
+ * bound, which exceeds the real count by at most the error), and the
+ * estimated number of distinct expansions is printed before them. The
+ * report is printed by pcresp_flush, and after every report_every
+ * matches (zero disables the periodic reports, which are followed by
+ * an empty line). */
+int pcresp_add_top_k(pcresp_ctx *ctx, size_t k, const char *source);
+int pcresp_add_distinct(pcresp_ctx *ctx, const char *source);
+int pcresp_set_report_every(pcresp_ctx *ctx, uint64_t report_every);
+void pcresp_set_format(pcresp_ctx *ctx, int format);
+int pcresp_set_cache_dir(pcresp_ctx *ctx, const char *dir);
+void pcresp_set_cache_size(pcresp_ctx *ctx, size_t max_entries);
+int pcresp_set_checkpoint(pcresp_ctx *ctx, const char *file_name);
+void pcresp_set_hugepages(pcresp_ctx *ctx, int enable);
+int pcresp_set_trace(pcresp_ctx *ctx, const char *file_name);
+void pcresp_set_pipeline(pcresp_ctx *ctx, int enable);
+
+/* Sets the stream where the output of the context is written (stdout
+ * by default, or when output is NULL). The output of a context which
+ * has a next stage is the next stage, so it cannot be changed. The
+ * stream is not closed by the context. */
+int pcresp_set_output(pcresp_ctx *ctx, FILE *output);
+
+/* Prefixes the printed matches with their line number, and adds a line
+ * field to the formatted records. The lines are counted from the start
+ * of each input (pcresp_match_buffer calls and files). */
+void pcresp_set_line_number(pcresp_ctx *ctx, int enable);
+void pcresp_set_match_callback(pcresp_ctx *ctx, pcresp_match_callback callback, void *user_data);
+
+/* Chained stages: the output of ctx is matched by next in memory,
+ * and the output of the last stage is written to stdout. The context
+ * owns the next stage, which is flushed and freed with ctx. In streaming
+ * mode (set after the stages are added) each next stage runs on its own
+ * thread, and receives the output of the previous stage in chunks of
+ * complete lines, so its matches cannot span chunks. Otherwise the whole
+ * output is matched by the next stage when ctx is flushed. */
+int pcresp_add_stage(pcresp_ctx *ctx, pcresp_ctx *next);
+void pcresp_set_streaming(pcresp_ctx *ctx, int enable);
+
+/* Compiles the pattern. The newline and bsr arguments are PCRE2_NEWLINE_xxx
+ * and PCRE2_BSR_xxx constants, or -1 to use the defaults. */
+int pcresp_compile(pcresp_ctx *ctx, const char *pattern, uint32_t options, int newline, int bsr);
+
+/* Compiles a list of fixed strings separated by newlines instead of a
+ * pattern. The leftmost (and then longest) keyword is matched. Only
+ * the PCRESP_CASELESS option is supported, which folds ASCII letters. */
+int pcresp_compile_keywords(pcresp_ctx *ctx, const char *keywords, size_t size, uint32_t options);
+
+/* Matching. The match_found flag is kept across calls. */
+void pcresp_match_buffer(pcresp_ctx *ctx, const char *buffer, size_t size);
+void pcresp_match_stream(pcresp_ctx *ctx, FILE *f, const char *name);
+void pcresp_match_fd(pcresp_ctx *ctx, int fd, const char *name);
+void pcresp_match_file(pcresp_ctx *ctx, const char *file_name);
+
+/* Same as calling pcresp_match_file for each file. When the pipeline
+ * is enabled, the upcoming files are prefetched by a reader thread, and
+ * the output is written by a writer thread until pcresp_flush. */
+void pcresp_match_files(pcresp_ctx *ctx, const char *const *file_names, size_t file_count);
+int pcresp_match_found(pcresp_ctx *ctx);
+
+/* Stops reading and matching the input as soon as possible. The
+ * running script is waited for, but no more scripts are executed
+ * and the pending batched scripts are dropped. Can be called from
+ * signal handlers. The processing is also stopped when writing the
+ * output fails (e.g. the reader of the pipe exits) or the total
+ * limit is reached, which applies to all inputs of the context.
+ * pcresp_cancelled returns with non-zero after pcresp_cancel, or
+ * when the output cannot be written. */
+void pcresp_cancel(pcresp_ctx *ctx);
+int pcresp_cancelled(pcresp_ctx *ctx);
+
+/* Executes the pending batched scripts (see *batch), closes the
+ * files of *write, prints the aggregates collected since the previous
+ * call, removes the least recently used cache entries, flushes the
+ * output and saves the checkpoint file. Must be called after the last input
+ * is processed. */
+void pcresp_flush(pcresp_ctx *ctx);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LIBPCRESP_H */
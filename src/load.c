@@ -24,61 +24,187 @@
  * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#ifdef __linux__
+#define _GNU_SOURCE
+#endif
+
 #include "pcresp.h"
 
-#define DATA_PAGE_SIZE 4096
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+/* Initial size of the buffer of the input read by stdio, and
+ * the maximum size of a read, which is checked for cancellation. */
+#define READ_SIZE (64 * 1024)
 
-typedef struct data_page {
-	struct data_page *next;
-	uint8_t data[DATA_PAGE_SIZE];
-} data_page;
+#define HUGE_PAGE_SIZE (2 * 1024 * 1024)
 
-void free_pages(data_page *page)
+/* Allocates the buffer of the input. The mapped_size is set to
+ * non-zero when the buffer must be released by munmap. The kind
+ * of the pages is printed in verbose mode when report is set. */
+static char *alloc_input(pcresp_ctx *ctx, size_t size, size_t *mapped_size, int report)
 {
-	while (page != NULL) {
-		data_page *current = page;
-		page = page->next;
-		free(current);
+	char *buffer;
+	size_t length;
+
+	*mapped_size = 0;
+
+	if (size < HUGE_PAGE_SIZE) {
+		return (char*)malloc(size);
+	}
+
+#ifdef MAP_HUGETLB
+	if (ctx->hugepages) {
+		/* Requires reserved huge pages. */
+		length = (size + HUGE_PAGE_SIZE - 1) & ~(size_t)(HUGE_PAGE_SIZE - 1);
+		buffer = (char*)mmap(NULL, length, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+
+		if (buffer != MAP_FAILED) {
+			if (ctx->verbose && report) {
+				fprintf(stderr, "Verbose: input buffer uses reserved huge pages\n");
+			}
+			*mapped_size = length;
+			return buffer;
+		}
+	}
+#endif /* MAP_HUGETLB */
+
+	/* Large buffers are anonymous mappings, which can be grown by mremap. */
+	length = size;
+	buffer = (char*)mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+	if (buffer == MAP_FAILED) {
+		return (char*)malloc(size);
 	}
+
+	*mapped_size = length;
+
+	if (!ctx->hugepages) {
+		return buffer;
+	}
+
+#ifdef MADV_HUGEPAGE
+	if (madvise(buffer, length, MADV_HUGEPAGE) == 0) {
+		if (ctx->verbose && report) {
+			fprintf(stderr, "Verbose: input buffer uses transparent huge pages\n");
+		}
+		return buffer;
+	}
+#endif /* MADV_HUGEPAGE */
+
+	if (ctx->verbose && report) {
+		fprintf(stderr, "Verbose: huge pages are not available\n");
+	}
+	return buffer;
 }
 
-static void load_and_match(FILE* f, char* file_name)
+void release_input(pcresp_ctx *ctx, const char *current)
 {
-	/* Reads the file into a single buffer */
-	size_t size = 0, offset = DATA_PAGE_SIZE;
-	data_page *first = NULL, *last = NULL;
-	char *full_buffer;
+#ifdef MADV_DONTNEED
+	size_t length = (size_t)(current - ctx->release_start);
+
+	length &= ~((size_t)sysconf(_SC_PAGESIZE) - 1);
+
+	/* The mapping is backed by the file, so the released pages
+	 * are read again if they are accessed later (e.g. lookbehind). */
+	if (length > 0 && madvise((void*)ctx->release_start, length, MADV_DONTNEED) == 0) {
+		ctx->release_start += length;
+		return;
+	}
+#endif /* MADV_DONTNEED */
+
+	(void)current;
+	ctx->release_start = NULL;
+}
+
+static void free_input(char *buffer, size_t mapped_size)
+{
+	if (mapped_size > 0) {
+		munmap(buffer, mapped_size);
+	}
+	else {
+		free(buffer);
+	}
+}
+
+/* Grows the buffer of the input to size bytes, and returns with NULL
+ * on failure (the buffer is not freed). The pages of anonymous mappings
+ * are moved by mremap, so the input is not copied, and the peak memory
+ * use stays close to the size of the input. */
+static char *grow_input(pcresp_ctx *ctx, char *buffer, size_t length, size_t size, size_t *mapped_size)
+{
+	char *new_buffer;
+	size_t new_mapped_size;
+
+#ifdef MREMAP_MAYMOVE
+	/* Mappings of reserved huge pages may not be grown, and are copied. */
+	if (*mapped_size > 0) {
+		new_buffer = (char*)mremap(buffer, *mapped_size, size, MREMAP_MAYMOVE);
+		if (new_buffer != MAP_FAILED) {
+			*mapped_size = size;
+			return new_buffer;
+		}
+	}
+#endif /* MREMAP_MAYMOVE */
+
+	new_buffer = alloc_input(ctx, size, &new_mapped_size, *mapped_size == 0);
+	if (new_buffer == NULL) {
+		return NULL;
+	}
+
+	memcpy(new_buffer, buffer, length);
+	free_input(buffer, *mapped_size);
+	*mapped_size = new_mapped_size;
+	return new_buffer;
+}
+
+static void load_and_match(pcresp_ctx *ctx, FILE* f, const char* file_name)
+{
+	/* Reads the file into a single buffer, which is doubled when it is full. */
+	size_t size = 0, capacity = READ_SIZE;
+	size_t mapped_size = 0, bytes;
+	char *buffer, *new_buffer;
+	uint64_t start = 0;
+
+	if (ctx->trace != NULL) {
+		start = trace_time();
+	}
+
+	buffer = (char*)malloc(capacity);
+	if (buffer == NULL) {
+		fprintf(stderr, "Cannot allocate memory\n");
+		return;
+	}
 
 	while (1) {
-		if (offset >= DATA_PAGE_SIZE) {
-			data_page *new_page = (data_page*)malloc(sizeof(data_page));
-			if (new_page == NULL) {
+		if (size == capacity) {
+			new_buffer = grow_input(ctx, buffer, size, capacity * 2, &mapped_size);
+			if (new_buffer == NULL) {
 				fprintf(stderr, "Cannot allocate memory\n");
-				free_pages(first);
+				free_input(buffer, mapped_size);
 				return;
 			}
 
-			new_page->next = NULL;
-
-			if (last == NULL) {
-				first = new_page;
-			}
-			else {
-				last->next = new_page;
-			}
-
-			last = new_page;
-			offset = 0;
+			buffer = new_buffer;
+			capacity *= 2;
 		}
 
-		size_t bytes = fread(last->data + offset, 1, DATA_PAGE_SIZE - offset, f);
-
-		offset += bytes;
+		bytes = capacity - size;
+		bytes = fread(buffer + size, 1, bytes < READ_SIZE ? bytes : READ_SIZE, f);
 		size += bytes;
 
+		/* A signal may interrupt the read. */
+		if (INPUT_CANCELLED(ctx)) {
+			free_input(buffer, mapped_size);
+			return;
+		}
+
 		if (ferror(f)) {
 			fprintf(stderr, "Read error when processing '%s'\n", file_name);
-			free_pages(first);
+			free_input(buffer, mapped_size);
 			return;
 		}
 
@@ -87,54 +213,339 @@ static void load_and_match(FILE* f, char* file_name)
 		}
 	}
 
-	if (size == 0) {
-		match("", 0);
-		free_pages(first);
-		return;
+	if (size > 0 && ctx->trace != NULL) {
+		trace_event_end(ctx, TRACE_LOAD, start, NULL, (long)size, 0);
+	}
+
+	match(ctx, size > 0 ? buffer : "", size);
+	free_input(buffer, mapped_size);
+}
+
+/* Maps regular files into memory. Returns with zero
+ * if the file cannot be mapped, and must be read. */
+static int map_and_match(pcresp_ctx *ctx, int fd)
+{
+	struct stat st;
+	off_t start;
+	size_t size;
+	uint64_t checkpoint_offset;
+	uint64_t trace_start = 0;
+	int flags;
+	char *map;
+
+	if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size <= 0) {
+		return 0;
+	}
+
+	start = lseek(fd, 0, SEEK_CUR);
+	if (start < 0 || start > st.st_size) {
+		return 0;
+	}
+
+	flags = MAP_PRIVATE;
+#ifdef MAP_POPULATE
+	if (ctx->hugepages) {
+		/* Prefault the whole file. */
+		flags |= MAP_POPULATE;
 	}
+#endif /* MAP_POPULATE */
 
-	full_buffer = malloc(size);
+	if (ctx->trace != NULL) {
+		trace_start = trace_time();
+	}
 
-	if (full_buffer != NULL) {
-		char *dst = full_buffer;
-		data_page *current = first;
+	map = (char*)mmap(NULL, (size_t)st.st_size, PROT_READ, flags, fd, 0);
+	if (map == MAP_FAILED) {
+		return 0;
+	}
 
-		while (current != last) {
-			memcpy(dst, current->data, DATA_PAGE_SIZE);
-			dst += DATA_PAGE_SIZE;
-			current = current->next;
+	if (ctx->trace != NULL) {
+		trace_event_end(ctx, TRACE_LOAD, trace_start, NULL, (long)st.st_size, 0);
+	}
+
+	/* The hints are optional, errors are ignored. */
+#ifdef MADV_SEQUENTIAL
+	madvise(map, (size_t)st.st_size, MADV_SEQUENTIAL);
+#endif /* MADV_SEQUENTIAL */
+
+	if (ctx->hugepages) {
+#ifdef MADV_HUGEPAGE
+		if (madvise(map, (size_t)st.st_size, MADV_HUGEPAGE) == 0 && ctx->verbose) {
+			fprintf(stderr, "Verbose: mapped input uses transparent huge pages\n");
 		}
+#endif /* MADV_HUGEPAGE */
+		ctx->release_start = map;
+	}
 
-		if (offset > 0) {
-			memcpy(dst, last->data, offset);
+	size = (size_t)(st.st_size - start);
+	checkpoint_offset = (uint64_t)start;
+
+	if (ctx->checkpoint.current != NULL) {
+		/* Only complete lines are processed, the rest is
+		 * processed when the line is completed. */
+		while (size > 0 && map[start + size - 1] != '\n') {
+			size--;
 		}
+		ctx->checkpoint.current->offset = (uint64_t)start + size;
+		ctx->checkpoint.modified = 1;
+	}
 
-		match(full_buffer, size);
+	/* Only complete files are cached. */
+	if (ctx->cache.dir_fd >= 0 && start == 0 && ctx->checkpoint.current == NULL) {
+		if (!cache_lookup(ctx, &st)) {
+			cache_start(ctx);
+		}
+		else if (ctx->verbose) {
+			fprintf(stderr, "Verbose: replaying %u cached matches\n", (unsigned)ctx->cache.match_count);
+		}
+	}
 
-		free(full_buffer);
+	ctx->input_fd = fd;
+	ctx->input_offset = (PCRE2_SIZE)start;
+	if (size > 0) {
+		match(ctx, map + start, size);
 	}
-	else {
-		fprintf(stderr, "Cannot allocate memory\n");
+	ctx->input_fd = -1;
+	ctx->input_offset = 0;
+	ctx->release_start = NULL;
+
+	if (ctx->checkpoint.current != NULL && ctx->cancelled) {
+		/* The file is processed again by the next run. */
+		ctx->checkpoint.current->offset = checkpoint_offset;
 	}
 
-	free_pages(first);
+	if (ctx->cache.dir_fd >= 0) {
+		ctx->cache.replay = NULL;
+		cache_store(ctx, &st);
+	}
+
+	munmap(map, (size_t)st.st_size);
+
+	/* Same as a read until the end of file. */
+	lseek(fd, 0, SEEK_END);
+	return 1;
 }
 
-void match_file(char* file_name)
+/* Seeks to the offset where the previous run is stopped. Returns
+ * with zero if the file has no new data. */
+static int start_from_checkpoint(pcresp_ctx *ctx, int fd, const char *file_name)
 {
-	FILE *f = fopen(file_name, "r");
+	checkpoint_entry *entry;
+	struct stat st;
+
+	if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+		return 1;
+	}
+
+	entry = get_checkpoint(ctx, file_name);
+	if (entry == NULL) {
+		return 1;
+	}
+
+	if (entry->inode != (uint64_t)st.st_ino || entry->offset > (uint64_t)st.st_size) {
+		/* The file is rotated or truncated. */
+		if (ctx->verbose && entry->offset > 0) {
+			fprintf(stderr, "Verbose: file is replaced or truncated, restarting from offset 0\n");
+		}
+		entry->inode = (uint64_t)st.st_ino;
+		entry->offset = 0;
+		ctx->checkpoint.modified = 1;
+	}
+
+	if (entry->offset == (uint64_t)st.st_size) {
+		return 0;
+	}
+
+	if (entry->offset > 0) {
+		if (ctx->verbose) {
+			fprintf(stderr, "Verbose: continuing from offset %llu\n", (unsigned long long)entry->offset);
+		}
+
+		if (lseek(fd, (off_t)entry->offset, SEEK_SET) < 0) {
+			return 1;
+		}
+	}
+
+	ctx->checkpoint.current = entry;
+	return 1;
+}
+
+static void match_file(pcresp_ctx *ctx, const char* file_name)
+{
+	struct stat st;
+	FILE *f;
+	int fd;
+
+	if (ctx->re_code == NULL) {
+		fprintf(stderr, "Pattern is not compiled\n");
+		return;
+	}
+
+	if (INPUT_CANCELLED(ctx)) {
+		return;
+	}
+
+	ctx->match_count = 0;
+	reset_line_position(ctx);
+
+	if (ctx->verbose) {
+		fprintf(stderr, "Verbose: reading data from '%s'\n", file_name);
+	}
+
+	ctx->input_name = file_name;
+
+	/* Files without cached matches are not opened. */
+	if (ctx->cache.dir_fd >= 0 && !ctx->print_text && ctx->checkpoint.file_name == NULL
+			&& stat(file_name, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0
+			&& cache_lookup(ctx, &st)) {
+		ctx->cache.replay = NULL;
+		if (ctx->cache.match_count == 0) {
+			if (ctx->verbose) {
+				fprintf(stderr, "Verbose: no cached matches\n");
+			}
+			return;
+		}
+	}
+
+	fd = open(file_name, O_RDONLY);
+
+	if (fd < 0) {
+		fprintf(stderr, "Cannot open file: %s\n", file_name);
+		return;
+	}
+
+	if (ctx->checkpoint.file_name != NULL && !start_from_checkpoint(ctx, fd, file_name)) {
+		close(fd);
+		return;
+	}
+
+	if (map_and_match(ctx, fd)) {
+		ctx->checkpoint.current = NULL;
+		close(fd);
+		return;
+	}
+
+	f = fdopen(fd, "r");
 
 	if (f == NULL) {
 		fprintf(stderr, "Cannot open file: %s\n", file_name);
+		close(fd);
 		return;
 	}
 
-	load_and_match(f, file_name);
+	load_and_match(ctx, f, file_name);
+
+	if (ctx->checkpoint.current != NULL && !ctx->cancelled) {
+		ctx->checkpoint.current->offset = (uint64_t)lseek(fd, 0, SEEK_CUR);
+		ctx->checkpoint.current = NULL;
+	}
 
 	fclose(f);
 }
 
-void match_stdin()
+static void match_fd(pcresp_ctx *ctx, int fd, const char *name)
 {
-	load_and_match(stdin, "stdin");
+	FILE *f;
+
+	if (ctx->re_code == NULL) {
+		fprintf(stderr, "Pattern is not compiled\n");
+		return;
+	}
+
+	if (INPUT_CANCELLED(ctx)) {
+		return;
+	}
+
+	ctx->match_count = 0;
+	reset_line_position(ctx);
+
+	if (ctx->verbose) {
+		fprintf(stderr, "Verbose: reading data from %s\n", name);
+	}
+
+	ctx->input_name = name;
+
+	if (map_and_match(ctx, fd)) {
+		return;
+	}
+
+	/* The descriptor is owned by the caller. */
+	fd = dup(fd);
+	f = (fd >= 0) ? fdopen(fd, "r") : NULL;
+
+	if (f == NULL) {
+		fprintf(stderr, "Cannot read %s\n", name);
+		if (fd >= 0) {
+			close(fd);
+		}
+		return;
+	}
+
+	load_and_match(ctx, f, name);
+
+	fclose(f);
+}
+
+static void match_stream(pcresp_ctx *ctx, FILE *f, const char *name)
+{
+	if (ctx->re_code == NULL) {
+		fprintf(stderr, "Pattern is not compiled\n");
+		return;
+	}
+
+	if (INPUT_CANCELLED(ctx)) {
+		return;
+	}
+
+	ctx->match_count = 0;
+	reset_line_position(ctx);
+
+	if (ctx->verbose) {
+		fprintf(stderr, "Verbose: reading data from %s\n", name);
+	}
+
+	ctx->input_name = name;
+	load_and_match(ctx, f, name);
+}
+
+void pcresp_match_file(pcresp_ctx *ctx, const char* file_name)
+{
+	uint64_t start;
+
+	if (ctx->trace == NULL) {
+		match_file(ctx, file_name);
+		return;
+	}
+
+	start = trace_time();
+	match_file(ctx, file_name);
+	trace_event_end(ctx, TRACE_FILE, start, file_name, 0, 0);
+}
+
+void pcresp_match_fd(pcresp_ctx *ctx, int fd, const char *name)
+{
+	uint64_t start;
+
+	if (ctx->trace == NULL) {
+		match_fd(ctx, fd, name);
+		return;
+	}
+
+	start = trace_time();
+	match_fd(ctx, fd, name);
+	trace_event_end(ctx, TRACE_FILE, start, name, 0, 0);
+}
+
+void pcresp_match_stream(pcresp_ctx *ctx, FILE *f, const char *name)
+{
+	uint64_t start;
+
+	if (ctx->trace == NULL) {
+		match_stream(ctx, f, name);
+		return;
+	}
+
+	start = trace_time();
+	match_stream(ctx, f, name);
+	trace_event_end(ctx, TRACE_FILE, start, name, 0, 0);
 }
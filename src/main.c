@@ -26,22 +26,6 @@
 
 #include "pcresp.h"
 
-int verbose;
-int match_found;
-int print_text;
-int match_limit;
-int ext_string_count;
-ext_string* ext_string_list;
-pcre2_code *re_code;
-pcre2_match_context *match_context;
-pcre2_match_data *match_data;
-uint32_t ovector_size;
-char *default_script;
-size_t default_script_size;
-char **shell;
-int shell_args;
-int shell_arg0_index;
-
 static void help(const char *name)
 {
 	const char *ptr = name;
@@ -68,7 +52,90 @@ static void help(const char *name)
 		"          Specify the pattern. The --pattern can be omitted\n"
 		"          if the pattern does not start with dash\n"
 		"  --limit n\n"
-		"          Stop after n successful match (0 - unlimited)\n"
+		"          Stop after n successful match of each input\n"
+		"          (0 - unlimited)\n"
+		"  --total-limit n\n"
+		"          Stop after n successful match of all input files\n"
+		"          (0 - unlimited), the remaining files are not read\n"
+		"          unless -p is specified\n"
+		"  --engine type\n"
+		"          [type] can be: backtrack (default), dfa (no captures,\n"
+		"          backreferences and callouts), auto (backtrack and retry\n"
+		"          with dfa when the match or heap limit is reached)\n"
+		"  --jit mode\n"
+		"          [mode] can be: auto (default, the interpreter is used until\n"
+		"          the input reaches 64 KiB, then the pattern is JIT compiled\n"
+		"          in the background), always, never\n"
+		"  --match-limit n\n"
+		"          Limit of the backtracking engine (0 - default)\n"
+		"  --heap-limit n\n"
+		"          Heap limit of the backtracking engine in KiB (0 - default)\n"
+		"  --group-by template\n"
+		"          Count the matches grouped by the expansion of template,\n"
+		"          and print the groups at the end of input\n"
+		"  --sum template, --min template, --max template\n"
+		"          Sum, minimum or maximum of the numbers produced by\n"
+		"          template for each group (requires --group-by)\n"
+		"  --sort order\n"
+		"          Order of the groups: key (default), count, sum, min, max\n"
+		"  --unique template\n"
+		"          Print the expansion of template when it is first seen\n"
+		"  --top-k n template\n"
+		"          Print the n most frequent expansions of template with\n"
+		"          their count and maximum error, using fixed memory\n"
+		"          (approximate, keys are truncated to 256 bytes)\n"
+		"  --distinct template\n"
+		"          Print the estimated number of distinct expansions of\n"
+		"          template (approximate, fixed memory), before --top-k\n"
+		"  --report-every n\n"
+		"          Print the --top-k and --distinct reports after every n\n"
+		"          matches as well, followed by an empty line\n"
+		"  --max-open-files n\n"
+		"          Maximum number of files kept open by *write (default: 64)\n"
+		"  --cache-dir dir\n"
+		"          Store the matches of regular files in dir, and reuse them\n"
+		"          while the file and the matching options are unchanged.\n"
+		"          Not used when the pattern has callouts or *dl is used\n"
+		"  --cache-size n\n"
+		"          Maximum number of cache entries (default: 16384)\n"
+		"  --checkpoint file\n"
+		"          Continue processing the input files from the end of\n"
+		"          the last complete line processed by the previous run.\n"
+		"          The offsets are stored in file after the output is\n"
+		"          flushed. Replaced or truncated files are processed again\n"
+		"  --hugepages\n"
+		"          Use huge pages for large input buffers, prefault mapped\n"
+		"          files and release their already scanned parts\n"
+		"  --trace file\n"
+		"          Write a timeline of input loading, matching, callouts\n"
+		"          and scripts to file in Chrome trace event format\n"
+		"  --pipeline\n"
+		"          Prefetch the next input files by a reader thread\n"
+		"          and write the output by a writer thread\n"
+		"  --then pattern\n"
+		"          Start a new stage: the output of the previous stage\n"
+		"          is matched by pattern in memory. The arguments after\n"
+		"          --then (script, aggregates, options) apply to the new\n"
+		"          stage, and the output of the last stage is printed\n"
+		"  --stream\n"
+		"          Run each --then stage on its own thread, and pass the\n"
+		"          output to it in chunks of complete lines (matches\n"
+		"          cannot span chunks) instead of after the input ends\n"
+		"  --line-number\n"
+		"          Prefix the printed matches with their line number, and\n"
+		"          add a line field after the offset to --format records\n"
+		"  --format type\n"
+		"          Print a record for each match instead of the matched\n"
+		"          text. [type] can be: jsonl, tsv, nul (NUL terminated\n"
+		"          fields, and an extra NUL after each record). Records\n"
+		"          contain the input name, the byte offset, the captures,\n"
+		"          the named groups (jsonl only) and the MARK\n"
+		"  -F\n"
+		"          The pattern is a list of fixed strings separated\n"
+		"          by newlines, and the leftmost longest one is matched\n"
+		"  -f file\n"
+		"          Read the fixed strings from file (one per line) instead\n"
+		"          of the pattern, which must be omitted\n"
 		"  -i\n"
 		"          Enable caseless matching\n"
 		"  -m\n"
@@ -109,16 +176,35 @@ static void help(const char *name)
 		"  #[name]      - insert constant string by name [*]\n"
 		"  #{idx,name}  - same as #{idx} if capture block is not empty\n"
 		"                 same as #[name] otherwise [*]\n"
+		"  #{idx:tr...} - capture block idx transformed by the listed transforms\n"
+		"                 in order: upper, lower (ASCII letters), hex, urldecode,\n"
+		"                 trim (e.g. #{2:trim:lower} or #{2:upper,name}) [*]\n"
 		"  #M           - current MARK value [*]\n"
+		"  #^idx        - start offset of capture block idx [*]\n"
+		"  #$idx        - end offset of capture block idx [*]\n"
+		"                 (the #^{idx} and #${idx} forms are also accepted)\n"
+		"  #F           - path of a file containing the subject (requires *memfd) [*]\n"
+		"  #L           - line number of the match start (not in callouts) [*]\n"
+		"  #C           - column of the match start in bytes, in characters\n"
+		"                 with -u (not in callouts) [*]\n"
 		"  ##           - # (hash mark)\n"
 		"  #<           - less-than sign character\n"
 		"  #>           - greater-than sign character\n"
 		"  #n           - newline (\\n) character\n"
 		"\nScript arguments can be preceeded by control flags:\n\n"
 		"  *print    - print arguments\n"
-		"  *!nl      - no newline after arguments are printed\n"
+		"  *!nl      - no newline after arguments are printed or written\n"
 		"  *null     - discard output\n"
 		"  *!sh      - default-shell (--shell) is not used\n"
+		"  *stdin:idx[,idx...]\n"
+		"            - write the listed capture blocks to the standard input\n"
+		"  *memfd    - the subject is available as a read-only file (see #F)\n"
+		"  *write    - write arguments to the file specified by the first argument\n"
+		"              (the file is created if needed, the data is appended)\n"
+		"  *batch:n[,bytes]\n"
+		"            - arguments of up to n matches are passed to a single\n"
+		"              execution of the program (after the arguments of the first\n"
+		"              match), the total size is limited by bytes and ARG_MAX\n"
 		"\nArguments enclosed in <> brackets:\n"
 		"\n  Arguments can be enclosed in <> brackets. These enclosed\n"
 		"  arguments are never recognised as special arguments such\n"
@@ -137,55 +223,6 @@ static void help(const char *name)
 		name);
 }
 
-static int add_ext_string(const char *name, const char *chars)
-{
-	static int ext_string_max = 0;
-	ext_string *new_ext_string_list;
-	const char *cptr = name;
-
-	if (ext_string_count == 65535) {
-		fprintf(stderr, "Maximum number of scripts reached\n");
-		return 0;
-	}
-
-	if (cptr == NULL || *cptr == '\0') {
-		fprintf(stderr, "String name cannot be empty\n");
-		return 0;
-	}
-
-	while (*cptr != '\0') {
-		if (*cptr == ']') {
-			fprintf(stderr, "The ']' character is not allowed in string name: %s\n", cptr);
-			return 0;
-		}
-		cptr++;
-	}
-
-	if (ext_string_count >= ext_string_max) {
-		const int growth = 16;
-
-		new_ext_string_list = (ext_string*)malloc((ext_string_max + growth) * sizeof(ext_string));
-		if (new_ext_string_list == NULL) {
-			fprintf(stderr, "Cannot allocate memory\n");
-			return 0;
-		}
-
-		if (ext_string_max > 0) {
-			memcpy(new_ext_string_list, ext_string_list, ext_string_max * sizeof(ext_string));
-			free(ext_string_list);
-		}
-		ext_string_list = new_ext_string_list;
-		ext_string_max += growth;
-	}
-
-	ext_string_list[ext_string_count].name = name;
-	ext_string_list[ext_string_count].name_length = strlen(name);
-	ext_string_list[ext_string_count].chars = chars;
-	ext_string_list[ext_string_count].chars_length = strlen(chars);
-	ext_string_count++;
-	return 1;
-}
-
 static int read_int(const char *str, int max)
 {
 	const char *char_ptr = str;
@@ -213,31 +250,168 @@ static int read_int(const char *str, int max)
 	return result;
 }
 
-int callout_function(pcre2_callout_block *callout_block, void *data)
+static char *read_file(const char *file_name, size_t *size)
+{
+	char *data = NULL;
+	char *new_data;
+	size_t length = 0, max = 0, bytes;
+	FILE *f = fopen(file_name, "rb");
+
+	if (f == NULL) {
+		fprintf(stderr, "Cannot open file: %s\n", file_name);
+		return NULL;
+	}
+
+	do {
+		if (length >= max) {
+			max = (max == 0) ? 65536 : max * 2;
+			new_data = (char*)realloc(data, max);
+			if (new_data == NULL) {
+				fprintf(stderr, "Cannot allocate memory\n");
+				free(data);
+				fclose(f);
+				return NULL;
+			}
+			data = new_data;
+		}
+
+		bytes = fread(data + length, 1, max - length, f);
+		length += bytes;
+	} while (bytes > 0);
+
+	if (ferror(f)) {
+		fprintf(stderr, "Read error when processing '%s'\n", file_name);
+		free(data);
+		data = NULL;
+	}
+
+	fclose(f);
+	*size = length;
+	return data;
+}
+
+static pcresp_ctx *signal_ctx;
+static volatile sig_atomic_t signal_number;
+
+static void cancel_handler(int signum)
 {
-	return run_script((char*)callout_block->callout_string, callout_block->callout_string_length,
-			(const char*)callout_block->subject, callout_block->offset_vector, (char*)callout_block->mark);
+	signal_number = signum;
+	pcresp_cancel(signal_ctx);
 }
 
-int enumerate_callback(pcre2_callout_enumerate_block *callout_block, void *data)
+static void set_signal_handlers(pcresp_ctx *ctx)
 {
-	if (!check_script((const char*)callout_block->callout_string, callout_block->callout_string_length)) {
-		return 1;
+	struct sigaction action;
+
+	signal_ctx = ctx;
+
+	/* Blocking reads are interrupted (no SA_RESTART), and
+	 * a second signal terminates the process immediately. */
+	memset(&action, 0, sizeof(action));
+	sigemptyset(&action.sa_mask);
+	action.sa_handler = cancel_handler;
+	action.sa_flags = SA_RESETHAND;
+	sigaction(SIGINT, &action, NULL);
+	sigaction(SIGTERM, &action, NULL);
+
+	/* Writing a closed pipe fails with EPIPE, which stops the processing. */
+	action.sa_handler = SIG_IGN;
+	action.sa_flags = 0;
+	sigaction(SIGPIPE, &action, NULL);
+}
+
+/* Arguments which are processed after the arguments of a stage are parsed. */
+typedef struct stage_args {
+	int backtrack_limit;
+	int heap_limit;
+	int sort;
+	int report_every;
+	uint32_t options;
+	char *script;
+	char *shell_arg;
+	char *pattern;
+	char *keyword_file;
+	int fixed_strings;
+	int newline;
+	int bsr;
+} stage_args;
+
+static void init_stage_args(stage_args *stage)
+{
+	memset(stage, 0, sizeof(stage_args));
+	stage->sort = -1;
+	stage->newline = -1;
+	stage->bsr = -1;
+}
+
+static int compile_stage(pcresp_ctx *ctx, stage_args *stage)
+{
+	char *keywords;
+	size_t keywords_size;
+
+	if (stage->script != NULL && !pcresp_set_script(ctx, stage->script)) {
+		return 0;
+	}
+
+	if (stage->shell_arg == NULL) {
+		stage->shell_arg = getenv("PCRESP_SHELL");
+	}
+
+	if (stage->shell_arg != NULL && !pcresp_set_shell(ctx, stage->shell_arg)) {
+		return 0;
+	}
+
+	if (stage->pattern == NULL && stage->keyword_file == NULL) {
+		fprintf(stderr, "Missing PCRE2 pattern\n");
+		return 0;
+	}
+
+	if (stage->sort != -1 && !pcresp_set_aggregate_sort(ctx, stage->sort)) {
+		return 0;
+	}
+
+	if (stage->report_every > 0 && !pcresp_set_report_every(ctx, (uint64_t)stage->report_every)) {
+		return 0;
+	}
+
+	pcresp_set_match_limit(ctx, (uint32_t)stage->backtrack_limit, (uint32_t)stage->heap_limit);
+
+	if (stage->keyword_file != NULL) {
+		keywords = read_file(stage->keyword_file, &keywords_size);
+		if (keywords == NULL) {
+			return 0;
+		}
+
+		if (!pcresp_compile_keywords(ctx, keywords, keywords_size, stage->options)) {
+			free(keywords);
+			return 0;
+		}
+		free(keywords);
 	}
-	return 0;
+	else if (stage->fixed_strings) {
+		if (!pcresp_compile_keywords(ctx, stage->pattern, strlen(stage->pattern), stage->options)) {
+			return 0;
+		}
+	}
+	else if (!pcresp_compile(ctx, stage->pattern, stage->options, stage->newline, stage->bsr)) {
+		return 0;
+	}
+	return 1;
 }
 
-static int pcresp_main(int argc, char* argv[])
+static int pcresp_main(pcresp_ctx *ctx, int argc, char* argv[])
 {
-	int arg_index, error_code;
-	PCRE2_SIZE error_offset;
-	pcre2_compile_context *compile_context;
-	pcre2_jit_stack *jit_stack;
-	uint32_t options = 0;
-	char *shell_arg = NULL;
-	char *pattern = NULL;
-	int newline = -1;
-	int bsr = -1;
+	pcresp_ctx *first_ctx = ctx;
+	pcresp_ctx *next_ctx;
+	stage_args stage;
+	int arg_index, match_limit;
+	int max_open_files;
+	int cache_size;
+	int aggregate_type;
+	int top_k;
+	int streaming = 0;
+
+	init_stage_args(&stage);
 
 	if (argc <= 1) {
 		help(argv[0]);
@@ -249,10 +423,10 @@ static int pcresp_main(int argc, char* argv[])
 		char *arg = argv[arg_index];
 
 		if (arg[0] != '-') {
-			if (pattern != NULL) {
+			if (stage.pattern != NULL || stage.keyword_file != NULL) {
 				break;
 			}
-			pattern = arg;
+			stage.pattern = arg;
 			arg_index++;
 			continue;
 		}
@@ -271,12 +445,11 @@ static int pcresp_main(int argc, char* argv[])
 					fprintf(stderr, "Script required after --script\n");
 					return 2;
 				}
-				default_script = argv[arg_index++];
-				default_script_size = (size_t)strlen(default_script);
+				stage.script = argv[arg_index++];
 				continue;
 			}
 			else if (strcmp(arg, "print") == 0) {
-				print_text = 1;
+				pcresp_set_print_text(ctx, 1);
 				continue;
 			}
 			else if (strcmp(arg, "def-string") == 0) {
@@ -284,7 +457,7 @@ static int pcresp_main(int argc, char* argv[])
 					fprintf(stderr, "Name and string required after --def-string\n");
 					return 2;
 				}
-				if (!add_ext_string(argv[arg_index], argv[arg_index + 1])) {
+				if (!pcresp_add_string(ctx, argv[arg_index], argv[arg_index + 1])) {
 					return 2;
 				}
 				arg_index += 2;
@@ -295,11 +468,11 @@ static int pcresp_main(int argc, char* argv[])
 					fprintf(stderr, "String required after --shell\n");
 					return 2;
 				}
-				shell_arg = argv[arg_index++];
+				stage.shell_arg = argv[arg_index++];
 				continue;
 			}
 			else if (strcmp(arg, "pattern") == 0) {
-				if (pattern != NULL) {
+				if (stage.pattern != NULL) {
 					fprintf(stderr, "The pattern has been spcified\n");
 					return 2;
 				}
@@ -307,7 +480,7 @@ static int pcresp_main(int argc, char* argv[])
 					fprintf(stderr, "PCRE2 pattern required after --pattern\n");
 					return 2;
 				}
-				pattern = argv[arg_index++];
+				stage.pattern = argv[arg_index++];
 				continue;
 			}
 			else if (strcmp(arg, "limit") == 0) {
@@ -319,32 +492,284 @@ static int pcresp_main(int argc, char* argv[])
 				if (match_limit == -1) {
 					return 2;
 				}
+				pcresp_set_limit(ctx, match_limit);
+				continue;
+			}
+			else if (strcmp(arg, "total-limit") == 0) {
+				if (arg_index >= argc) {
+					fprintf(stderr, "Number required after --total-limit\n");
+					return 2;
+				}
+				match_limit = read_int(argv[arg_index++], 100000000);
+				if (match_limit == -1) {
+					return 2;
+				}
+				pcresp_set_total_limit(ctx, match_limit);
+				continue;
+			}
+			else if (strcmp(arg, "engine") == 0) {
+				if (arg_index >= argc) {
+					fprintf(stderr, "Engine type required after --engine\n");
+					return 2;
+				}
+				arg = argv[arg_index++];
+				if (strcmp(arg, "backtrack") == 0) {
+					pcresp_set_engine(ctx, PCRESP_ENGINE_BACKTRACK);
+				}
+				else if (strcmp(arg, "dfa") == 0) {
+					pcresp_set_engine(ctx, PCRESP_ENGINE_DFA);
+				}
+				else if (strcmp(arg, "auto") == 0) {
+					pcresp_set_engine(ctx, PCRESP_ENGINE_AUTO);
+				}
+				else {
+					fprintf(stderr, "Unknown engine type: '%s'\n", arg);
+					return 2;
+				}
+				continue;
+			}
+			else if (strcmp(arg, "jit") == 0) {
+				if (arg_index >= argc) {
+					fprintf(stderr, "JIT mode required after --jit\n");
+					return 2;
+				}
+				arg = argv[arg_index++];
+				if (strcmp(arg, "auto") == 0) {
+					pcresp_set_jit(ctx, PCRESP_JIT_AUTO);
+				}
+				else if (strcmp(arg, "always") == 0) {
+					pcresp_set_jit(ctx, PCRESP_JIT_ALWAYS);
+				}
+				else if (strcmp(arg, "never") == 0) {
+					pcresp_set_jit(ctx, PCRESP_JIT_NEVER);
+				}
+				else {
+					fprintf(stderr, "Unknown JIT mode: '%s'\n", arg);
+					return 2;
+				}
+				continue;
+			}
+			else if (strcmp(arg, "match-limit") == 0) {
+				if (arg_index >= argc) {
+					fprintf(stderr, "Number required after --match-limit\n");
+					return 2;
+				}
+				stage.backtrack_limit = read_int(argv[arg_index++], 1000000000);
+				if (stage.backtrack_limit == -1) {
+					return 2;
+				}
+				continue;
+			}
+			else if (strcmp(arg, "group-by") == 0 || strcmp(arg, "unique") == 0
+					|| strcmp(arg, "sum") == 0 || strcmp(arg, "min") == 0 || strcmp(arg, "max") == 0) {
+				if (arg_index >= argc) {
+					fprintf(stderr, "Template required after --%s\n", arg);
+					return 2;
+				}
+
+				if (arg[0] == 'g') {
+					aggregate_type = PCRESP_GROUP_BY;
+				}
+				else if (arg[0] == 'u') {
+					aggregate_type = PCRESP_UNIQUE;
+				}
+				else if (arg[0] == 's') {
+					aggregate_type = PCRESP_SUM;
+				}
+				else {
+					aggregate_type = (arg[1] == 'i') ? PCRESP_MIN : PCRESP_MAX;
+				}
+
+				if (!pcresp_add_aggregate(ctx, aggregate_type, argv[arg_index++])) {
+					return 2;
+				}
+				continue;
+			}
+			else if (strcmp(arg, "top-k") == 0) {
+				if (arg_index + 1 >= argc) {
+					fprintf(stderr, "Number and template required after --top-k\n");
+					return 2;
+				}
+				top_k = read_int(argv[arg_index], 65536);
+				if (top_k == -1 || !pcresp_add_top_k(ctx, (size_t)top_k, argv[arg_index + 1])) {
+					return 2;
+				}
+				arg_index += 2;
+				continue;
+			}
+			else if (strcmp(arg, "distinct") == 0) {
+				if (arg_index >= argc) {
+					fprintf(stderr, "Template required after --distinct\n");
+					return 2;
+				}
+				if (!pcresp_add_distinct(ctx, argv[arg_index++])) {
+					return 2;
+				}
+				continue;
+			}
+			else if (strcmp(arg, "report-every") == 0) {
+				if (arg_index >= argc) {
+					fprintf(stderr, "Number required after --report-every\n");
+					return 2;
+				}
+				stage.report_every = read_int(argv[arg_index++], 1000000000);
+				if (stage.report_every == -1) {
+					return 2;
+				}
+				continue;
+			}
+			else if (strcmp(arg, "sort") == 0) {
+				if (arg_index >= argc) {
+					fprintf(stderr, "Sorting order required after --sort\n");
+					return 2;
+				}
+				arg = argv[arg_index++];
+				if (strcmp(arg, "key") == 0) {
+					stage.sort = PCRESP_SORT_KEY;
+				}
+				else if (strcmp(arg, "count") == 0) {
+					stage.sort = PCRESP_SORT_COUNT;
+				}
+				else if (strcmp(arg, "sum") == 0) {
+					stage.sort = PCRESP_SORT_SUM;
+				}
+				else if (strcmp(arg, "min") == 0) {
+					stage.sort = PCRESP_SORT_MIN;
+				}
+				else if (strcmp(arg, "max") == 0) {
+					stage.sort = PCRESP_SORT_MAX;
+				}
+				else {
+					fprintf(stderr, "Unknown sorting order: '%s'\n", arg);
+					return 2;
+				}
+				continue;
+			}
+			else if (strcmp(arg, "cache-dir") == 0) {
+				if (arg_index >= argc) {
+					fprintf(stderr, "Directory required after --cache-dir\n");
+					return 2;
+				}
+				if (!pcresp_set_cache_dir(ctx, argv[arg_index++])) {
+					return 2;
+				}
+				continue;
+			}
+			else if (strcmp(arg, "cache-size") == 0) {
+				if (arg_index >= argc) {
+					fprintf(stderr, "Number required after --cache-size\n");
+					return 2;
+				}
+				cache_size = read_int(argv[arg_index++], 16777216);
+				if (cache_size < 0) {
+					return 2;
+				}
+				pcresp_set_cache_size(ctx, (size_t)cache_size);
+				continue;
+			}
+			else if (strcmp(arg, "checkpoint") == 0) {
+				if (arg_index >= argc) {
+					fprintf(stderr, "File name required after --checkpoint\n");
+					return 2;
+				}
+				if (!pcresp_set_checkpoint(ctx, argv[arg_index++])) {
+					return 2;
+				}
+				continue;
+			}
+			else if (strcmp(arg, "hugepages") == 0) {
+				pcresp_set_hugepages(ctx, 1);
+				continue;
+			}
+			else if (strcmp(arg, "trace") == 0) {
+				if (arg_index >= argc) {
+					fprintf(stderr, "File name required after --trace\n");
+					return 2;
+				}
+				if (!pcresp_set_trace(ctx, argv[arg_index++])) {
+					return 2;
+				}
+				continue;
+			}
+			else if (strcmp(arg, "line-number") == 0) {
+				pcresp_set_line_number(ctx, 1);
+				continue;
+			}
+			else if (strcmp(arg, "pipeline") == 0) {
+				pcresp_set_pipeline(ctx, 1);
+				continue;
+			}
+			else if (strcmp(arg, "format") == 0) {
+				if (arg_index >= argc) {
+					fprintf(stderr, "Format type required after --format\n");
+					return 2;
+				}
+				arg = argv[arg_index++];
+				if (strcmp(arg, "jsonl") == 0) {
+					pcresp_set_format(ctx, PCRESP_FORMAT_JSONL);
+				}
+				else if (strcmp(arg, "tsv") == 0) {
+					pcresp_set_format(ctx, PCRESP_FORMAT_TSV);
+				}
+				else if (strcmp(arg, "nul") == 0) {
+					pcresp_set_format(ctx, PCRESP_FORMAT_NUL);
+				}
+				else {
+					fprintf(stderr, "Unknown format type: '%s'\n", arg);
+					return 2;
+				}
+				continue;
+			}
+			else if (strcmp(arg, "max-open-files") == 0) {
+				if (arg_index >= argc) {
+					fprintf(stderr, "Number required after --max-open-files\n");
+					return 2;
+				}
+				max_open_files = read_int(argv[arg_index++], 65536);
+				if (max_open_files <= 0) {
+					if (max_open_files == 0) {
+						fprintf(stderr, "--max-open-files must be greater than 0\n");
+					}
+					return 2;
+				}
+				pcresp_set_max_open_files(ctx, max_open_files);
+				continue;
+			}
+			else if (strcmp(arg, "heap-limit") == 0) {
+				if (arg_index >= argc) {
+					fprintf(stderr, "Number required after --heap-limit\n");
+					return 2;
+				}
+				stage.heap_limit = read_int(argv[arg_index++], 1000000000);
+				if (stage.heap_limit == -1) {
+					return 2;
+				}
 				continue;
 			}
 			else if (strcmp(arg, "utf") == 0) {
-				options |= PCRE2_UTF | PCRE2_UCP;
+				stage.options |= PCRESP_UTF;
 				continue;
 			}
 			else if (strcmp(arg, "dot-all") == 0) {
-				options |= PCRE2_DOTALL;
+				stage.options |= PCRESP_DOTALL;
 				continue;
 			}
 			else if (strlen(arg) >= 8 && memcmp(arg, "newline-", 8) == 0) {
 				arg += 8;
 				if (strcmp(arg, "lf") == 0) {
-					newline = PCRE2_NEWLINE_LF;
+					stage.newline = PCRE2_NEWLINE_LF;
 				}
 				else if (strcmp(arg, "cr") == 0) {
-					newline = PCRE2_NEWLINE_CR;
+					stage.newline = PCRE2_NEWLINE_CR;
 				}
 				else if (strcmp(arg, "crlf") == 0) {
-					newline = PCRE2_NEWLINE_CRLF;
+					stage.newline = PCRE2_NEWLINE_CRLF;
 				}
 				else if (strcmp(arg, "anycrlf") == 0) {
-					newline = PCRE2_NEWLINE_ANYCRLF;
+					stage.newline = PCRE2_NEWLINE_ANYCRLF;
 				}
 				else if (strcmp(arg, "unicode") == 0) {
-					newline = PCRE2_NEWLINE_ANY;
+					stage.newline = PCRE2_NEWLINE_ANY;
 				}
 				else {
 					fprintf(stderr, "Unknown newline type: '%s'\n", arg);
@@ -355,10 +780,10 @@ static int pcresp_main(int argc, char* argv[])
 			else if (strlen(arg) >= 4 && memcmp(arg, "bsr-", 4) == 0) {
 				arg += 4;
 				if (strcmp(arg, "anycrlf") == 0) {
-					bsr = PCRE2_BSR_ANYCRLF;
+					stage.bsr = PCRE2_BSR_ANYCRLF;
 				}
 				else if (strcmp(arg, "unicode") == 0) {
-					bsr = PCRE2_BSR_UNICODE;
+					stage.bsr = PCRE2_BSR_UNICODE;
 				}
 				else {
 					fprintf(stderr, "Unknown bsr newline type: '%s'\n", arg);
@@ -366,17 +791,44 @@ static int pcresp_main(int argc, char* argv[])
 				}
 				continue;
 			}
+			else if (strcmp(arg, "then") == 0) {
+				if (arg_index >= argc) {
+					fprintf(stderr, "PCRE2 pattern required after --then\n");
+					return 2;
+				}
+				if (!compile_stage(ctx, &stage)) {
+					return 2;
+				}
+
+				next_ctx = pcresp_ctx_create();
+				if (next_ctx == NULL) {
+					return 2;
+				}
+				if (!pcresp_add_stage(ctx, next_ctx)) {
+					pcresp_ctx_free(next_ctx);
+					return 2;
+				}
+
+				ctx = next_ctx;
+				init_stage_args(&stage);
+				stage.pattern = argv[arg_index++];
+				continue;
+			}
+			else if (strcmp(arg, "stream") == 0) {
+				streaming = 1;
+				continue;
+			}
 			else if (strcmp(arg, "verbose") == 0) {
-				verbose = 1;
+				pcresp_set_verbose(ctx, 1);
 				continue;
 			}
 			else if (strcmp(arg, "end") == 0) {
-				if (pattern == NULL) {
+				if (stage.pattern == NULL) {
 					if (arg_index >= argc) {
 						fprintf(stderr, "PCRE2 pattern required after --end\n");
 						return 2;
 					}
-					pattern = argv[arg_index++];
+					stage.pattern = argv[arg_index++];
 				}
 				break;
 			}
@@ -392,33 +844,42 @@ static int pcresp_main(int argc, char* argv[])
 					fprintf(stderr, "Script required after -s\n");
 					return 2;
 				}
-				default_script = argv[arg_index++];
-				default_script_size = (size_t)strlen(default_script);
+				stage.script = argv[arg_index++];
 				continue;
 			case 'p':
-				print_text = 1;
+				pcresp_set_print_text(ctx, 1);
 				continue;
 			case 'd':
 				if (arg_index + 1>= argc) {
 					fprintf(stderr, "Name and string required after -d\n");
 					return 2;
 				}
-				if (!add_ext_string(argv[arg_index], argv[arg_index + 1])) {
+				if (!pcresp_add_string(ctx, argv[arg_index], argv[arg_index + 1])) {
 					return 2;
 				}
 				arg_index += 2;
 				continue;
+			case 'F':
+				stage.fixed_strings = 1;
+				continue;
+			case 'f':
+				if (arg_index >= argc) {
+					fprintf(stderr, "File name required after -f\n");
+					return 2;
+				}
+				stage.keyword_file = argv[arg_index++];
+				continue;
 			case 'i':
-				options |= PCRE2_CASELESS;
+				stage.options |= PCRESP_CASELESS;
 				continue;
 			case 'm':
-				options |= PCRE2_MULTILINE;
+				stage.options |= PCRESP_MULTILINE;
 				continue;
 			case 'x':
-				options |= PCRE2_EXTENDED;
+				stage.options |= PCRESP_EXTENDED;
 				continue;
 			case 'u':
-				options |= PCRE2_UTF | PCRE2_UCP;
+				stage.options |= PCRESP_UTF;
 				continue;
 			}
 		}
@@ -427,130 +888,41 @@ static int pcresp_main(int argc, char* argv[])
 		return 2;
 	}
 
-	if (default_script != NULL) {
-		if (!check_script(default_script, default_script_size)) {
-			return 2;
-		}
-	}
-
-	if (shell_arg == NULL) {
-		shell_arg = getenv("PCRESP_SHELL");
-	}
-
-	if (shell_arg != NULL && !parse_shell(shell_arg)) {
-		return 2;
-	}
-
-	if (pattern == NULL) {
-		fprintf(stderr, "Missing PCRE2 pattern\n");
-		return 2;
-	}
-
-	compile_context = pcre2_compile_context_create(NULL);
-	if (!compile_context) {
-		fprintf(stderr, "Cannot create context\n");
-		return 2;
-	}
-	if (newline != -1) {
-		pcre2_set_newline(compile_context, (uint32_t)newline);
-	}
-	if (bsr != -1) {
-		pcre2_set_bsr(compile_context, (uint32_t)bsr);
-	}
-
-	if (verbose) {
-		fprintf(stderr, "Verbose: compiling '%s'\n", pattern);
-	}
-
-	re_code = pcre2_compile((uint8_t*)pattern, PCRE2_ZERO_TERMINATED, options,
-				&error_code, &error_offset, compile_context);
-	pcre2_compile_context_free(compile_context);
-
-	if (re_code == NULL) {
-		char *buffer = (char *)malloc(256);
-
-		if (buffer != NULL) {
-			pcre2_get_error_message(error_code, (uint8_t*)buffer, 256);
-		}
-
-		fprintf(stderr, "Cannot compile /%s/\n    Error at offset %d : %s\n",
-			argv[arg_index], (int)error_offset, buffer != NULL ? buffer : "<no memory for error string>");
-
-		if (buffer != NULL) {
-			free(buffer);
-		}
-
-		return 2;
-	}
-
-	if (pcre2_callout_enumerate(re_code, enumerate_callback, NULL)) {
-		return 2;
-	}
-
-	match_context = pcre2_match_context_create(NULL);
-	match_data = pcre2_match_data_create_from_pattern(re_code, NULL);
-
-	if (match_context == NULL || match_data == NULL) {
-		if (match_context != NULL) {
-			pcre2_match_context_free(match_context);
-		}
-		if (match_data != NULL) {
-			pcre2_match_data_free(match_data);
-		}
-
-		fprintf(stderr, "Cannot create match context\n");
+	if (!compile_stage(ctx, &stage)) {
 		return 2;
 	}
 
-	jit_stack = pcre2_jit_stack_create(64 * 1024, 8 * 1024 * 1024, NULL);
-
-	if (jit_stack != NULL) {
-		pcre2_jit_stack_assign(match_context, NULL, jit_stack);
-
-		/* Silently ignored if JIT compilation is failed */
-		pcre2_jit_compile(re_code, PCRE2_JIT_COMPLETE);
-	}
-
-	pcre2_set_callout(match_context, callout_function, NULL);
-	ovector_size = pcre2_get_ovector_count(match_data);
+	pcresp_set_streaming(first_ctx, streaming);
 
 	if (arg_index >= argc) {
-		if (verbose) {
-			fprintf(stderr, "Verbose: reading data from stdin\n");
-		}
-		match_stdin();
+		pcresp_match_fd(first_ctx, fileno(stdin), "stdin");
 	}
 	else {
-		while (arg_index < argc) {
-			if (verbose) {
-				fprintf(stderr, "Verbose: reading data from '%s'\n", argv[arg_index]);
-			}
-			match_file(argv[arg_index]);
-			arg_index++;
-		}
+		pcresp_match_files(first_ctx, (const char *const *)(argv + arg_index), (size_t)(argc - arg_index));
 	}
 
-	if (jit_stack != NULL) {
-		pcre2_jit_stack_free(jit_stack);
-	}
-
-	pcre2_match_context_free(match_context);
-	pcre2_match_data_free(match_data);
-	return !match_found;
+	/* The stages are flushed in order. */
+	pcresp_flush(first_ctx);
+	return !pcresp_match_found(ctx);
 }
 
 int main(int argc, char* argv[])
 {
-	int result = pcresp_main(argc, argv);
+	pcresp_ctx *ctx = pcresp_ctx_create();
+	int result;
 
-	if (re_code != NULL) {
-		pcre2_code_free(re_code);
-	}
-	if (ext_string_list != NULL) {
-		free(ext_string_list);
+	if (ctx == NULL) {
+		return 2;
 	}
-	if (shell != NULL) {
-		free(shell);
+
+	set_signal_handlers(ctx);
+	result = pcresp_main(ctx, argc, argv);
+	pcresp_ctx_free(ctx);
+
+	if (signal_number != 0) {
+		/* The output is flushed, terminate by the signal. */
+		signal(signal_number, SIG_DFL);
+		raise(signal_number);
 	}
 	return result;
 }
@@ -24,24 +24,55 @@
  * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#ifdef __linux__
+#define _GNU_SOURCE
+#endif
+
 #include "pcresp.h"
 
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
 #include <sys/wait.h>
+#include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
 #include <unistd.h>
 
 #define HAS_PRINT_FLAG 0x1
 #define HAS_NO_NEWLINE_FLAG 0x2
 #define HAS_NULL_FLAG 0x4
 #define HAS_NO_SH_FLAG 0x8
-
-static const char *do_check_script(const char *script, size_t script_size, char **msg)
+#define HAS_STDIN_FLAG 0x10
+#define HAS_MEMFD_FLAG 0x20
+#define HAS_BATCH_FLAG 0x40
+#define HAS_WRITE_FLAG 0x80
+#define HAS_DL_FLAG 0x100
+
+/* Shorter passthrough ranges are copied by fwrite. */
+#define ZERO_COPY_MIN_SIZE (32 * 1024)
+
+/* Size of the offset strings of *print scripts. */
+#define PRINT_NUMBER_SIZE 24
+/* Longer *print outputs are written by writev. */
+#define PRINT_WRITEV_MIN_SIZE (16 * 1024)
+
+#define ZERO_COPY_DISABLED -1
+#define ZERO_COPY_UNKNOWN 0
+#define ZERO_COPY_SPLICE 1
+#define ZERO_COPY_COPY_FILE_RANGE 2
+
+static const char *do_check_script(const char *script, size_t script_size, int is_callout, char **msg,
+	const char **plugin_name, size_t *plugin_name_length, int *line_positions)
 {
 	const int max_args = 1000;
 	const char *src, *src_end, *flag_start;
 	PCRE2_SIZE capture_id;
 	size_t args_len, flag_len;
+	hash_reference reference;
 	int in_group = 0;
+	int in_braces;
 	int flags = 0;
 
 	if (script == NULL || script_size == 0) {
@@ -90,17 +121,139 @@ static const char *do_check_script(const char *script, size_t script_size, char
 				*msg = "duplicated *!nl flag";
 				return flag_start - 1;
 			}
-			if (!(flags & HAS_PRINT_FLAG)) {
-				*msg = "*print required before *!nl flag";
+			if (!(flags & (HAS_PRINT_FLAG | HAS_WRITE_FLAG))) {
+				*msg = "*print or *write required before *!nl flag";
 				return flag_start - 1;
 			}
 			flags |= HAS_NO_NEWLINE_FLAG;
 		}
+		else if (flag_len >= 6 && memcmp (flag_start, "stdin:", 6) == 0) {
+			if (flags & HAS_STDIN_FLAG) {
+				*msg = "duplicated *stdin flag";
+				return flag_start - 1;
+			}
+			flags |= HAS_STDIN_FLAG;
+
+			/* Comma separated list of capture indicies, e.g: *stdin:1,3 */
+			flag_start += 6;
+			while (1) {
+				if (flag_start >= src || *flag_start < '0' || *flag_start > '9') {
+					*msg = "a decimal number between 0 and 65535 is required";
+					return flag_start;
+				}
+
+				capture_id = 0;
+				do {
+					capture_id = capture_id * 10 + (*flag_start - '0');
+					if (capture_id > 65535) {
+						*msg = "a decimal number between 0 and 65535 is required";
+						return flag_start;
+					}
+					flag_start++;
+				} while (flag_start < src && *flag_start >= '0' && *flag_start <= '9');
+
+				if (flag_start >= src) {
+					break;
+				}
+
+				if (*flag_start != ',') {
+					*msg = "a comma is required between capture indicies";
+					return flag_start;
+				}
+				flag_start++;
+			}
+		}
+		else if (flag_len >= 6 && memcmp (flag_start, "batch:", 6) == 0) {
+			if (flags & HAS_BATCH_FLAG) {
+				*msg = "duplicated *batch flag";
+				return flag_start - 1;
+			}
+			if (is_callout) {
+				*msg = "*batch is not allowed in callouts";
+				return flag_start - 1;
+			}
+			flags |= HAS_BATCH_FLAG;
+
+			/* Maximum number of matches and optional byte limit, e.g: *batch:100,65536 */
+			flag_start += 6;
+			for (in_braces = 0; in_braces < 2; in_braces++) {
+				if (flag_start >= src || *flag_start < '0' || *flag_start > '9') {
+					*msg = "a decimal number between 1 and 1000000000 is required";
+					return flag_start;
+				}
+
+				capture_id = 0;
+				do {
+					capture_id = capture_id * 10 + (*flag_start - '0');
+					if (capture_id > 1000000000) {
+						*msg = "a decimal number between 1 and 1000000000 is required";
+						return flag_start;
+					}
+					flag_start++;
+				} while (flag_start < src && *flag_start >= '0' && *flag_start <= '9');
+
+				if (capture_id == 0) {
+					*msg = "a decimal number between 1 and 1000000000 is required";
+					return flag_start;
+				}
+
+				if (flag_start >= src) {
+					break;
+				}
+
+				if (*flag_start != ',' || in_braces == 1) {
+					*msg = "invalid *batch flag";
+					return flag_start;
+				}
+				flag_start++;
+			}
+		}
+		else if (flag_len == 5 && memcmp (flag_start, "write", 5) == 0) {
+			if (flags & HAS_WRITE_FLAG) {
+				*msg = "duplicated *write flag";
+				return flag_start - 1;
+			}
+			flags |= HAS_WRITE_FLAG;
+		}
+		else if (flag_len == 2 && memcmp (flag_start, "dl", 2) == 0) {
+			if (flags & HAS_DL_FLAG) {
+				*msg = "duplicated *dl flag";
+				return flag_start - 1;
+			}
+			flags |= HAS_DL_FLAG;
+		}
+		else if (flag_len == 5 && memcmp (flag_start, "memfd", 5) == 0) {
+			if (flags & HAS_MEMFD_FLAG) {
+				*msg = "duplicated *memfd flag";
+				return flag_start - 1;
+			}
+			flags |= HAS_MEMFD_FLAG;
+		}
 		else {
 			*msg = "unknown flag";
 			return flag_start - 1;
 		}
 
+		if ((flags & HAS_PRINT_FLAG) && (flags & (HAS_STDIN_FLAG | HAS_MEMFD_FLAG | HAS_BATCH_FLAG))) {
+			*msg = "*print cannot be combined with *stdin, *memfd or *batch";
+			return src;
+		}
+
+		if ((flags & HAS_BATCH_FLAG) && (flags & HAS_STDIN_FLAG)) {
+			*msg = "*batch and *stdin cannot be combined";
+			return src;
+		}
+
+		if ((flags & HAS_WRITE_FLAG) && (flags & ~(HAS_WRITE_FLAG | HAS_NO_NEWLINE_FLAG))) {
+			*msg = "*write can only be combined with *!nl";
+			return src;
+		}
+
+		if ((flags & HAS_DL_FLAG) && (flags & ~HAS_DL_FLAG)) {
+			*msg = "*dl cannot be combined with other flags";
+			return src;
+		}
+
 		if ((flags & HAS_PRINT_FLAG) && (flags & HAS_NO_SH_FLAG)) {
 			*msg = "*print and *!sh cannot be combined";
 			return flag_start - 1;
@@ -117,9 +270,33 @@ static const char *do_check_script(const char *script, size_t script_size, char
 	}
 
 	if (src == src_end) {
+		if (flags & HAS_WRITE_FLAG) {
+			*msg = "*write requires a file name";
+			return src;
+		}
+		if (flags & HAS_DL_FLAG) {
+			*msg = "*dl requires a library:function argument";
+			return src;
+		}
 		return NULL;
 	}
 
+	if (flags & HAS_DL_FLAG) {
+		/* The plugin is loaded at compile time, so its name must be constant. */
+		flag_start = src;
+		while (src < src_end && !IS_SPACE(*src)) {
+			if (*src == '#' || *src == '<') {
+				*msg = "library:function argument must be a constant";
+				return src;
+			}
+			src++;
+		}
+
+		*plugin_name = flag_start;
+		*plugin_name_length = (size_t)(src - flag_start);
+		src = flag_start;
+	}
+
 	args_len = 1;
 
 	do {
@@ -163,81 +340,58 @@ static const char *do_check_script(const char *script, size_t script_size, char
 				return src;
 			}
 
-			if (*src >= '0' && *src <= '9') {
-				capture_id = 0;
-				do {
-					capture_id = capture_id * 10 + (*src - '0');
-					if (capture_id > 65535) {
-						*msg = "a decimal number between 0 and 65535 is required";
-						return src;
-					}
-
-					src++;
-				} while (src < src_end && *src >= '0' && *src <= '9');
-
+			if ((*src >= '0' && *src <= '9') || *src == '{' || *src == '[') {
+				src = parse_hash_reference(src, src_end, &reference, msg);
+				if (*msg != NULL) {
+					return src;
+				}
 				continue;
 			}
 
-			if (*src == '{') {
-				/* Must be a decimal number in parenthesis, e.g: {5} or {38} */
+			if (*src == '^' || *src == '$') {
+				/* Offset of a capture block, e.g: #^5 or #${38} */
 				src++;
-				capture_id = 0;
+				in_braces = (src < src_end && *src == '{');
+				if (in_braces) {
+					src++;
+				}
 
-				while (1) {
-					if (src >= src_end || *src < '0' || *src > '9') {
-						*msg = "a decimal number between 0 and 65535 is required";
-						return src;
-					}
+				if (src >= src_end || *src < '0' || *src > '9') {
+					*msg = "a decimal number between 0 and 65535 is required";
+					return src;
+				}
 
+				capture_id = 0;
+				do {
 					capture_id = capture_id * 10 + (*src - '0');
-
 					if (capture_id > 65535) {
 						*msg = "a decimal number between 0 and 65535 is required";
 						return src;
 					}
-
 					src++;
-					if (src < src_end && (*src == '}' || *src == ',')) {
-						break;
-					}
+				} while (src < src_end && *src >= '0' && *src <= '9');
 
+				if (!in_braces) {
+					continue;
 				}
 
-				if (*src == ',') {
-					src++;
-
-					if (src >= src_end || *src == '}') {
-						*msg = "string name cannot be empty";
-						return src;
-					}
-
-					while (1) {
-						src++;
-						if (src >= src_end) {
-							*msg = "string name is not terminated by '}'";
-							return src;
-						}
-						if (*src == '}') {
-							break;
-						}
-					}
+				if (src >= src_end || *src != '}') {
+					*msg = "decimal number is not terminated by '}'";
+					return src;
 				}
 			}
-			else if (*src == '[') {
-				src++;
-
-				if (src >= src_end || *src == ']') {
-					*msg = "string name cannot be empty";
+			else if (*src == 'F') {
+				if (!(flags & HAS_MEMFD_FLAG)) {
+					*msg = "#F requires *memfd flag";
 					return src;
 				}
-
-				do {
-					src++;
-					if (src >= src_end) {
-						*msg = "string name is not terminated by ']'";
-						return src;
-					}
-				} while (*src != ']');
+			}
+			else if (*src == 'L' || *src == 'C') {
+				if (is_callout) {
+					*msg = "#L and #C are not allowed in callouts";
+					return src;
+				}
+				*line_positions = 1;
 			}
 			else if (*src != '#' && *src != '<' && *src != '>' && *src != 'M' && *src != 'n') {
 				*msg = "invalid # (hash mark) sequence";
@@ -255,10 +409,13 @@ static const char *do_check_script(const char *script, size_t script_size, char
 	return 0;
 }
 
-int check_script(const char *script, size_t script_size)
+int check_script(pcresp_ctx *ctx, const char *script, size_t script_size)
 {
 	char *err_msg = NULL;
-	const char *err_pos = do_check_script(script, script_size, &err_msg);
+	const char *plugin_name = NULL;
+	size_t plugin_name_length = 0;
+	const char *err_pos = do_check_script(script, script_size, script != ctx->default_script, &err_msg,
+		&plugin_name, &plugin_name_length, &ctx->line_positions);
 	size_t err_offs;
 
 	if (err_pos != NULL) {
@@ -271,16 +428,20 @@ int check_script(const char *script, size_t script_size)
 		fprintf(stderr, "\n    Error at offset %d : %s\n", (int)err_offs, err_msg);
 		return 0;
 	}
+
+	if (plugin_name != NULL) {
+		return load_plugin(ctx, plugin_name, plugin_name_length);
+	}
 	return 1;
 }
 
-static size_t get_capture_len(PCRE2_SIZE capture_id, PCRE2_SIZE *ovector, const char *script)
+static size_t get_capture_len(pcresp_ctx *ctx, PCRE2_SIZE capture_id, PCRE2_SIZE *ovector, const char *script)
 {
-	if (capture_id >= ovector_size) {
+	if (capture_id >= ctx->ovector_size) {
 		return PCRE2_UNSET;
 	}
 
-	if (capture_id == 0 && script != default_script) {
+	if (capture_id == 0 && script != ctx->default_script) {
 		return PCRE2_UNSET;
 	}
 
@@ -297,10 +458,28 @@ static size_t get_capture_len(PCRE2_SIZE capture_id, PCRE2_SIZE *ovector, const
 	return ovector[capture_id + 1] - ovector[capture_id];
 }
 
-static ext_string * get_ext_string(const char *name, size_t length)
+/* Returns with the transformed capture. The result is computed
+ * by both passes of run_script, so the buffers are not grown by
+ * the second pass, and its length cannot differ. */
+static const char *transform_capture(pcresp_ctx *ctx, uint32_t transforms, const char *buffer,
+	PCRE2_SIZE *ovector, PCRE2_SIZE capture_id, size_t *length)
+{
+	const char *result;
+
+	*length = ovector[capture_id * 2 + 1] > ovector[capture_id * 2]
+		? ovector[capture_id * 2 + 1] - ovector[capture_id * 2] : 0;
+	result = apply_transforms(ctx, transforms, buffer + ovector[capture_id * 2], length);
+
+	if (result == NULL) {
+		*length = 0;
+	}
+	return result;
+}
+
+ext_string *get_ext_string(pcresp_ctx *ctx, const char *name, size_t length)
 {
-	ext_string *current = ext_string_list;
-	ext_string *end = ext_string_list + ext_string_count;
+	ext_string *current = ctx->ext_string_list;
+	ext_string *end = ctx->ext_string_list + ctx->ext_string_count;
 
 	while (current < end) {
 		if (current->name_length == length && memcmp(current->name, name, length) == 0) {
@@ -311,449 +490,1556 @@ static ext_string * get_ext_string(const char *name, size_t length)
 	return NULL;
 }
 
-int run_script(const char *script, size_t script_size, const char *buffer, PCRE2_SIZE *ovector, char *mark)
+static const char *parse_offset(const char *src, PCRE2_SIZE *capture_id, int *is_end)
 {
-	const char *src, *src_end, *src_start;
-	char *str_list_dst;
-	size_t args_len, str_list_len, string_name_len, length;
-	PCRE2_SIZE capture_id;
-	const char *string_name;
-	char **args, **args_dst;
-	int result, in_group, flags = 0;
-	ext_string *string;
-	pid_t pid;
+	/* The syntax is checked by do_check_script. */
+	*is_end = (*src == '$');
+	*capture_id = 0;
+	src++;
 
-	if (script == NULL || script_size == 0) {
-		return 0;
+	if (*src == '{') {
+		src++;
+		do {
+			*capture_id = *capture_id * 10 + (*src - '0');
+			src++;
+		} while (*src != '}');
+		return src + 1;
 	}
 
-	/* Checking syntax and compute the number of string fragments.
-	 * Callout strings are ignored in case of a syntax error. */
-	src = script;
-	src_end = script + script_size;
-
-	while (src < src_end && IS_SPACE(*src)) {
+	do {
+		*capture_id = *capture_id * 10 + (*src - '0');
 		src++;
+	} while (*src >= '0' && *src <= '9');
+	return src;
+}
+
+static size_t get_offset_string(pcresp_ctx *ctx, PCRE2_SIZE capture_id, int is_end,
+	PCRE2_SIZE *ovector, const char *script, char *dst)
+{
+	if (get_capture_len(ctx, capture_id, ovector, script) == PCRE2_UNSET) {
+		return 0;
 	}
 
-	while (*src == '*') {
-		src++;
+	return (size_t)sprintf(dst, "%lu", (unsigned long)ovector[capture_id * 2 + is_end]);
+}
 
-		src_start = src;
-		while (src < src_end && *src != '\0' && !IS_SPACE(*src)) {
-			src++;
-		}
+static size_t get_line_string(pcresp_ctx *ctx, int is_column, char *dst)
+{
+	return (size_t)sprintf(dst, "%lu", (unsigned long)(is_column ? ctx->column : ctx->line_number));
+}
 
-		length = src - src_start;
-		if (length == 5) {
-			/* Shell has no effect on print. */
-			flags |= HAS_PRINT_FLAG | HAS_NO_SH_FLAG;
-		}
-		if (length == 4) {
-			flags |= HAS_NULL_FLAG;
-		}
-		else if (length == 3) {
-			if (src_start[1] == 's')
-				flags |= HAS_NO_SH_FLAG;
-			else
-				flags |= HAS_NO_NEWLINE_FLAG;
-		}
+/* The subject is exposed to the scripts as a read-only file. The
+ * mapped input file is shared when possible, otherwise the subject
+ * is copied into a sealed memfd once per subject. */
+static int get_subject_fd(pcresp_ctx *ctx)
+{
+	size_t offset;
+	ssize_t result;
+	int fd;
 
-		while (src < src_end && IS_SPACE(*src)) {
-			src++;
-		}
+	if (ctx->subject_fd >= 0) {
+		return ctx->subject_fd;
 	}
 
-	if (src == src_end) {
-		return 0;
+	if (ctx->input_fd >= 0 && ctx->input_offset == 0) {
+		/* A new descriptor, since stdin can be redirected by *stdin. */
+		ctx->subject_fd = dup(ctx->input_fd);
+		return ctx->subject_fd;
 	}
 
-	args_len = 2;
-	str_list_len = 1;
-	in_group = 0;
-	src_start = src;
-
-	if (!(flags & HAS_NO_SH_FLAG) && shell_args > 0) {
-		args_len += shell_args - 1;
+#ifdef MFD_ALLOW_SEALING
+	fd = memfd_create("pcresp-subject", MFD_ALLOW_SEALING);
+	if (fd < 0) {
+		fprintf(stderr, "Cannot create memfd\n");
+		return -1;
 	}
 
-	if (*src == '<') {
-		in_group = 1;
-		src++;
+	offset = 0;
+	while (offset < ctx->subject_size) {
+		result = write(fd, ctx->subject + offset, ctx->subject_size - offset);
+		if (result < 0 && errno == EINTR) {
+			continue;
+		}
+		if (result <= 0) {
+			fprintf(stderr, "Cannot write memfd\n");
+			close(fd);
+			return -1;
+		}
+		offset += (size_t)result;
 	}
 
-	do {
-		if ((!in_group && IS_SPACE(*src)) || (in_group && *src == '>')) {
-			args_len++;
-			str_list_len++;
+	fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL);
+	ctx->subject_fd = fd;
+	return fd;
+#else /* !MFD_ALLOW_SEALING */
+	(void)offset;
+	(void)result;
+	(void)fd;
+	fprintf(stderr, "*memfd is not supported on this system\n");
+	return -1;
+#endif /* MFD_ALLOW_SEALING */
+}
 
-			src++;
-			while (src < src_end && IS_SPACE(*src)) {
-				src++;
-			}
+static size_t get_subject_path(pcresp_ctx *ctx, char *dst)
+{
+	int fd = get_subject_fd(ctx);
 
-			in_group = 0;
-			if (src == src_end) {
-				args_len--;
-				str_list_len--;
-			}
-			else if (*src == '<') {
-				in_group = 1;
-				src++;
+	if (fd < 0) {
+		return 0;
+	}
+	return (size_t)sprintf(dst, "/dev/fd/%d", fd);
+}
+
+static int write_to_pipe(int fd, const char *data, size_t length)
+{
+	ssize_t result;
+#ifdef __linux__
+	struct iovec iov;
+	int use_vmsplice = 1;
+#endif /* __linux__ */
+
+	while (length > 0) {
+#ifdef __linux__
+		if (use_vmsplice) {
+			/* The subject is not modified until the child is terminated. */
+			iov.iov_base = (void*)data;
+			iov.iov_len = length;
+			result = vmsplice(fd, &iov, 1, 0);
+
+			if (result < 0 && (errno == EINVAL || errno == ENOSYS)) {
+				use_vmsplice = 0;
+				continue;
 			}
-			continue;
 		}
-		else if (*src == '#')
-		{
-			src++;
-			capture_id = 0;
-			string_name = NULL;
-			string_name_len = 0;
-
-			if (*src >= '0' && *src <= '9') {
-				do {
-					capture_id = capture_id * 10 + (*src - '0');
-					src++;
-				} while (src < src_end && *src >= '0' && *src <= '9');
+		else
+#endif /* __linux__ */
+			result = write(fd, data, length);
 
-				/* Increase ID */
-				capture_id++;
+		if (result < 0) {
+			if (errno == EINTR) {
+				continue;
 			}
-			else if (*src == '{')
-			{
-				/* Must be a decimal number in braces, e.g: {5} or {38} */
-				src++;
+			/* EPIPE: the child does not read its input. */
+			return 0;
+		}
 
-				do
-				{
-					capture_id = capture_id * 10 + (*src - '0');
-					src++;
-				} while (*src != '}' && *src != ',');
+		data += result;
+		length -= (size_t)result;
+	}
+	return 1;
+}
 
-				if (*src == ',') {
-					string_name = src + 1;
+static void feed_captures(pcresp_ctx *ctx, int fd, const char *list, const char *list_end,
+	const char *buffer, PCRE2_SIZE *ovector, const char *script)
+{
+	struct sigaction ignore_action, old_action;
+	PCRE2_SIZE capture_id;
+	size_t length;
 
-					do
-					{
-						src++;
-					} while (*src != '}');
+	memset(&ignore_action, 0, sizeof(ignore_action));
+	ignore_action.sa_handler = SIG_IGN;
+	sigaction(SIGPIPE, &ignore_action, &old_action);
 
-					string_name_len = src - string_name;
-				}
+	while (list < list_end) {
+		capture_id = 0;
+		do {
+			capture_id = capture_id * 10 + (*list - '0');
+			list++;
+		} while (list < list_end && *list != ',');
+		list++;
 
-				src++;
-				/* Increase ID */
-				capture_id++;
-			}
-			else if (*src == '[')
-			{
-				string_name = src + 1;
+		length = get_capture_len(ctx, capture_id, ovector, script);
 
-				do
-				{
-					src++;
-				} while (*src != ']');
+		if (length == PCRE2_UNSET || length == 0) {
+			continue;
+		}
 
-				string_name_len = src - string_name;
-				src++;
-			}
-			else if (*src == 'M') {
-				if (mark != NULL) {
-					str_list_len += strlen(mark);
-				}
-				src++;
-				continue;
-			}
+		if (ctx->verbose) {
+			printf("  Verbose: stdin: capture %d (%lu bytes)\n", (int)capture_id, (unsigned long)length);
+		}
 
-			if (capture_id > 0) {
-				length = get_capture_len(capture_id - 1, ovector, script);
+		if (!write_to_pipe(fd, buffer + ovector[capture_id * 2], length)) {
+			break;
+		}
+	}
 
-				if (length != PCRE2_UNSET) {
-					str_list_len += length;
-					continue;
-				}
-			}
+	sigaction(SIGPIPE, &old_action, NULL);
+}
 
-			if (string_name != NULL) {
-				string = get_ext_string(string_name, string_name_len);
+/* Scripts of chained stages write into a temporary file, which is
+ * copied to the output of the stage after the script is terminated. */
+static int get_script_output_fd(pcresp_ctx *ctx)
+{
+	if (ctx->script_output == NULL) {
+		ctx->script_output = tmpfile();
+		if (ctx->script_output == NULL) {
+			fprintf(stderr, "Cannot create temporary file\n");
+			return -1;
+		}
+	}
+	return fileno(ctx->script_output);
+}
 
-				if (string != NULL) {
+static void copy_script_output(pcresp_ctx *ctx, int fd)
+{
+	char buffer[65536];
+	ssize_t length;
+
+	if (lseek(fd, 0, SEEK_SET) != 0) {
+		return;
+	}
+
+	while (1) {
+		length = read(fd, buffer, sizeof(buffer));
+		if (length <= 0) {
+			if (length < 0 && errno == EINTR) {
+				continue;
+			}
+			break;
+		}
+		fwrite(buffer, 1, (size_t)length, ctx->output);
+	}
+
+	/* The file is reused by the next script. */
+	if (ftruncate(fd, 0) != 0 || lseek(fd, 0, SEEK_SET) != 0) {
+		fclose(ctx->script_output);
+		ctx->script_output = NULL;
+	}
+}
+
+static int spawn_script(pcresp_ctx *ctx, char **args, int flags, const char *stdin_list,
+	const char *stdin_list_end, const char *buffer, PCRE2_SIZE *ovector, const char *script)
+{
+	int result;
+	int pipe_fds[2];
+	int output_fd = -1;
+	uint64_t start = 0;
+	pid_t pid;
+
+	if (flags & HAS_NULL_FLAG) {
+		/* The output is discarded. */
+	}
+	else if (ctx->pipeline != NULL) {
+		/* The scripts write into the pipe of the pipeline writer. */
+		output_fd = fileno(ctx->output);
+	}
+	else if (ctx->output != stdout) {
+		output_fd = get_script_output_fd(ctx);
+		if (output_fd < 0) {
+			return 1;
+		}
+	}
+
+	if ((flags & HAS_STDIN_FLAG) && pipe(pipe_fds) != 0) {
+		fprintf(stderr, "Cannot create pipe\n");
+		return 1;
+	}
+
+	if (ctx->trace != NULL) {
+		start = trace_time();
+	}
+
+	pid = fork();
+
+	if (pid == 0) {
+		/* The caller may ignore SIGPIPE to detect output errors. */
+		signal(SIGPIPE, SIG_DFL);
+
+		if (flags & HAS_NULL_FLAG) {
+			result = open("/dev/null", O_WRONLY);
+			if (result > -1) {
+				dup2(result, STDOUT_FILENO);
+				close(result);
+			}
+		}
+		else if (output_fd >= 0) {
+			dup2(output_fd, STDOUT_FILENO);
+		}
+
+		if (flags & HAS_STDIN_FLAG) {
+			dup2(pipe_fds[0], STDIN_FILENO);
+			close(pipe_fds[0]);
+			close(pipe_fds[1]);
+		}
+
+		(void)execv(args[0], args);
+		/* Control gets here if there is an error,
+		 * e.g. a non-existent program. */
+		exit(1);
+	}
+
+	if (flags & HAS_STDIN_FLAG) {
+		close(pipe_fds[0]);
+		if (pid > 0) {
+			feed_captures(ctx, pipe_fds[1], stdin_list, stdin_list_end, buffer, ovector, script);
+		}
+		close(pipe_fds[1]);
+	}
+
+	result = 1;
+	if (pid > 0) {
+		/* The child is reaped even if a signal cancels the processing. */
+		while (waitpid(pid, &result, 0) < 0 && errno == EINTR) {
+		}
+	}
+
+	if (output_fd >= 0 && ctx->pipeline == NULL) {
+		copy_script_output(ctx, output_fd);
+	}
+
+	if (ctx->trace != NULL) {
+		/* Exit status, or the negated signal number. */
+		trace_event_end(ctx, TRACE_SCRIPT, start, NULL, (long)pid,
+			WIFEXITED(result) ? (long)WEXITSTATUS(result) : -(long)WTERMSIG(result));
+	}
+
+	/* Currently negative return values are not supported,
+	 * only zero (match continues) or non-zero (match fails). */
+
+	return !!result;
+}
+
+static int batch_prefix_equals(script_batch *batch, char **args, size_t prefix_count)
+{
+	const char *data = batch->data;
+	size_t length;
+
+	while (prefix_count > 0) {
+		length = strlen(*args) + 1;
+		if (memcmp(data, *args, length) != 0) {
+			return 0;
+		}
+		data += length;
+		args++;
+		prefix_count--;
+	}
+	return 1;
+}
+
+static int append_to_batch(script_batch *batch, const char *arg)
+{
+	size_t length = strlen(arg) + 1;
+	size_t new_max;
+	char *new_data;
+
+	if (batch->data_length + length > batch->data_max) {
+		new_max = batch->data_max > 0 ? batch->data_max * 2 : 4096;
+		while (new_max < batch->data_length + length) {
+			new_max *= 2;
+		}
+
+		new_data = (char*)realloc(batch->data, new_max);
+		if (new_data == NULL) {
+			fprintf(stderr, "Cannot allocate memory\n");
+			return 0;
+		}
+
+		batch->data = new_data;
+		batch->data_max = new_max;
+	}
+
+	memcpy(batch->data + batch->data_length, arg, length);
+	batch->data_length += length;
+	batch->arg_count++;
+	return 1;
+}
+
+/* The prefix (program and shell arguments) is stored once, and the
+ * remaining arguments of each match are appended after it. */
+static int add_to_batch(pcresp_ctx *ctx, char **args, size_t prefix_count,
+	size_t batch_size, size_t batch_bytes, int flags)
+{
+	script_batch *batch = &ctx->batch;
+	size_t bytes = 0;
+	long arg_max;
+	char **arg;
+
+	/* Each argument uses a pointer and a zero terminated string. */
+	for (arg = args; *arg != NULL; arg++) {
+		bytes += sizeof(char*) + strlen(*arg) + 1;
+	}
+
+	arg_max = sysconf(_SC_ARG_MAX);
+	if (arg_max <= 0) {
+		arg_max = 128 * 1024;
+	}
+
+	/* The other half is left for the environment. */
+	if (batch_bytes == 0 || batch_bytes > (size_t)arg_max / 2) {
+		batch_bytes = (size_t)arg_max / 2;
+	}
+
+	if (batch->arg_count > 0) {
+		if (batch->flags != flags || batch->prefix_count != prefix_count
+				|| !batch_prefix_equals(batch, args, prefix_count)
+				|| batch->bytes + bytes - batch->prefix_bytes > batch_bytes) {
+			flush_batch(ctx);
+		}
+	}
+
+	if (batch->arg_count == 0) {
+		batch->flags = flags;
+		batch->prefix_count = prefix_count;
+		batch->prefix_bytes = 0;
+		batch->bytes = 0;
+		batch->match_count = 0;
+
+		for (arg = args; arg < args + prefix_count; arg++) {
+			if (!append_to_batch(batch, *arg)) {
+				return 1;
+			}
+			batch->prefix_bytes += sizeof(char*) + strlen(*arg) + 1;
+		}
+		batch->bytes = batch->prefix_bytes;
+		arg = args + prefix_count;
+	}
+	else {
+		arg = args + prefix_count;
+	}
+
+	while (*arg != NULL) {
+		if (!append_to_batch(batch, *arg)) {
+			return 1;
+		}
+		arg++;
+	}
+
+	batch->bytes += bytes - batch->prefix_bytes;
+	batch->match_count++;
+
+	if (batch->match_count >= batch_size) {
+		flush_batch(ctx);
+	}
+	return 0;
+}
+
+void flush_batch(pcresp_ctx *ctx)
+{
+	script_batch *batch = &ctx->batch;
+	char **args, **args_dst;
+	char *data;
+	size_t i;
+
+	if (batch->arg_count == 0) {
+		return;
+	}
+
+	if (ctx->cancelled > CANCEL_LIMIT) {
+		/* Pending scripts are dropped. */
+		batch->data_length = 0;
+		batch->arg_count = 0;
+		batch->match_count = 0;
+		return;
+	}
+
+	args = (char**)malloc((batch->arg_count + 1) * sizeof(char*));
+
+	if (args != NULL) {
+		data = batch->data;
+		args_dst = args;
+
+		for (i = 0; i < batch->arg_count; i++) {
+			*args_dst++ = data;
+			data += strlen(data) + 1;
+		}
+		*args_dst = NULL;
+
+		if (ctx->verbose) {
+			printf("  Verbose: batch of %d matches\n", (int)batch->match_count);
+			for (i = 0; i < batch->arg_count; i++) {
+				printf("  Verbose: arg[%d]: '%s'\n", (int)i, args[i]);
+			}
+		}
+
+		fflush(ctx->output);
+		spawn_script(ctx, args, batch->flags, NULL, NULL, NULL, NULL, NULL);
+		free(args);
+	}
+	else {
+		fprintf(stderr, "Cannot allocate memory\n");
+	}
+
+	batch->data_length = 0;
+	batch->arg_count = 0;
+	batch->match_count = 0;
+}
+
+int run_script(pcresp_ctx *ctx, const char *script, size_t script_size, const char *buffer, PCRE2_SIZE *ovector, char *mark)
+{
+	const char *src, *src_end, *src_start;
+	char *str_list_dst;
+	size_t args_len, str_list_len, string_name_len, length;
+	PCRE2_SIZE capture_id;
+	const char *string_name;
+	const char *stdin_list = NULL, *stdin_list_end = NULL;
+	char **args, **args_dst;
+	char offset_string[32];
+	const char *data;
+	char *msg = NULL;
+	hash_reference reference;
+	uint32_t transforms;
+	size_t batch_size = 0, batch_bytes = 0;
+	int result, in_group, is_end, flags = 0;
+	ext_string *string;
+
+	if (script == NULL || script_size == 0 || ctx->cancelled > CANCEL_LIMIT) {
+		return 0;
+	}
+
+	/* Checking syntax and compute the number of string fragments.
+	 * Callout strings are ignored in case of a syntax error. */
+	src = script;
+	src_end = script + script_size;
+
+	while (src < src_end && IS_SPACE(*src)) {
+		src++;
+	}
+
+	while (*src == '*') {
+		src++;
+
+		src_start = src;
+		while (src < src_end && *src != '\0' && !IS_SPACE(*src)) {
+			src++;
+		}
+
+		length = src - src_start;
+		if (length == 5 && src_start[0] == 'p') {
+			/* Shell has no effect on print. */
+			flags |= HAS_PRINT_FLAG | HAS_NO_SH_FLAG;
+		}
+		else if (length == 5 && src_start[0] == 'w') {
+			/* Shell has no effect on write. */
+			flags |= HAS_WRITE_FLAG | HAS_NO_SH_FLAG;
+		}
+		else if (length == 5) {
+			flags |= HAS_MEMFD_FLAG;
+		}
+		else if (length == 4) {
+			flags |= HAS_NULL_FLAG;
+		}
+		else if (length == 2) {
+			flags |= HAS_DL_FLAG | HAS_NO_SH_FLAG;
+		}
+		else if (length > 5 && src_start[0] == 's') {
+			flags |= HAS_STDIN_FLAG;
+			stdin_list = src_start + 6;
+			stdin_list_end = src;
+		}
+		else if (length > 5) {
+			flags |= HAS_BATCH_FLAG;
+			src_start += 6;
+			batch_size = 0;
+			while (src_start < src && *src_start != ',') {
+				batch_size = batch_size * 10 + (size_t)(*src_start++ - '0');
+			}
+			if (src_start < src) {
+				src_start++;
+				batch_bytes = 0;
+				while (src_start < src) {
+					batch_bytes = batch_bytes * 10 + (size_t)(*src_start++ - '0');
+				}
+			}
+		}
+		else if (length == 3) {
+			if (src_start[1] == 's')
+				flags |= HAS_NO_SH_FLAG;
+			else
+				flags |= HAS_NO_NEWLINE_FLAG;
+		}
+
+		while (src < src_end && IS_SPACE(*src)) {
+			src++;
+		}
+	}
+
+	if (src == src_end) {
+		return 0;
+	}
+
+	args_len = 2;
+	str_list_len = 1;
+	in_group = 0;
+	src_start = src;
+
+	if (!(flags & HAS_NO_SH_FLAG) && ctx->shell_args > 0) {
+		args_len += ctx->shell_args - 1;
+	}
+
+	if (*src == '<') {
+		in_group = 1;
+		src++;
+	}
+
+	do {
+		if ((!in_group && IS_SPACE(*src)) || (in_group && *src == '>')) {
+			args_len++;
+			str_list_len++;
+
+			src++;
+			while (src < src_end && IS_SPACE(*src)) {
+				src++;
+			}
+
+			in_group = 0;
+			if (src == src_end) {
+				args_len--;
+				str_list_len--;
+			}
+			else if (*src == '<') {
+				in_group = 1;
+				src++;
+			}
+			continue;
+		}
+		else if (*src == '#')
+		{
+			src++;
+			capture_id = 0;
+			string_name = NULL;
+			string_name_len = 0;
+			transforms = 0;
+
+			if ((*src >= '0' && *src <= '9') || *src == '{' || *src == '[') {
+				/* The syntax is checked by do_check_script. */
+				src = parse_hash_reference(src, src_end, &reference, &msg);
+				/* Zero means no capture. */
+				capture_id = (reference.capture_id != PCRE2_UNSET) ? reference.capture_id + 1 : 0;
+				transforms = reference.transforms;
+				string_name = reference.name;
+				string_name_len = reference.name_length;
+			}
+			else if (*src == 'M') {
+				if (mark != NULL) {
+					str_list_len += strlen(mark);
+				}
+				src++;
+				continue;
+			}
+			else if (*src == '^' || *src == '$') {
+				src = parse_offset(src, &capture_id, &is_end);
+				str_list_len += get_offset_string(ctx, capture_id, is_end, ovector, script, offset_string);
+				continue;
+			}
+			else if (*src == 'F') {
+				str_list_len += get_subject_path(ctx, offset_string);
+				src++;
+				continue;
+			}
+			else if (*src == 'L' || *src == 'C') {
+				str_list_len += get_line_string(ctx, *src == 'C', offset_string);
+				src++;
+				continue;
+			}
+
+			if (capture_id > 0) {
+				length = get_capture_len(ctx, capture_id - 1, ovector, script);
+
+				if (length != PCRE2_UNSET) {
+					if (transforms != 0) {
+						transform_capture(ctx, transforms, buffer, ovector, capture_id - 1, &length);
+					}
+					str_list_len += length;
+					continue;
+				}
+			}
+
+			if (string_name != NULL) {
+				string = get_ext_string(ctx, string_name, string_name_len);
+
+				if (string != NULL) {
 					str_list_len += string->chars_length;
 				}
 				continue;
 			}
 
-			if (capture_id > 0) {
+			if (capture_id > 0) {
+				continue;
+			}
+		}
+
+		src++;
+		str_list_len++;
+	} while (src < src_end);
+
+	args = (char**)malloc((args_len * sizeof(char*)) + str_list_len);
+
+	if (args == NULL) {
+		return 0;
+	}
+
+	args_dst = args;
+	str_list_dst = (char*)(args + args_len);
+
+	if (!(flags & HAS_NO_SH_FLAG) && ctx->shell_args > 0) {
+		memcpy(args_dst, ctx->shell, ctx->shell_args * sizeof(char*));
+		args_dst[ctx->shell_arg0_index] = str_list_dst;
+		args_dst += ctx->shell_args;
+	}
+	else {
+		*args_dst++ = str_list_dst;
+	}
+
+	src = src_start;
+	in_group = 0;
+
+	if (*src == '<') {
+		in_group = 1;
+		src++;
+	}
+
+	do {
+		if ((!in_group && IS_SPACE(*src)) || (in_group && *src == '>')) {
+			*str_list_dst++ = '\0';
+			*args_dst++ = str_list_dst;
+
+			src++;
+			while (src < src_end && IS_SPACE(*src)) {
+				src++;
+			}
+
+			in_group = 0;
+			if (src == src_end) {
+				str_list_dst--;
+				args_dst--;
+			}
+			else if (src < src_end && *src == '<') {
+				in_group = 1;
+				src++;
+			}
+			continue;
+		}
+		else if (*src == '#')
+		{
+			src++;
+			capture_id = 0;
+			string_name = NULL;
+			string_name_len = 0;
+			transforms = 0;
+
+			if ((*src >= '0' && *src <= '9') || *src == '{' || *src == '[') {
+				/* The syntax is checked by do_check_script. */
+				src = parse_hash_reference(src, src_end, &reference, &msg);
+				/* Zero means no capture. */
+				capture_id = (reference.capture_id != PCRE2_UNSET) ? reference.capture_id + 1 : 0;
+				transforms = reference.transforms;
+				string_name = reference.name;
+				string_name_len = reference.name_length;
+			}
+			else if (*src == 'M') {
+				if (mark != NULL) {
+					length = strlen(mark);
+					memcpy(str_list_dst, mark, length);
+					str_list_dst += length;
+				}
+				src++;
+				continue;
+			}
+			else if (*src == 'n') {
+				*str_list_dst++ = '\n';
+				src++;
+				continue;
+			}
+			else if (*src == '^' || *src == '$') {
+				src = parse_offset(src, &capture_id, &is_end);
+				length = get_offset_string(ctx, capture_id, is_end, ovector, script, offset_string);
+				memcpy(str_list_dst, offset_string, length);
+				str_list_dst += length;
+				continue;
+			}
+			else if (*src == 'F') {
+				length = get_subject_path(ctx, offset_string);
+				memcpy(str_list_dst, offset_string, length);
+				str_list_dst += length;
+				src++;
+				continue;
+			}
+			else if (*src == 'L' || *src == 'C') {
+				length = get_line_string(ctx, *src == 'C', offset_string);
+				memcpy(str_list_dst, offset_string, length);
+				str_list_dst += length;
+				src++;
+				continue;
+			}
+
+			if (capture_id > 0) {
+				length = get_capture_len(ctx, capture_id - 1, ovector, script);
+
+				if (length != PCRE2_UNSET) {
+					data = buffer + ovector[(capture_id - 1) * 2];
+					if (transforms != 0) {
+						data = transform_capture(ctx, transforms, buffer, ovector, capture_id - 1, &length);
+					}
+					if (length > 0) {
+						memcpy(str_list_dst, data, length);
+						str_list_dst += length;
+					}
+					continue;
+				}
+			}
+
+			if (string_name != NULL) {
+				string = get_ext_string(ctx, string_name, string_name_len);
+
+				if (string != NULL) {
+					length = string->chars_length;
+					memcpy(str_list_dst, string->chars, length);
+					str_list_dst += length;
+				}
+				continue;
+			}
+
+			if (capture_id > 0) {
+				continue;
+			}
+		}
+
+		*str_list_dst++ = *src++;
+	} while (src < src_end);
+
+	*str_list_dst++ = '\0';
+	*args_dst++ = NULL;
+
+	if (args + args_len != args_dst) {
+		fprintf(stderr, "Internal error SAN1! Please file a bug report.\n");
+		exit(2);
+	}
+
+	if (((char*)(args + args_len)) + str_list_len != str_list_dst) {
+		fprintf(stderr, "Internal error SAN2! Please file a bug report.\n");
+		exit(2);
+	}
+
+	if (flags & HAS_BATCH_FLAG) {
+		length = (!(flags & HAS_NO_SH_FLAG) && ctx->shell_args > 0) ? ctx->shell_args : 1;
+		result = add_to_batch(ctx, args, length, batch_size, batch_bytes, flags);
+		free(args);
+		return result;
+	}
+
+	if (ctx->verbose) {
+		args_dst = args;
+		length = 0;
+		while (*args_dst != NULL) {
+			printf("  Verbose: arg[%d]: '%s'\n", (int)length, *args_dst);
+			length++;
+			args_dst++;
+		}
+	}
+
+	if (flags & HAS_DL_FLAG) {
+		result = call_plugin(ctx, args, buffer, ovector, mark);
+		free(args);
+		return result;
+	}
+
+	if (flags & HAS_WRITE_FLAG) {
+		/* The first argument is the file name. */
+		write_to_file(ctx, args[0], args + 1, !(flags & HAS_NO_NEWLINE_FLAG));
+		free(args);
+		return 0;
+	}
+
+	fflush(ctx->output);
+
+	if (flags & HAS_PRINT_FLAG) {
+		args_dst = args;
+		while (*args_dst != NULL) {
+			if (args_dst != args)
+				fprintf(ctx->output, " ");
+
+			fprintf(ctx->output, "%s", *args_dst);
+			args_dst++;
+		}
+
+		if (!(flags & HAS_NO_NEWLINE_FLAG))
+			fprintf(ctx->output, "\n");
+
+		free(args);
+		return 1;
+	}
+
+	result = spawn_script(ctx, args, flags, stdin_list, stdin_list_end, buffer, ovector, script);
+	free(args);
+	return result;
+}
+
+/* Converts the arguments of a *print script to template source:
+ * the separators are replaced by a single space, and the <> brackets
+ * are removed. The syntax is checked by do_check_script. */
+static size_t print_script_source(const char *src, const char *src_end, char *dst)
+{
+	char *dst_start = dst;
+	char terminator;
+	int in_group = 0;
+
+	if (*src == '<') {
+		in_group = 1;
+		src++;
+	}
+
+	while (src < src_end) {
+		if ((!in_group && IS_SPACE(*src)) || (in_group && *src == '>')) {
+			src++;
+			while (src < src_end && IS_SPACE(*src)) {
+				src++;
+			}
+
+			in_group = 0;
+			if (src == src_end) {
+				break;
+			}
+
+			*dst++ = ' ';
+			if (*src == '<') {
+				in_group = 1;
+				src++;
+			}
+			continue;
+		}
+
+		if (*src != '#') {
+			*dst++ = *src++;
+			continue;
+		}
+
+		*dst++ = *src++;
+		if ((*src == '^' || *src == '$') && src[1] == '{') {
+			*dst++ = *src++;
+		}
+
+		if (*src == '{' || *src == '[') {
+			terminator = (*src == '{') ? '}' : ']';
+			while (*src != terminator) {
+				*dst++ = *src++;
+			}
+		}
+		*dst++ = *src++;
+	}
+
+	return (size_t)(dst - dst_start);
+}
+
+int init_print_script(pcresp_ctx *ctx)
+{
+	const char *src = ctx->default_script;
+	const char *src_end = src + ctx->default_script_size;
+	const char *flag_start;
+	int has_print = 0, new_line = 1;
+	print_script *script;
+	char *source;
+	size_t length;
+
+	/* The arguments are displayed by run_script in verbose mode. */
+	if (ctx->verbose) {
+		return 1;
+	}
+
+	while (src < src_end && IS_SPACE(*src)) {
+		src++;
+	}
+
+	while (src < src_end && *src == '*') {
+		flag_start = ++src;
+		while (src < src_end && !IS_SPACE(*src)) {
+			src++;
+		}
+
+		length = (size_t)(src - flag_start);
+		if (length == 5 && memcmp(flag_start, "print", 5) == 0) {
+			has_print = 1;
+		}
+		else if (length == 3 && memcmp(flag_start, "!nl", 3) == 0) {
+			new_line = 0;
+		}
+		else {
+			return 1;
+		}
+
+		while (src < src_end && IS_SPACE(*src)) {
+			src++;
+		}
+	}
+
+	/* Scripts without arguments print nothing. */
+	if (!has_print || src == src_end) {
+		return 1;
+	}
+
+	/* The source is not longer than the arguments, and #n may be appended. */
+	source = (char*)malloc((size_t)(src_end - src) + 2);
+	script = (print_script*)malloc(sizeof(print_script));
+
+	if (source == NULL || script == NULL) {
+		fprintf(stderr, "Cannot allocate memory\n");
+		free(source);
+		free(script);
+		return 0;
+	}
+
+	length = print_script_source(src, src_end, source);
+	if (new_line) {
+		source[length++] = '#';
+		source[length++] = 'n';
+	}
+
+	script->tpl = compile_template(ctx, source, length);
+	free(source);
+
+	if (script->tpl == NULL) {
+		free(script);
+		return 0;
+	}
+
+	/* Transformed captures are not part of the subject. */
+	for (length = 0; length < script->tpl->item_count; length++) {
+		if (script->tpl->items[length].type == TEMPLATE_CAPTURE && script->tpl->items[length].transforms != 0) {
+			free(script->tpl);
+			free(script);
+			return 1;
+		}
+	}
+
+	/* Each item produces at most one fragment. */
+	length = script->tpl->item_count;
+	script->iov = (struct iovec*)malloc(length * sizeof(struct iovec));
+	script->numbers = (char*)malloc(length * PRINT_NUMBER_SIZE);
+	ctx->print_script = script;
+
+	if (script->iov == NULL || script->numbers == NULL) {
+		fprintf(stderr, "Cannot allocate memory\n");
+		return 0;
+	}
+	return 1;
+}
+
+/* Short outputs are copied into the stdio buffer, longer ones
+ * are written by writev after the buffer is flushed. */
+static void write_fragments(pcresp_ctx *ctx, struct iovec *iov, int count, size_t total_length)
+{
+	FILE *output = ctx->output;
+	ssize_t result;
+
+	/* Streams without descriptors (e.g. chained stages) are written by fwrite. */
+	if (total_length < PRINT_WRITEV_MIN_SIZE || fileno(output) < 0) {
+		while (count > 0) {
+			fwrite(iov->iov_base, 1, iov->iov_len, output);
+			iov++;
+			count--;
+		}
+		return;
+	}
+
+	fflush(output);
+
+	while (count > 0) {
+		result = writev(fileno(output), iov, count > IOV_MAX ? IOV_MAX : count);
+
+		if (result < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			/* The stream is bypassed, so ferror does not report it. */
+			ctx->cancelled = CANCEL_OUTPUT;
+			return;
+		}
+
+		while (count > 0 && (size_t)result >= iov->iov_len) {
+			result -= (ssize_t)iov->iov_len;
+			iov++;
+			count--;
+		}
+
+		if (count > 0) {
+			iov->iov_base = (char*)iov->iov_base + result;
+			iov->iov_len -= (size_t)result;
+		}
+	}
+}
+
+void print_script_match(pcresp_ctx *ctx, const char *subject, PCRE2_SIZE *ovector, const char *mark)
+{
+	print_script *script = ctx->print_script;
+	template_item *item = script->tpl->items;
+	template_item *end = item + script->tpl->item_count;
+	struct iovec *iov = script->iov;
+	char *number = script->numbers;
+	size_t total_length = 0;
+	PCRE2_SIZE capture_id;
+	const char *data;
+	size_t length;
+
+	for (; item < end; item++) {
+		data = item->chars;
+		length = item->length;
+
+		switch (item->type) {
+		case TEMPLATE_MARK:
+			if (mark == NULL) {
+				continue;
+			}
+			data = mark;
+			length = strlen(mark);
+			break;
+		case TEMPLATE_CAPTURE:
+			capture_id = item->capture_id * 2;
+
+			/* The fallback string is used for unset captures. */
+			if (item->capture_id < ctx->ovector_size && ovector[capture_id] != PCRE2_UNSET) {
+				data = subject + ovector[capture_id];
+				length = ovector[capture_id + 1] > ovector[capture_id]
+					? ovector[capture_id + 1] - ovector[capture_id] : 0;
+			}
+			break;
+		case TEMPLATE_START_OFFSET:
+		case TEMPLATE_END_OFFSET:
+			capture_id = item->capture_id * 2;
+
+			if (item->capture_id >= ctx->ovector_size || ovector[capture_id] == PCRE2_UNSET) {
 				continue;
 			}
+
+			if (item->type == TEMPLATE_END_OFFSET) {
+				capture_id++;
+			}
+
+			data = number;
+			length = (size_t)sprintf(number, "%lu", (unsigned long)ovector[capture_id]);
+			number += PRINT_NUMBER_SIZE;
+			break;
+		case TEMPLATE_LINE:
+		case TEMPLATE_COLUMN:
+			data = number;
+			length = (size_t)sprintf(number, "%lu", (unsigned long)(item->type == TEMPLATE_LINE
+				? ctx->line_number : ctx->column));
+			number += PRINT_NUMBER_SIZE;
+			break;
 		}
 
-		src++;
-		str_list_len++;
-	} while (src < src_end);
+		if (length > 0) {
+			iov->iov_base = (void*)data;
+			iov->iov_len = length;
+			iov++;
+			total_length += length;
+		}
+	}
 
-	args = (char**)malloc((args_len * sizeof(char*)) + str_list_len);
+	write_fragments(ctx, script->iov, (int)(iov - script->iov), total_length);
+}
 
-	if (args == NULL) {
-		return 0;
+void free_print_script(pcresp_ctx *ctx)
+{
+	if (ctx->print_script == NULL) {
+		return;
 	}
 
-	args_dst = args;
-	str_list_dst = (char*)(args + args_len);
+	free(ctx->print_script->tpl);
+	free(ctx->print_script->iov);
+	free(ctx->print_script->numbers);
+	free(ctx->print_script);
+	ctx->print_script = NULL;
+}
+
+static void print_match_error(int error_code)
+{
+	char buffer[256];
 
-	if (!(flags & HAS_NO_SH_FLAG) && shell_args > 0) {
-		memcpy(args_dst, shell, shell_args * sizeof(char*));
-		args_dst[shell_arg0_index] = str_list_dst;
-		args_dst += shell_args;
+	if (pcre2_get_error_message(error_code, (uint8_t*)buffer, sizeof(buffer)) < 0) {
+		strcpy(buffer, "<unknown error>");
 	}
-	else {
-		*args_dst++ = str_list_dst;
+
+	fprintf(stderr, "Matching error: %s\n", buffer);
+}
+
+static int dfa_match(pcresp_ctx *ctx, pcre2_match_context *match_context,
+	const char *buffer, size_t size, PCRE2_SIZE start_offset, uint32_t options)
+{
+	const size_t max_workspace_size = 1024 * 1024;
+	PCRE2_SIZE *ovector = pcre2_get_ovector_pointer(ctx->match_data);
+	uint32_t i;
+	int *new_workspace;
+	int result;
+
+	while (1) {
+		result = pcre2_dfa_match(ctx->re_code, (PCRE2_SPTR)buffer, size, start_offset, options,
+			ctx->match_data, match_context, ctx->dfa_workspace, ctx->dfa_workspace_size);
+
+		if (result != PCRE2_ERROR_DFA_WSSIZE || ctx->dfa_workspace_size >= max_workspace_size) {
+			break;
+		}
+
+		new_workspace = (int*)malloc(ctx->dfa_workspace_size * 2 * sizeof(int));
+		if (new_workspace == NULL) {
+			break;
+		}
+
+		free(ctx->dfa_workspace);
+		ctx->dfa_workspace = new_workspace;
+		ctx->dfa_workspace_size *= 2;
 	}
 
-	src = src_start;
-	in_group = 0;
+	if (result < 0) {
+		return result;
+	}
 
-	if (*src == '<') {
-		in_group = 1;
-		src++;
+	/* The other pairs contain shorter alternative matches
+	 * starting at the same position, not capturing groups. */
+	for (i = 1; i < ctx->ovector_size; i++) {
+		ovector[i * 2] = PCRE2_UNSET;
+		ovector[i * 2 + 1] = PCRE2_UNSET;
 	}
+	return 1;
+}
 
-	do {
-		if ((!in_group && IS_SPACE(*src)) || (in_group && *src == '>')) {
-			*str_list_dst++ = '\0';
-			*args_dst++ = str_list_dst;
+static int do_match(pcresp_ctx *ctx, const char *buffer, size_t size, PCRE2_SIZE start_offset, uint32_t options)
+{
+	int result;
 
-			src++;
-			while (src < src_end && IS_SPACE(*src)) {
-				src++;
-			}
+	if (ctx->keywords != NULL) {
+		return keyword_match(ctx, buffer, size, start_offset);
+	}
 
-			in_group = 0;
-			if (src == src_end) {
-				str_list_dst--;
-				args_dst--;
-			}
-			else if (src < src_end && *src == '<') {
-				in_group = 1;
-				src++;
-			}
-			continue;
-		}
-		else if (*src == '#')
-		{
-			src++;
-			capture_id = 0;
-			string_name = NULL;
-			string_name_len = 0;
+	if (ctx->engine == PCRESP_ENGINE_DFA) {
+		return dfa_match(ctx, ctx->match_context, buffer, size, start_offset, options);
+	}
 
-			if (*src >= '0' && *src <= '9') {
-				do {
-					capture_id = capture_id * 10 + (*src - '0');
-					src++;
-				} while (src < src_end && *src >= '0' && *src <= '9');
+	if (ctx->jit_compiler != NULL) {
+		poll_jit(ctx);
+	}
 
-				/* Increase ID */
-				capture_id++;
-			}
-			else if (*src == '{')
-			{
-				/* Must be a decimal number in braces, e.g: {5} or {38} */
-				src++;
+	result = pcre2_match(ctx->match_code, (PCRE2_SPTR)buffer, size,
+		start_offset, options, ctx->match_data, ctx->match_context);
 
-				do
-				{
-					capture_id = capture_id * 10 + (*src - '0');
-					src++;
-				} while (*src != '}' && *src != ',');
+	if (!ctx->dfa_fallback || (result != PCRE2_ERROR_MATCHLIMIT
+			&& result != PCRE2_ERROR_HEAPLIMIT && result != PCRE2_ERROR_JIT_STACKLIMIT)) {
+		return result;
+	}
 
-				if (*src == ',') {
-					string_name = src + 1;
+	if (ctx->verbose) {
+		fprintf(stderr, "Verbose: backtracking limit reached at offset %lu, retrying with DFA\n",
+			(unsigned long)start_offset);
+	}
+	return dfa_match(ctx, ctx->dfa_match_context, buffer, size, start_offset, options);
+}
 
-					do
-					{
-						src++;
-					} while (*src != '}');
+#ifdef __linux__
 
-					string_name_len = src - string_name;
-				}
+static int get_zero_copy_mode(pcresp_ctx *ctx)
+{
+	struct stat st;
+	int mode = ZERO_COPY_DISABLED;
 
-				src++;
-				/* Increase ID */
-				capture_id++;
-			}
-			else if (*src == '[')
-			{
-				string_name = src + 1;
+	if (fstat(fileno(ctx->output), &st) == 0) {
+		if (S_ISFIFO(st.st_mode)) {
+			mode = ZERO_COPY_SPLICE;
+		}
+		else if (S_ISREG(st.st_mode)) {
+			mode = ZERO_COPY_COPY_FILE_RANGE;
+		}
+	}
 
-				do
-				{
-					src++;
-				} while (*src != ']');
+	if (ctx->verbose && mode != ZERO_COPY_DISABLED) {
+		fprintf(stderr, "Verbose: zero-copy passthrough using %s\n",
+			mode == ZERO_COPY_SPLICE ? "splice" : "copy_file_range");
+	}
+	return mode;
+}
 
-				string_name_len = src - string_name;
-				src++;
-			}
-			else if (*src == 'M') {
-				if (mark != NULL) {
-					length = strlen(mark);
-					memcpy(str_list_dst, mark, length);
-					str_list_dst += length;
-				}
-				src++;
-				continue;
-			}
-			else if (*src == 'n') {
-				*str_list_dst++ = '\n';
-				src++;
-				continue;
-			}
+/* Copies the range from the input file to the output without
+ * a userspace copy. Returns with the number of bytes copied. */
+static size_t zero_copy_write(pcresp_ctx *ctx, PCRE2_SIZE start, size_t length)
+{
+	loff_t offset = (loff_t)(ctx->input_offset + start);
+	int out_fd = fileno(ctx->output);
+	size_t copied = 0;
+	ssize_t result;
 
-			if (capture_id > 0) {
-				length = get_capture_len(capture_id - 1, ovector, script);
+	if (ctx->zero_copy == ZERO_COPY_UNKNOWN) {
+		ctx->zero_copy = get_zero_copy_mode(ctx);
+	}
 
-				if (length != PCRE2_UNSET) {
-					if (length > 0) {
-						memcpy(str_list_dst, buffer + ovector[(capture_id - 1) * 2], length);
-						str_list_dst += length;
-					}
-					continue;
-				}
-			}
+	if (ctx->zero_copy == ZERO_COPY_DISABLED) {
+		return 0;
+	}
 
-			if (string_name != NULL) {
-				string = get_ext_string(string_name, string_name_len);
+	/* Buffered data must be written first. */
+	fflush(ctx->output);
 
-				if (string != NULL) {
-					length = string->chars_length;
-					memcpy(str_list_dst, string->chars, length);
-					str_list_dst += length;
-				}
+	while (copied < length) {
+		if (ctx->zero_copy == ZERO_COPY_SPLICE) {
+			result = splice(ctx->input_fd, &offset, out_fd, NULL, length - copied, SPLICE_F_MORE);
+		}
+		else {
+			result = copy_file_range(ctx->input_fd, &offset, out_fd, NULL, length - copied, 0);
+		}
+
+		if (result <= 0) {
+			if (result < 0 && errno == EINTR) {
 				continue;
 			}
 
-			if (capture_id > 0) {
-				continue;
+			/* Unsupported file systems or descriptors (e.g. O_APPEND)
+			 * are detected on the first call. The rest is copied by fwrite. */
+			if (result < 0 && (errno == EINVAL || errno == EXDEV || errno == ENOSYS
+					|| errno == EBADF || errno == EOPNOTSUPP)) {
+				ctx->zero_copy = ZERO_COPY_DISABLED;
 			}
+			break;
 		}
 
-		*str_list_dst++ = *src++;
-	} while (src < src_end);
+		copied += (size_t)result;
+	}
 
-	*str_list_dst++ = '\0';
-	*args_dst++ = NULL;
+	return copied;
+}
 
-	if (args + args_len != args_dst) {
-		fprintf(stderr, "Internal error SAN1! Please file a bug report.\n");
-		exit(2);
-	}
+#endif /* __linux__ */
 
-	if (((char*)(args + args_len)) + str_list_len != str_list_dst) {
-		fprintf(stderr, "Internal error SAN2! Please file a bug report.\n");
-		exit(2);
+/* Counts the newline characters. Eight bytes are compared at once
+ * (the compiler also vectorizes the loop), and the byte counters
+ * are summed after at most 255 words, before they could overflow. */
+static size_t count_newlines(const char *data, size_t length)
+{
+	const uint64_t ones = 0x0101010101010101ull;
+	const uint64_t low_bits = 0x7f7f7f7f7f7f7f7full;
+	const uint64_t byte_pairs = 0x00ff00ff00ff00ffull;
+	size_t words = length / 8;
+	size_t count = 0;
+	size_t block;
+	uint64_t word, sums;
+
+	while (words > 0) {
+		block = (words < 255) ? words : 255;
+		words -= block;
+		sums = 0;
+
+		do {
+			memcpy(&word, data, 8);
+			word ^= ones * '\n';
+			/* The highest bit of the zero (newline) bytes is set. */
+			word = ~(((word & low_bits) + low_bits) | word | low_bits);
+			sums += word >> 7;
+			data += 8;
+		} while (--block > 0);
+
+		sums = (sums & byte_pairs) + ((sums >> 8) & byte_pairs);
+		count += (size_t)((sums * 0x0001000100010001ull) >> 48);
 	}
 
-	if (verbose) {
-		args_dst = args;
-		length = 0;
-		while (*args_dst != NULL) {
-			printf("  Verbose: arg[%d]: '%s'\n", (int)length, *args_dst);
-			length++;
-			args_dst++;
-		}
+	for (length &= 7; length > 0; length--) {
+		count += (*data++ == '\n');
 	}
+	return count;
+}
 
-	fflush(stdout);
+/* Counts the UTF-8 characters (the non-continuation bytes). */
+static size_t count_characters(const char *data, size_t length)
+{
+	size_t count = 0;
 
-	if (flags & HAS_PRINT_FLAG) {
-		args_dst = args;
-		while (*args_dst != NULL) {
-			if (args_dst != args)
-				fprintf(stdout, " ");
+	for (; length > 0; length--) {
+		count += ((*data++ & 0xc0) != 0x80);
+	}
+	return count;
+}
 
-			fprintf(stdout, "%s", *args_dst);
-			args_dst++;
-		}
+/* Updates the line and column of a match starting at offset. Only the
+ * part of the subject after the start of the previous match is scanned,
+ * so the cost does not depend on the line number. */
+static void update_line_position(pcresp_ctx *ctx, const char *subject, PCRE2_SIZE offset)
+{
+	PCRE2_SIZE start = ctx->line_offset;
+	size_t newlines;
+
+	if (offset < start) {
+		/* Matches cannot start before the previous match. */
+		start = 0;
+		ctx->line_number = 1;
+		ctx->column = 1;
+	}
 
-		if (!(flags & HAS_NO_NEWLINE_FLAG))
-			fprintf(stdout, "\n");
+	newlines = count_newlines(subject + start, offset - start);
 
-		free(args);
-		return 1;
+	if (newlines > 0) {
+		ctx->line_number += newlines;
+		ctx->column = 1;
+		start = offset;
+		while (subject[start - 1] != '\n') {
+			start--;
+		}
 	}
 
-	pid = fork();
+	ctx->column += ctx->utf ? count_characters(subject + start, offset - start) : offset - start;
+	ctx->line_offset = offset;
+}
 
-	if (pid == 0) {
-		if (flags & HAS_NULL_FLAG) {
-			result = open("/dev/null", O_WRONLY);
-			if (result > -1) {
-				dup2(result, STDOUT_FILENO);
-				close(result);
-			}
-		}
+void reset_line_position(pcresp_ctx *ctx)
+{
+	ctx->line_offset = 0;
+	ctx->line_number = 1;
+	ctx->column = 1;
+}
 
-		(void)execv(args[0], args);
-		/* Control gets here if there is an error,
-		 * e.g. a non-existent program. */
-		exit(1);
+static void print_range(pcresp_ctx *ctx, const char *buffer, PCRE2_SIZE start, PCRE2_SIZE end)
+{
+#ifdef __linux__
+	if (ctx->input_fd >= 0 && end - start >= ZERO_COPY_MIN_SIZE) {
+		start += zero_copy_write(ctx, start, end - start);
 	}
+#endif /* __linux__ */
 
-	if (pid > 0) {
-		(void)waitpid(pid, &result, 0);
+	if (end > start) {
+		fwrite(buffer + start, 1, end - start, ctx->output);
 	}
-
-	/* Currently negative return values are not supported,
-	 * only zero (match continues) or non-zero (match fails). */
-
-	free(args);
-	return !!result;
 }
 
-void match(char *buffer, size_t size)
+void match(pcresp_ctx *ctx, const char *buffer, size_t size)
 {
-	int result, match_count = 0;
-	PCRE2_SIZE *ovector = pcre2_get_ovector_pointer(match_data);
+	int result, stop = 0;
+	PCRE2_SIZE *ovector = pcre2_get_ovector_pointer(ctx->match_data);
 	PCRE2_SIZE start_offset = 0;
+	PCRE2_SIZE print_offset = 0;
 	uint32_t options = 0;
+	const char *cached_mark;
+	uint64_t trace_start = 0;
+	char *mark;
 
-	while (1) {
-		result = pcre2_match(re_code, (uint8_t*)buffer, size,
-			start_offset, options, match_data, match_context);
+	ctx->subject = buffer;
+	ctx->subject_size = size;
 
-		if (result <= 0) {
-			break;
+	if (ctx->jit_pending) {
+		ctx->jit_input_size += size;
+		if (ctx->jit_input_size >= JIT_AUTO_MIN_SIZE) {
+			start_jit(ctx);
+		}
+	}
+
+	while (!ctx->cancelled && (ctx->match_limit == 0 || ctx->match_count < ctx->match_limit)) {
+		if (ctx->cache.replay != NULL) {
+			/* The matches are known from a previous run. */
+			if (!cache_next(ctx, ovector, &cached_mark)) {
+				break;
+			}
+			mark = (char*)cached_mark;
+		}
+		else {
+			if (ctx->trace != NULL) {
+				trace_start = trace_time();
+			}
+
+			result = do_match(ctx, buffer, size, start_offset, options);
+
+			if (ctx->trace != NULL) {
+				trace_event_end(ctx, TRACE_MATCH, trace_start, NULL, (long)start_offset, (long)result);
+			}
+
+			if (result <= 0) {
+				if (result < 0 && result != PCRE2_ERROR_NOMATCH && !ctx->cancelled) {
+					print_match_error(result);
+					ctx->cache.recording = 0;
+				}
+				break;
+			}
+
+			mark = (ctx->keywords == NULL) ? (char*)pcre2_get_mark(ctx->match_data) : NULL;
 		}
 
-		match_found = 1;
+		ctx->match_found = 1;
 
 		if (ovector[1] < ovector[0]) {
 			ovector[1] = ovector[0];
 		}
 
-		if (print_text && ovector[0] > start_offset) {
-			fwrite(buffer + start_offset, 1, ovector[0] - start_offset, stdout);
+		if (ctx->line_positions) {
+			update_line_position(ctx, buffer, ovector[0]);
 		}
 
-		if (default_script == NULL) {
-			if (ovector[1] > ovector[0]) {
-				fwrite(buffer + ovector[0], 1, ovector[1] - ovector[0], stdout);
-				fputs("\n", stdout);
+		if (ctx->cache.recording) {
+			cache_record(ctx, ovector, mark);
+		}
+
+		if (ctx->print_text && ovector[0] > print_offset) {
+			print_range(ctx, buffer, print_offset, ovector[0]);
+		}
+
+		if (ctx->aggregate != NULL) {
+			aggregate_match(ctx, buffer, ovector, mark);
+		}
+		else if (ctx->sketch != NULL) {
+			sketch_match(ctx, buffer, ovector, mark);
+		}
+
+		if (ctx->match_callback != NULL) {
+			stop = ctx->match_callback(ctx->match_callback_data, buffer, size, ovector,
+				ctx->ovector_size, mark);
+			if (stop) {
+				/* The decision of the callback is not cached. */
+				ctx->cache.recording = 0;
+			}
+		}
+		else if (ctx->format != PCRESP_FORMAT_TEXT) {
+			print_formatted(ctx, buffer, ovector, mark);
+		}
+		else if (ctx->default_script == NULL) {
+			if (ctx->aggregate == NULL && ctx->sketch == NULL && ovector[1] > ovector[0]) {
+				if (ctx->print_line_number) {
+					fprintf(ctx->output, "%lu:", (unsigned long)ctx->line_number);
+				}
+				fwrite(buffer + ovector[0], 1, ovector[1] - ovector[0], ctx->output);
+				fputs("\n", ctx->output);
 			}
 		}
+		else if (ctx->print_script != NULL) {
+			print_script_match(ctx, buffer, ovector, mark);
+		}
 		else {
-			run_script(default_script, default_script_size, buffer,
-				ovector, (char*)pcre2_get_mark(match_data));
+			run_script(ctx, ctx->default_script, ctx->default_script_size, buffer,
+				ovector, mark);
 		}
 
-		if (ovector[1] > start_offset) {
+		/* The text after an empty match is printed with the next match. */
+		if (ovector[1] > print_offset) {
+			print_offset = ovector[1];
+		}
+
+		if (ovector[1] > start_offset && ovector[1] > ovector[0]) {
 			start_offset = ovector[1];
 		}
+		else if (ovector[1] < size) {
+			/* After an empty match the next match starts at the next
+			 * character, since UTF is not checked again. Otherwise the
+			 * same empty match would be found twice. */
+			start_offset = (ovector[1] > start_offset ? ovector[1] : start_offset) + 1;
+			while (ctx->utf && start_offset < size && (buffer[start_offset] & 0xc0) == 0x80) {
+				start_offset++;
+			}
+		}
 		else {
-			start_offset++;
+			/* Empty match at the end of the subject. */
+			stop = 1;
 		}
 
-		match_count++;
-		if (match_limit > 0 && match_count >= match_limit) {
+		if (ctx->release_start != NULL && buffer + start_offset >= ctx->release_start + INPUT_RELEASE_STEP) {
+			release_input(ctx, buffer + start_offset);
+		}
+
+		/* The limit also applies to the next buffers of the input. */
+		ctx->match_count++;
+		if (ctx->match_limit > 0 && ctx->match_count >= ctx->match_limit) {
+			stop = 1;
+		}
+
+		ctx->total_match_count++;
+		if (ctx->total_limit > 0 && ctx->total_match_count >= ctx->total_limit) {
+			ctx->cancelled = CANCEL_LIMIT;
+		}
+
+		/* Writing the output fails when the reader of the pipe exits. */
+		if (ferror(ctx->output)) {
+			ctx->cancelled = CANCEL_OUTPUT;
+		}
+
+		if (stop) {
 			break;
 		}
 
@@ -761,7 +2047,28 @@ void match(char *buffer, size_t size)
 		options |= PCRE2_NO_UTF_CHECK;
 	}
 
-	if (print_text && size > start_offset) {
-		fwrite(buffer + start_offset, 1, size - start_offset, stdout);
+	if (ctx->cancelled) {
+		/* The matches of the rest of the input are unknown. */
+		ctx->cache.recording = 0;
+	}
+
+	if (ctx->print_text && size > print_offset && ctx->cancelled <= CANCEL_LIMIT) {
+		print_range(ctx, buffer, print_offset, size);
+	}
+
+	if (ctx->line_positions) {
+		/* The next buffer of the input continues at the end of this one. */
+		update_line_position(ctx, buffer, size);
+		ctx->line_offset = 0;
+	}
+
+	/* The #F files are only valid until the end of the subject. */
+	if (ctx->batch.flags & HAS_MEMFD_FLAG) {
+		flush_batch(ctx);
+	}
+
+	if (ctx->subject_fd >= 0) {
+		close(ctx->subject_fd);
+		ctx->subject_fd = -1;
 	}
 }
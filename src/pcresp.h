@@ -29,10 +29,13 @@
 
 #include "stdio.h"
 #include "string.h"
+#include "signal.h"
 
 #define PCRE2_CODE_UNIT_WIDTH 8
 #include "pcre2.h"
 
+#include "libpcresp.h"
+
 #define IS_SPACE(chr) ((chr) == ' ' || (chr) == '\t')
 
 typedef struct ext_string {
@@ -42,27 +45,289 @@ typedef struct ext_string {
 	size_t chars_length;
 } ext_string;
 
-extern int verbose;
-extern int match_found;
-extern int print_text;
-extern int match_limit;
-extern int ext_string_count;
-extern ext_string* ext_string_list;
-extern pcre2_code *re_code;
-extern pcre2_match_context *match_context;
-extern pcre2_match_data *match_data;
-extern uint32_t ovector_size;
-extern char *default_script;
-extern size_t default_script_size;
-extern char **shell;
-extern int shell_args;
-extern int shell_arg0_index;
-
-void match_file(char*);
-void match_stdin(void);
-void match(char*, size_t);
-int check_script(const char *, size_t);
-int run_script(const char *, size_t, const char *, PCRE2_SIZE *, char *);
-int parse_shell(const char *);
+typedef struct string_buffer {
+	char *data;
+	size_t length;
+	size_t max;
+} string_buffer;
+
+#define TEMPLATE_LITERAL 0
+#define TEMPLATE_STRING 1
+#define TEMPLATE_CAPTURE 2
+#define TEMPLATE_MARK 3
+#define TEMPLATE_START_OFFSET 4
+#define TEMPLATE_END_OFFSET 5
+#define TEMPLATE_LINE 6
+#define TEMPLATE_COLUMN 7
+
+/* Transforms of captures (#{idx:name...}). A list of transforms is
+ * stored in an uint32_t, the first transform in the lowest bits. */
+#define TRANSFORM_UPPER 1
+#define TRANSFORM_LOWER 2
+#define TRANSFORM_HEX 3
+#define TRANSFORM_URLDECODE 4
+#define TRANSFORM_TRIM 5
+#define TRANSFORM_BITS 3
+#define TRANSFORM_MASK 0x7
+#define TRANSFORM_MAX 10
+
+/* Capture (#n, #{n:transforms,name}) or string (#[name]) reference
+ * of a hash mark sequence. The capture_id is PCRE2_UNSET for strings. */
+typedef struct hash_reference {
+	PCRE2_SIZE capture_id;
+	uint32_t transforms;
+	const char *name;
+	size_t name_length;
+} hash_reference;
+
+typedef struct template_item {
+	int type;
+	PCRE2_SIZE capture_id;
+	uint32_t transforms;
+	/* Literal characters or the fallback string of a capture. */
+	const char *chars;
+	size_t length;
+} template_item;
+
+typedef struct hash_template {
+	size_t item_count;
+	template_item items[1];
+} hash_template;
+
+struct iovec;
+
+/* Default scripts with only *print and *!nl flags are compiled
+ * into a template, and the arguments are printed by a gather
+ * write from the subject without copying them. */
+typedef struct print_script {
+	hash_template *tpl;
+	struct iovec *iov;
+	char *numbers;
+} print_script;
+
+typedef struct script_batch {
+	char *data;
+	size_t data_length;
+	size_t data_max;
+	size_t arg_count;
+	size_t prefix_count;
+	size_t prefix_bytes;
+	size_t bytes;
+	size_t match_count;
+	int flags;
+} script_batch;
+
+typedef struct match_cache {
+	int dir_fd;
+	size_t max_entries;
+	size_t stored;
+	uint64_t pattern_hash;
+	int recording;
+	uint32_t match_count;
+	string_buffer record;
+	char *entry;
+	size_t entry_max;
+	const uint8_t *replay;
+	const uint8_t *replay_end;
+} match_cache;
+
+typedef struct checkpoint_entry {
+	char *path;
+	uint64_t inode;
+	uint64_t offset;
+} checkpoint_entry;
+
+typedef struct checkpoint_list {
+	const char *file_name;
+	checkpoint_entry *entries;
+	size_t count;
+	size_t max;
+	size_t next;
+	checkpoint_entry *current;
+	int modified;
+	string_buffer tmp_name;
+} checkpoint_list;
+
+typedef struct keyword_set keyword_set;
+typedef struct plugin plugin;
+typedef struct trace_buffer trace_buffer;
+typedef struct pipeline pipeline;
+typedef struct stage_link stage_link;
+typedef struct jit_compiler jit_compiler;
+typedef struct sketch sketch;
+
+/* Reasons of stopping the processing (ctx->cancelled). */
+#define CANCEL_LIMIT 1
+#define CANCEL_REQUEST 2
+#define CANCEL_OUTPUT 3
+
+/* No more input is read after cancellation, except when the
+ * limit is reached and the rest of the input is printed (-p). */
+#define INPUT_CANCELLED(ctx) \
+	((ctx)->cancelled > CANCEL_LIMIT || ((ctx)->cancelled == CANCEL_LIMIT && !(ctx)->print_text))
+
+/* Event types of --trace. */
+#define TRACE_FILE 0
+#define TRACE_LOAD 1
+#define TRACE_MATCH 2
+#define TRACE_CALLOUT 3
+#define TRACE_SCRIPT 4
+typedef struct write_file write_file;
+typedef struct aggregate aggregate;
+
+struct pcresp_ctx {
+	int verbose;
+	int match_found;
+	int print_text;
+	int match_limit;
+	/* Matches of the current input, and of all inputs. */
+	int match_count;
+	int total_limit;
+	int total_match_count;
+	volatile sig_atomic_t cancelled;
+	int ext_string_count;
+	int ext_string_max;
+	ext_string* ext_string_list;
+	pcre2_code *re_code;
+	keyword_set *keywords;
+	plugin *plugins;
+	trace_buffer *trace;
+	int pipeline_enabled;
+	pipeline *pipeline;
+	pcre2_match_context *match_context;
+	/* The DFA fallback does not inherit the limits of match_context. */
+	pcre2_match_context *dfa_match_context;
+	pcre2_match_data *match_data;
+	pcre2_jit_stack *jit_stack;
+	/* The code used by pcre2_match, which is re_code, or its JIT
+	 * compiled copy (jit_code) when it is compiled in the background. */
+	pcre2_code *match_code;
+	pcre2_code *jit_code;
+	int jit_mode;
+	int jit_pending;
+	size_t jit_input_size;
+	jit_compiler *jit_compiler;
+	int engine;
+	int dfa_fallback;
+	int callout_count;
+	uint32_t backtrack_limit;
+	uint32_t heap_limit;
+	int *dfa_workspace;
+	size_t dfa_workspace_size;
+	uint32_t ovector_size;
+	const char *default_script;
+	size_t default_script_size;
+	print_script *print_script;
+	char **shell;
+	int shell_args;
+	int shell_arg0_index;
+	int input_fd;
+	PCRE2_SIZE input_offset;
+	int zero_copy;
+	const char *subject;
+	size_t subject_size;
+	int subject_fd;
+	script_batch batch;
+	write_file *write_files;
+	write_file *write_files_last;
+	write_file **write_table;
+	uint32_t write_table_mask;
+	int write_file_count;
+	int max_open_files;
+	aggregate *aggregate;
+	sketch *sketch;
+	int format;
+	string_buffer format_buffer;
+	string_buffer transform_buffers[2];
+	uint32_t name_count;
+	uint32_t name_entry_size;
+	PCRE2_SPTR name_table;
+	const char *input_name;
+	/* Position of the current match (#L, #C and --line-number), which
+	 * is only tracked when it is used. line_offset is the start of the
+	 * previous match, the newlines are counted from there. The position
+	 * is kept across the buffers of an input (e.g. streamed chunks). */
+	int line_positions;
+	int print_line_number;
+	int utf;
+	PCRE2_SIZE line_offset;
+	size_t line_number;
+	size_t column;
+	match_cache cache;
+	checkpoint_list checkpoint;
+	int hugepages;
+	const char *release_start;
+	FILE *output;
+	FILE *script_output;
+	stage_link *next_stage;
+	pcresp_match_callback match_callback;
+	void *match_callback_data;
+};
+
+void match(pcresp_ctx *, const char*, size_t);
+void reset_line_position(pcresp_ctx *);
+int check_script(pcresp_ctx *, const char *, size_t);
+int run_script(pcresp_ctx *, const char *, size_t, const char *, PCRE2_SIZE *, char *);
+ext_string *get_ext_string(pcresp_ctx *, const char *, size_t);
+int init_print_script(pcresp_ctx *);
+void print_script_match(pcresp_ctx *, const char *, PCRE2_SIZE *, const char *);
+void free_print_script(pcresp_ctx *);
+uint32_t hash_bytes(const char *, size_t);
+int buffer_append(string_buffer *, const char *, size_t);
+const char *parse_hash_reference(const char *, const char *, hash_reference *, char **);
+hash_template *compile_template(pcresp_ctx *, const char *, size_t);
+int expand_template(pcresp_ctx *, hash_template *, const char *, PCRE2_SIZE *, const char *, string_buffer *);
+const char *parse_transforms(const char *, const char *, uint32_t *, char **);
+const char *apply_transforms(pcresp_ctx *, uint32_t, const char *, size_t *);
+int init_aggregate(pcresp_ctx *);
+void aggregate_match(pcresp_ctx *, const char *, PCRE2_SIZE *, const char *);
+void print_aggregate(pcresp_ctx *);
+void free_aggregate(pcresp_ctx *);
+int init_sketch(pcresp_ctx *);
+void sketch_match(pcresp_ctx *, const char *, PCRE2_SIZE *, const char *);
+void print_sketch(pcresp_ctx *);
+void free_sketch(pcresp_ctx *);
+/* Scanned parts of mapped inputs are released in this step (--hugepages). */
+#define INPUT_RELEASE_STEP (16 * 1024 * 1024)
+
+void release_input(pcresp_ctx *, const char *);
+
+/* Total input size of a context which starts the background JIT compilation. */
+#define JIT_AUTO_MIN_SIZE (64 * 1024)
+
+struct stat;
+void init_cache(pcresp_ctx *, const char *, uint32_t, int, int);
+int cache_lookup(pcresp_ctx *, struct stat *);
+int cache_next(pcresp_ctx *, PCRE2_SIZE *, const char **);
+void cache_start(pcresp_ctx *);
+void cache_record(pcresp_ctx *, PCRE2_SIZE *, const char *);
+void cache_store(pcresp_ctx *, struct stat *);
+void evict_cache(pcresp_ctx *);
+void free_cache(pcresp_ctx *);
+checkpoint_entry *get_checkpoint(pcresp_ctx *, const char *);
+void commit_checkpoint(pcresp_ctx *);
+void free_checkpoint(pcresp_ctx *);
+int keyword_match(pcresp_ctx *, const char *, size_t, PCRE2_SIZE);
+uint32_t keyword_hash(pcresp_ctx *);
+void free_keywords(pcresp_ctx *);
+int load_plugin(pcresp_ctx *, const char *, size_t);
+int call_plugin(pcresp_ctx *, char **, const char *, PCRE2_SIZE *, const char *);
+void free_plugins(pcresp_ctx *);
+uint64_t trace_time(void);
+void trace_event_end(pcresp_ctx *, int, uint64_t, const char *, long, long);
+void close_trace(pcresp_ctx *);
+void stop_pipeline(pcresp_ctx *);
+void flush_stages(pcresp_ctx *);
+void init_jit(pcresp_ctx *);
+void start_jit(pcresp_ctx *);
+void poll_jit(pcresp_ctx *);
+void free_jit(pcresp_ctx *);
+void free_stages(pcresp_ctx *);
+int init_format(pcresp_ctx *);
+void print_formatted(pcresp_ctx *, const char *, PCRE2_SIZE *, const char *);
+void flush_batch(pcresp_ctx *);
+void write_to_file(pcresp_ctx *, const char *, char **, int);
+void close_write_files(pcresp_ctx *);
+int parse_shell(pcresp_ctx *, const char *);
 
 #endif /* PCRESP_H */
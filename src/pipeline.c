@@ -0,0 +1,310 @@
+/*
+ *    Stream processing tool
+ *
+ *    Copyright 2016 Zoltan Herczeg (hzmester@freemail.hu). All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are
+ * permitted provided that the following conditions are met:
+ *
+ *   1. Redistributions of source code must retain the above copyright notice, this list of
+ *      conditions and the following disclaimer.
+ *
+ *   2. Redistributions in binary form must reproduce the above copyright notice, this list
+ *      of conditions and the following disclaimer in the documentation and/or other materials
+ *      provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDER(S) AND CONTRIBUTORS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT
+ * SHALL THE COPYRIGHT HOLDER(S) OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifdef __linux__
+#define _GNU_SOURCE
+#endif
+
+#include "pcresp.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* Pipelined processing of input files (--pipeline). A reader thread
+ * prefetches the upcoming files into the page cache while the current
+ * file is matched, and a writer thread copies the output to the output
+ * stream of the context. The output of the context is replaced by a
+ * pipe, so the order of the data written by pcresp, splice and the
+ * executed scripts is kept, and the capacity of the pipe limits the
+ * buffered output. */
+
+/* Maximum number of files and bytes per file prefetched ahead. */
+#define PREFETCH_FILES 4
+#define PREFETCH_BYTES (64 * 1024 * 1024)
+#define OUTPUT_PIPE_SIZE (1024 * 1024)
+
+struct pipeline {
+	FILE *output;
+	int output_fd;
+	int pipe_fd;
+	int write_failed;
+	pthread_t writer;
+	pthread_t reader;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	const char *const *file_names;
+	size_t file_count;
+	size_t current;
+	size_t next;
+	int stop;
+};
+
+void pcresp_set_pipeline(pcresp_ctx *ctx, int enable)
+{
+	ctx->pipeline_enabled = enable;
+}
+
+static void *writer_thread(void *data)
+{
+	pipeline *state = (pipeline*)data;
+	char buffer[65536];
+	ssize_t length, written, result;
+
+#ifdef __linux__
+	while (1) {
+		result = splice(state->pipe_fd, NULL, state->output_fd, NULL, OUTPUT_PIPE_SIZE, SPLICE_F_MOVE);
+		if (result > 0) {
+			continue;
+		}
+		if (result == 0) {
+			return NULL;
+		}
+		if (errno != EINTR) {
+			/* Unsupported output, e.g. O_APPEND files. The
+			 * write below reports the other errors. */
+			break;
+		}
+	}
+#endif /* __linux__ */
+
+	while (1) {
+		length = read(state->pipe_fd, buffer, sizeof(buffer));
+		if (length == 0) {
+			return NULL;
+		}
+
+		if (length < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			state->write_failed = 1;
+			return NULL;
+		}
+
+		written = 0;
+		while (written < length) {
+			result = write(state->output_fd, buffer + written, (size_t)(length - written));
+			if (result < 0) {
+				if (errno == EINTR) {
+					continue;
+				}
+				/* The writers get EPIPE, as if they wrote the output. */
+				state->write_failed = 1;
+				close(state->pipe_fd);
+				state->pipe_fd = -1;
+				return NULL;
+			}
+			written += result;
+		}
+	}
+}
+
+static void *reader_thread(void *data)
+{
+	pipeline *state = (pipeline*)data;
+	const char *file_name;
+	struct stat st;
+	int fd;
+
+	while (1) {
+		pthread_mutex_lock(&state->lock);
+		while (!state->stop && state->next < state->file_count
+				&& state->next >= state->current + PREFETCH_FILES) {
+			pthread_cond_wait(&state->cond, &state->lock);
+		}
+
+		if (state->stop || state->next >= state->file_count) {
+			pthread_mutex_unlock(&state->lock);
+			return NULL;
+		}
+
+		file_name = state->file_names[state->next++];
+		pthread_mutex_unlock(&state->lock);
+
+		fd = open(file_name, O_RDONLY);
+		if (fd < 0) {
+			continue;
+		}
+
+		if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+			/* Starts reading the data in the background. */
+			posix_fadvise(fd, 0, st.st_size < PREFETCH_BYTES ? st.st_size : PREFETCH_BYTES,
+				POSIX_FADV_WILLNEED);
+		}
+
+		close(fd);
+	}
+}
+
+static int start_output(pcresp_ctx *ctx, pipeline *state)
+{
+	int pipe_fds[2];
+	FILE *stream;
+
+	/* Only the output of the context is redirected, so custom
+	 * streams without a file descriptor are not supported. */
+	state->output_fd = fileno(ctx->output);
+	if (state->output_fd < 0 || fflush(ctx->output) != 0) {
+		return 0;
+	}
+
+	if (pipe(pipe_fds) != 0) {
+		return 0;
+	}
+
+#ifdef F_SETPIPE_SZ
+	fcntl(pipe_fds[1], F_SETPIPE_SZ, OUTPUT_PIPE_SIZE);
+#endif /* F_SETPIPE_SZ */
+
+	/* The executed scripts get the write end as stdout by dup2. */
+	fcntl(pipe_fds[0], F_SETFD, FD_CLOEXEC);
+	fcntl(pipe_fds[1], F_SETFD, FD_CLOEXEC);
+
+	stream = fdopen(pipe_fds[1], "w");
+	if (stream == NULL) {
+		close(pipe_fds[0]);
+		close(pipe_fds[1]);
+		return 0;
+	}
+
+	state->output = ctx->output;
+	state->pipe_fd = pipe_fds[0];
+
+	if (pthread_create(&state->writer, NULL, writer_thread, state) != 0) {
+		fclose(stream);
+		close(state->pipe_fd);
+		return 0;
+	}
+
+	/* The type of the output is changed. */
+	ctx->output = stream;
+	ctx->zero_copy = 0;
+	return 1;
+}
+
+static int start_pipeline(pcresp_ctx *ctx)
+{
+	pipeline *state = (pipeline*)malloc(sizeof(pipeline));
+
+	if (state == NULL) {
+		return 0;
+	}
+
+	memset(state, 0, sizeof(pipeline));
+
+	if (!start_output(ctx, state)) {
+		free(state);
+		return 0;
+	}
+
+	pthread_mutex_init(&state->lock, NULL);
+	pthread_cond_init(&state->cond, NULL);
+	ctx->pipeline = state;
+
+	if (ctx->verbose) {
+		fprintf(stderr, "Verbose: pipelined reading and writing is enabled\n");
+	}
+	return 1;
+}
+
+void stop_pipeline(pcresp_ctx *ctx)
+{
+	pipeline *state = ctx->pipeline;
+	int failed;
+
+	if (state == NULL) {
+		return;
+	}
+
+	/* Closing the write end of the pipe terminates the writer. */
+	failed = ferror(ctx->output);
+	if (fclose(ctx->output) != 0) {
+		failed = 1;
+	}
+	pthread_join(state->writer, NULL);
+
+	ctx->output = state->output;
+	if (state->pipe_fd >= 0) {
+		close(state->pipe_fd);
+	}
+
+	/* The output is incomplete, which must be known before
+	 * the checkpoint is committed. */
+	if (failed || state->write_failed) {
+		ctx->cancelled = CANCEL_OUTPUT;
+	}
+	pthread_mutex_destroy(&state->lock);
+	pthread_cond_destroy(&state->cond);
+	free(state);
+
+	ctx->pipeline = NULL;
+	ctx->zero_copy = 0;
+}
+
+void pcresp_match_files(pcresp_ctx *ctx, const char *const *file_names, size_t file_count)
+{
+	pipeline *state;
+	size_t i;
+	int has_reader;
+
+	if (!ctx->pipeline_enabled || (ctx->pipeline == NULL && !start_pipeline(ctx))) {
+		for (i = 0; i < file_count && !INPUT_CANCELLED(ctx); i++) {
+			pcresp_match_file(ctx, file_names[i]);
+		}
+		return;
+	}
+
+	state = ctx->pipeline;
+	state->file_names = file_names;
+	state->file_count = file_count;
+	state->current = 0;
+	state->next = 1;
+	state->stop = 0;
+
+	has_reader = (file_count > 1 && pthread_create(&state->reader, NULL, reader_thread, state) == 0);
+
+	for (i = 0; i < file_count && !INPUT_CANCELLED(ctx); i++) {
+		if (has_reader) {
+			pthread_mutex_lock(&state->lock);
+			state->current = i;
+			pthread_cond_signal(&state->cond);
+			pthread_mutex_unlock(&state->lock);
+		}
+
+		pcresp_match_file(ctx, file_names[i]);
+	}
+
+	if (has_reader) {
+		pthread_mutex_lock(&state->lock);
+		state->stop = 1;
+		pthread_cond_signal(&state->cond);
+		pthread_mutex_unlock(&state->lock);
+		pthread_join(state->reader, NULL);
+	}
+}
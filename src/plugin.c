@@ -0,0 +1,181 @@
+/*
+ *    Stream processing tool
+ *
+ *    Copyright 2016 Zoltan Herczeg (hzmester@freemail.hu). All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are
+ * permitted provided that the following conditions are met:
+ *
+ *   1. Redistributions of source code must retain the above copyright notice, this list of
+ *      conditions and the following disclaimer.
+ *
+ *   2. Redistributions in binary form must reproduce the above copyright notice, this list
+ *      of conditions and the following disclaimer in the documentation and/or other materials
+ *      provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDER(S) AND CONTRIBUTORS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT
+ * SHALL THE COPYRIGHT HOLDER(S) OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "pcresp.h"
+
+#include <dlfcn.h>
+
+/* In-process script functions (*dl). The libraries are loaded when
+ * the script is compiled, and unloaded when the context is freed. */
+
+struct plugin {
+	plugin *next;
+	char *name;
+	size_t name_length;
+	void *handle;
+	pcresp_plugin_function function;
+	void (*fini)(void *);
+	void *state;
+};
+
+static plugin *find_plugin(pcresp_ctx *ctx, const char *name, size_t length)
+{
+	plugin *current = ctx->plugins;
+
+	while (current != NULL) {
+		if (current->name_length == length && memcmp(current->name, name, length) == 0) {
+			return current;
+		}
+		current = current->next;
+	}
+	return NULL;
+}
+
+static void *find_symbol(void *handle, const char *symbol, const char *suffix)
+{
+	char name[256];
+
+	if (strlen(symbol) + strlen(suffix) >= sizeof(name)) {
+		return NULL;
+	}
+
+	strcpy(name, symbol);
+	strcat(name, suffix);
+	return dlsym(handle, name);
+}
+
+/* The name is a library path and a function name separated by the
+ * last colon, e.g: ./plugin.so:my_function */
+int load_plugin(pcresp_ctx *ctx, const char *name, size_t length)
+{
+	void *(*init)(void);
+	const char *separator;
+	plugin *new_plugin;
+	char *symbol;
+
+	if (find_plugin(ctx, name, length) != NULL) {
+		return 1;
+	}
+
+	separator = name + length;
+	while (separator > name && separator[-1] != ':') {
+		separator--;
+	}
+
+	if (separator <= name + 1 || separator == name + length) {
+		fprintf(stderr, "Plugin name must be library:function: %.*s\n", (int)length, name);
+		return 0;
+	}
+
+	new_plugin = (plugin*)malloc(sizeof(plugin) + length + 1);
+	if (new_plugin == NULL) {
+		fprintf(stderr, "Cannot allocate memory\n");
+		return 0;
+	}
+
+	new_plugin->name = (char*)(new_plugin + 1);
+	memcpy(new_plugin->name, name, length);
+	new_plugin->name[length] = '\0';
+	new_plugin->name_length = length;
+
+	/* Split to library and function names. */
+	symbol = new_plugin->name + (separator - name);
+	symbol[-1] = '\0';
+
+	new_plugin->handle = dlopen(new_plugin->name, RTLD_NOW | RTLD_LOCAL);
+	if (new_plugin->handle == NULL) {
+		fprintf(stderr, "Cannot load plugin: %s\n", dlerror());
+		free(new_plugin);
+		return 0;
+	}
+
+	new_plugin->function = (pcresp_plugin_function)dlsym(new_plugin->handle, symbol);
+	if (new_plugin->function == NULL) {
+		fprintf(stderr, "Cannot find function '%s' in plugin %s\n", symbol, new_plugin->name);
+		dlclose(new_plugin->handle);
+		free(new_plugin);
+		return 0;
+	}
+
+	/* Optional hooks for keeping state until the context is freed. */
+	init = (void *(*)(void))find_symbol(new_plugin->handle, symbol, "_init");
+	new_plugin->fini = (void (*)(void *))find_symbol(new_plugin->handle, symbol, "_fini");
+	new_plugin->state = (init != NULL) ? init() : NULL;
+
+	if (ctx->verbose) {
+		fprintf(stderr, "Verbose: function '%s' loaded from plugin %s\n", symbol, new_plugin->name);
+	}
+
+	/* Restore the original name for lookups. */
+	symbol[-1] = ':';
+	new_plugin->next = ctx->plugins;
+	ctx->plugins = new_plugin;
+	return 1;
+}
+
+int call_plugin(pcresp_ctx *ctx, char **args, const char *buffer, PCRE2_SIZE *ovector, const char *mark)
+{
+	plugin *current = find_plugin(ctx, args[0], strlen(args[0]));
+	pcresp_plugin_call call;
+	int argc = 0;
+
+	if (current == NULL) {
+		return 0;
+	}
+
+	while (args[argc + 1] != NULL) {
+		argc++;
+	}
+
+	call.size = sizeof(pcresp_plugin_call);
+	call.subject = buffer;
+	call.subject_size = ctx->subject_size;
+	call.ovector = ovector;
+	call.pair_count = ctx->ovector_size;
+	call.mark = mark;
+	call.argc = argc;
+	call.argv = (const char *const *)(args + 1);
+	call.state = current->state;
+
+	return current->function(&call);
+}
+
+void free_plugins(pcresp_ctx *ctx)
+{
+	plugin *current = ctx->plugins;
+	plugin *next;
+
+	while (current != NULL) {
+		next = current->next;
+		if (current->fini != NULL) {
+			current->fini(current->state);
+		}
+		dlclose(current->handle);
+		free(current);
+		current = next;
+	}
+	ctx->plugins = NULL;
+}
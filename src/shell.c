@@ -26,7 +26,7 @@
 
 #include "pcresp.h"
 
-static const char *do_parse_shell(const char *shell_arg, char **msg)
+static const char *do_parse_shell(pcresp_ctx *ctx, const char *shell_arg, char **msg)
 {
 	const int max_args = 1000;
 	const char *src = shell_arg;
@@ -113,17 +113,17 @@ static const char *do_parse_shell(const char *shell_arg, char **msg)
 		return src;
 	}
 
-	shell = (char**)malloc(sizeof(char*) * args_len + str_list_len);
-	shell_args = args_len;
+	ctx->shell = (char**)malloc(sizeof(char*) * args_len + str_list_len);
+	ctx->shell_args = args_len;
 
-	args = shell;
-	dst = (char*)(shell + args_len);
+	args = ctx->shell;
+	dst = (char*)(ctx->shell + args_len);
 
 	src = shell_arg;
 
 	do {
 		if (*src == '?' && (src[1] == '\0' || IS_SPACE(src[1]))) {
-			shell_arg0_index = args - shell;
+			ctx->shell_arg0_index = args - ctx->shell;
 			*args++ = NULL;
 
 			src++;
@@ -164,27 +164,27 @@ static const char *do_parse_shell(const char *shell_arg, char **msg)
 	} while (*src != '\0');
 
 	if (!arg0_found) {
-		shell_arg0_index = args - shell;
+		ctx->shell_arg0_index = args - ctx->shell;
 		*args++ = NULL;
 	}
 
 	return NULL;
 }
 
-int parse_shell(const char *shell_arg)
+int parse_shell(pcresp_ctx *ctx, const char *shell_arg)
 {
 	char *err_msg = NULL;
 	const char *err_pos;
 	size_t err_offs;
 
-	if (shell) {
-		free(shell);
-		shell = NULL;
-		shell_args = 0;
-		shell_arg0_index = 0;
+	if (ctx->shell) {
+		free(ctx->shell);
+		ctx->shell = NULL;
+		ctx->shell_args = 0;
+		ctx->shell_arg0_index = 0;
 	}
 
-	err_pos = do_parse_shell(shell_arg, &err_msg);
+	err_pos = do_parse_shell(ctx, shell_arg, &err_msg);
 
 	if (err_pos != NULL) {
 		err_offs = err_pos - shell_arg;
@@ -0,0 +1,505 @@
+/*
+ *    Stream processing tool
+ *
+ *    Copyright 2016 Zoltan Herczeg (hzmester@freemail.hu). All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are
+ * permitted provided that the following conditions are met:
+ *
+ *   1. Redistributions of source code must retain the above copyright notice, this list of
+ *      conditions and the following disclaimer.
+ *
+ *   2. Redistributions in binary form must reproduce the above copyright notice, this list
+ *      of conditions and the following disclaimer in the documentation and/or other materials
+ *      provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDER(S) AND CONTRIBUTORS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT
+ * SHALL THE COPYRIGHT HOLDER(S) OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "pcresp.h"
+
+#include <math.h>
+#include <stdlib.h>
+
+/* Approximate aggregation with fixed memory (--top-k and --distinct).
+ *
+ * The most frequent keys are tracked by the Space-Saving algorithm:
+ * TOP_K_COUNTER_FACTOR * k counters are kept, and a new key replaces
+ * the key of the smallest counter, inheriting its count as the error.
+ * The counters are stored in a min-heap, and found by an open
+ * addressing hash table. The reported count of a key is an upper
+ * bound, which exceeds the real count by at most the reported error.
+ *
+ * The number of distinct keys is estimated by HyperLogLog with
+ * 2^DISTINCT_PRECISION one byte registers (0.8% standard error). */
+
+#define TOP_K_COUNTER_FACTOR 4
+/* Longer keys are truncated, so the memory of a counter is fixed. */
+#define TOP_K_MAX_KEY_LENGTH 256
+#define DISTINCT_PRECISION 14
+#define DISTINCT_REGISTERS (1 << DISTINCT_PRECISION)
+
+typedef struct top_k_counter {
+	/* Fixed part of the key storage. */
+	char *key;
+	uint64_t hash;
+	uint64_t count;
+	uint64_t error;
+	size_t key_length;
+	uint32_t heap_index;
+} top_k_counter;
+
+struct sketch {
+	const char *top_k_source;
+	const char *distinct_source;
+	hash_template *top_k_key;
+	hash_template *distinct_key;
+	size_t k;
+	/* Space-Saving counters. */
+	top_k_counter *counters;
+	char *keys;
+	uint32_t counter_max;
+	uint32_t counter_count;
+	uint32_t *heap;
+	/* Counter index + 1, zero for empty slots. */
+	uint32_t *table;
+	size_t table_mask;
+	/* HyperLogLog registers. */
+	uint8_t *registers;
+	uint64_t report_every;
+	uint64_t match_count;
+	string_buffer key_buffer;
+};
+
+static sketch *get_sketch(pcresp_ctx *ctx)
+{
+	if (ctx->sketch == NULL) {
+		ctx->sketch = (sketch*)malloc(sizeof(sketch));
+		if (ctx->sketch == NULL) {
+			fprintf(stderr, "Cannot allocate memory\n");
+			return NULL;
+		}
+		memset(ctx->sketch, 0, sizeof(sketch));
+	}
+	return ctx->sketch;
+}
+
+int pcresp_add_top_k(pcresp_ctx *ctx, size_t k, const char *source)
+{
+	sketch *sk = get_sketch(ctx);
+
+	if (sk == NULL) {
+		return 0;
+	}
+
+	if (sk->top_k_source != NULL) {
+		fprintf(stderr, "Only one --top-k key is allowed\n");
+		return 0;
+	}
+
+	if (k < 1 || k > 65536) {
+		fprintf(stderr, "The number of --top-k keys must be between 1 and 65536\n");
+		return 0;
+	}
+
+	sk->top_k_source = source;
+	sk->k = k;
+	return 1;
+}
+
+int pcresp_add_distinct(pcresp_ctx *ctx, const char *source)
+{
+	sketch *sk = get_sketch(ctx);
+
+	if (sk == NULL) {
+		return 0;
+	}
+
+	if (sk->distinct_source != NULL) {
+		fprintf(stderr, "Only one --distinct key is allowed\n");
+		return 0;
+	}
+
+	sk->distinct_source = source;
+	return 1;
+}
+
+int pcresp_set_report_every(pcresp_ctx *ctx, uint64_t report_every)
+{
+	if (ctx->sketch == NULL) {
+		fprintf(stderr, "Periodic reports require --top-k or --distinct\n");
+		return 0;
+	}
+
+	ctx->sketch->report_every = report_every;
+	return 1;
+}
+
+int init_sketch(pcresp_ctx *ctx)
+{
+	sketch *sk = ctx->sketch;
+	size_t table_size;
+	uint32_t i;
+
+	if (ctx->aggregate != NULL) {
+		fprintf(stderr, "--top-k and --distinct cannot be combined with --group-by or --unique\n");
+		return 0;
+	}
+
+	if (sk->distinct_source != NULL) {
+		sk->distinct_key = compile_template(ctx, sk->distinct_source, strlen(sk->distinct_source));
+		sk->registers = (uint8_t*)calloc(DISTINCT_REGISTERS, 1);
+
+		if (sk->distinct_key == NULL || sk->registers == NULL) {
+			if (sk->registers == NULL) {
+				fprintf(stderr, "Cannot allocate memory\n");
+			}
+			return 0;
+		}
+	}
+
+	if (sk->top_k_source == NULL) {
+		return 1;
+	}
+
+	sk->top_k_key = compile_template(ctx, sk->top_k_source, strlen(sk->top_k_source));
+	if (sk->top_k_key == NULL) {
+		return 0;
+	}
+
+	sk->counter_max = (uint32_t)(sk->k * TOP_K_COUNTER_FACTOR);
+
+	/* The table is at most half full. */
+	table_size = 1;
+	while (table_size < (size_t)sk->counter_max * 2) {
+		table_size *= 2;
+	}
+	sk->table_mask = table_size - 1;
+
+	sk->counters = (top_k_counter*)malloc(sk->counter_max * sizeof(top_k_counter));
+	sk->keys = (char*)malloc((size_t)sk->counter_max * TOP_K_MAX_KEY_LENGTH);
+	sk->heap = (uint32_t*)malloc(sk->counter_max * sizeof(uint32_t));
+	sk->table = (uint32_t*)calloc(table_size, sizeof(uint32_t));
+
+	if (sk->counters == NULL || sk->keys == NULL || sk->heap == NULL || sk->table == NULL) {
+		fprintf(stderr, "Cannot allocate memory\n");
+		return 0;
+	}
+
+	for (i = 0; i < sk->counter_max; i++) {
+		sk->counters[i].key = sk->keys + (size_t)i * TOP_K_MAX_KEY_LENGTH;
+	}
+	return 1;
+}
+
+void free_sketch(pcresp_ctx *ctx)
+{
+	sketch *sk = ctx->sketch;
+
+	if (sk == NULL) {
+		return;
+	}
+
+	free(sk->top_k_key);
+	free(sk->distinct_key);
+	free(sk->counters);
+	free(sk->keys);
+	free(sk->heap);
+	free(sk->table);
+	free(sk->registers);
+	free(sk->key_buffer.data);
+	free(sk);
+	ctx->sketch = NULL;
+}
+
+/* FNV-1a followed by the splitmix64 finalizer, since HyperLogLog
+ * needs uniformly distributed bits. */
+static uint64_t hash_key(const char *data, size_t length)
+{
+	uint64_t hash = 14695981039346656037ull;
+	const char *end = data + length;
+
+	while (data < end) {
+		hash = (hash ^ (uint8_t)*data++) * 1099511628211ull;
+	}
+
+	hash = (hash ^ (hash >> 30)) * 0xbf58476d1ce4e5b9ull;
+	hash = (hash ^ (hash >> 27)) * 0x94d049bb133111ebull;
+	return hash ^ (hash >> 31);
+}
+
+static void add_distinct(sketch *sk, uint64_t hash)
+{
+	uint32_t index = (uint32_t)(hash >> (64 - DISTINCT_PRECISION));
+	uint8_t rank = 1;
+
+	/* Position of the first set bit in the remaining bits. */
+	hash <<= DISTINCT_PRECISION;
+	while (rank <= 64 - DISTINCT_PRECISION && !(hash & 0x8000000000000000ull)) {
+		hash <<= 1;
+		rank++;
+	}
+
+	if (rank > sk->registers[index]) {
+		sk->registers[index] = rank;
+	}
+}
+
+static double estimate_distinct(sketch *sk)
+{
+	const double registers = (double)DISTINCT_REGISTERS;
+	double sum = 0.0, estimate;
+	uint32_t i, zeros = 0;
+
+	for (i = 0; i < DISTINCT_REGISTERS; i++) {
+		sum += ldexp(1.0, -(int)sk->registers[i]);
+		zeros += (sk->registers[i] == 0);
+	}
+
+	estimate = (0.7213 / (1.0 + 1.079 / registers)) * registers * registers / sum;
+
+	/* Linear counting is more accurate for small cardinalities. */
+	if (estimate <= 2.5 * registers && zeros > 0) {
+		estimate = registers * log(registers / (double)zeros);
+	}
+	return estimate;
+}
+
+static int heap_less(sketch *sk, uint32_t left, uint32_t right)
+{
+	return sk->counters[sk->heap[left]].count < sk->counters[sk->heap[right]].count;
+}
+
+static void heap_swap(sketch *sk, uint32_t left, uint32_t right)
+{
+	uint32_t counter = sk->heap[left];
+
+	sk->heap[left] = sk->heap[right];
+	sk->heap[right] = counter;
+	sk->counters[sk->heap[left]].heap_index = left;
+	sk->counters[sk->heap[right]].heap_index = right;
+}
+
+static void heap_sift_up(sketch *sk, uint32_t index)
+{
+	while (index > 0 && heap_less(sk, index, (index - 1) / 2)) {
+		heap_swap(sk, index, (index - 1) / 2);
+		index = (index - 1) / 2;
+	}
+}
+
+static void heap_sift_down(sketch *sk, uint32_t index)
+{
+	uint32_t child;
+
+	while (1) {
+		child = index * 2 + 1;
+		if (child >= sk->counter_count) {
+			return;
+		}
+
+		if (child + 1 < sk->counter_count && heap_less(sk, child + 1, child)) {
+			child++;
+		}
+
+		if (!heap_less(sk, child, index)) {
+			return;
+		}
+
+		heap_swap(sk, index, child);
+		index = child;
+	}
+}
+
+/* Returns with the table slot of the key, or the empty slot where it can be inserted. */
+static size_t find_slot(sketch *sk, const char *key, size_t length, uint64_t hash)
+{
+	size_t index = (size_t)hash & sk->table_mask;
+	top_k_counter *counter;
+	uint32_t id;
+
+	while ((id = sk->table[index]) != 0) {
+		counter = sk->counters + id - 1;
+		if (counter->hash == hash && counter->key_length == length
+				&& memcmp(counter->key, key, length) == 0) {
+			break;
+		}
+		index = (index + 1) & sk->table_mask;
+	}
+	return index;
+}
+
+/* Removes a slot of the linear probing table, and moves
+ * the following entries of the probe sequence back. */
+static void remove_slot(sketch *sk, size_t index)
+{
+	size_t next = index, home;
+
+	while (1) {
+		next = (next + 1) & sk->table_mask;
+		if (sk->table[next] == 0) {
+			break;
+		}
+
+		home = (size_t)sk->counters[sk->table[next] - 1].hash & sk->table_mask;
+
+		/* The entry can be moved if index is between its home and next (cyclically). */
+		if (((next - home) & sk->table_mask) >= ((next - index) & sk->table_mask)) {
+			sk->table[index] = sk->table[next];
+			index = next;
+		}
+	}
+	sk->table[index] = 0;
+}
+
+static void add_top_k(sketch *sk, const char *key, size_t length, uint64_t hash)
+{
+	top_k_counter *counter;
+	size_t slot = find_slot(sk, key, length, hash);
+	uint32_t id = sk->table[slot];
+
+	if (id != 0) {
+		counter = sk->counters + id - 1;
+		counter->count++;
+		heap_sift_down(sk, counter->heap_index);
+		return;
+	}
+
+	if (sk->counter_count < sk->counter_max) {
+		id = ++sk->counter_count;
+		counter = sk->counters + id - 1;
+		counter->count = 0;
+		counter->error = 0;
+		counter->heap_index = id - 1;
+		sk->heap[id - 1] = id - 1;
+	}
+	else {
+		/* The key of the smallest counter is replaced. */
+		id = sk->heap[0] + 1;
+		counter = sk->counters + id - 1;
+		remove_slot(sk, find_slot(sk, counter->key, counter->key_length, counter->hash));
+		counter->error = counter->count;
+		/* The removal may have moved the free slot of the new key. */
+		slot = find_slot(sk, key, length, hash);
+	}
+
+	memcpy(counter->key, key, length);
+	counter->key_length = length;
+	counter->hash = hash;
+	counter->count++;
+	sk->table[slot] = id;
+
+	heap_sift_up(sk, counter->heap_index);
+	heap_sift_down(sk, counter->heap_index);
+}
+
+static int compare_counters(const void *left_ptr, const void *right_ptr)
+{
+	const top_k_counter *left = *(const top_k_counter * const *)left_ptr;
+	const top_k_counter *right = *(const top_k_counter * const *)right_ptr;
+	size_t length;
+	int result;
+
+	if (left->count != right->count) {
+		return left->count < right->count ? 1 : -1;
+	}
+
+	length = left->key_length < right->key_length ? left->key_length : right->key_length;
+	result = memcmp(left->key, right->key, length);
+
+	if (result != 0) {
+		return result;
+	}
+	return (left->key_length > right->key_length) - (left->key_length < right->key_length);
+}
+
+static void print_report(pcresp_ctx *ctx)
+{
+	sketch *sk = ctx->sketch;
+	top_k_counter **list;
+	uint32_t i, count;
+
+	if (sk->registers != NULL) {
+		fprintf(ctx->output, "%.0f\n", estimate_distinct(sk));
+	}
+
+	if (sk->counter_count == 0) {
+		return;
+	}
+
+	list = (top_k_counter**)malloc(sk->counter_count * sizeof(top_k_counter*));
+	if (list == NULL) {
+		fprintf(stderr, "Cannot allocate memory\n");
+		return;
+	}
+
+	for (i = 0; i < sk->counter_count; i++) {
+		list[i] = sk->counters + i;
+	}
+
+	qsort(list, sk->counter_count, sizeof(top_k_counter*), compare_counters);
+
+	count = sk->counter_count < sk->k ? sk->counter_count : (uint32_t)sk->k;
+	for (i = 0; i < count; i++) {
+		fwrite(list[i]->key, 1, list[i]->key_length, ctx->output);
+		fprintf(ctx->output, "\t%lu\t%lu\n", (unsigned long)list[i]->count, (unsigned long)list[i]->error);
+	}
+
+	free(list);
+}
+
+void sketch_match(pcresp_ctx *ctx, const char *subject, PCRE2_SIZE *ovector, const char *mark)
+{
+	sketch *sk = ctx->sketch;
+	size_t length;
+
+	if (sk->registers != NULL
+			&& expand_template(ctx, sk->distinct_key, subject, ovector, mark, &sk->key_buffer)) {
+		add_distinct(sk, hash_key(sk->key_buffer.data, sk->key_buffer.length));
+	}
+
+	if (sk->counters != NULL
+			&& expand_template(ctx, sk->top_k_key, subject, ovector, mark, &sk->key_buffer)) {
+		length = sk->key_buffer.length;
+		if (length > TOP_K_MAX_KEY_LENGTH) {
+			length = TOP_K_MAX_KEY_LENGTH;
+		}
+		add_top_k(sk, sk->key_buffer.data, length, hash_key(sk->key_buffer.data, length));
+	}
+
+	sk->match_count++;
+	if (sk->report_every > 0 && sk->match_count % sk->report_every == 0) {
+		print_report(ctx);
+		/* Separates the periodic reports. */
+		fputs("\n", ctx->output);
+	}
+}
+
+/* Prints the final report, and clears the sketches. */
+void print_sketch(pcresp_ctx *ctx)
+{
+	sketch *sk = ctx->sketch;
+
+	if (sk == NULL || sk->match_count == 0) {
+		return;
+	}
+
+	print_report(ctx);
+
+	sk->match_count = 0;
+	sk->counter_count = 0;
+	if (sk->table != NULL) {
+		memset(sk->table, 0, (sk->table_mask + 1) * sizeof(uint32_t));
+	}
+	if (sk->registers != NULL) {
+		memset(sk->registers, 0, DISTINCT_REGISTERS);
+	}
+}
@@ -0,0 +1,343 @@
+/*
+ *    Stream processing tool
+ *
+ *    Copyright 2016 Zoltan Herczeg (hzmester@freemail.hu). All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are
+ * permitted provided that the following conditions are met:
+ *
+ *   1. Redistributions of source code must retain the above copyright notice, this list of
+ *      conditions and the following disclaimer.
+ *
+ *   2. Redistributions in binary form must reproduce the above copyright notice, this list
+ *      of conditions and the following disclaimer in the documentation and/or other materials
+ *      provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDER(S) AND CONTRIBUTORS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT
+ * SHALL THE COPYRIGHT HOLDER(S) OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifdef __linux__
+#define _GNU_SOURCE
+#endif
+
+#include "pcresp.h"
+
+#include <pthread.h>
+
+/* Chained stages (--then). The output of a context is written into
+ * a memory buffer by a custom stdio stream, and the buffer is matched
+ * by the next context. By default the whole output is passed to the
+ * next stage when the context is flushed. In streaming mode each next
+ * stage runs on its own thread, and receives the output in chunks of
+ * complete lines. The chunks are returned to the producer after they
+ * are matched, so the same buffers are used again. */
+
+/* Size of a chunk passed to the next stage in streaming mode. */
+#define STAGE_CHUNK_SIZE (256 * 1024)
+/* Buffer of the output stream, which is copied to the chunks. */
+#define STAGE_STREAM_BUFFER_SIZE (64 * 1024)
+/* Maximum number of chunks waiting for the next stage. */
+#define STAGE_QUEUE_LENGTH 4
+
+typedef struct stage_chunk {
+	struct stage_chunk *next;
+	string_buffer data;
+} stage_chunk;
+
+struct stage_link {
+	pcresp_ctx *next;
+	int streaming;
+	/* Chunk filled by the output stream of the producer. */
+	stage_chunk *current;
+	pthread_t thread;
+	int thread_started;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	stage_chunk *queue_first;
+	stage_chunk *queue_last;
+	size_t queue_length;
+	stage_chunk *free_chunks;
+	int finished;
+};
+
+static stage_chunk *get_chunk(stage_link *link)
+{
+	stage_chunk *chunk;
+
+	pthread_mutex_lock(&link->lock);
+	chunk = link->free_chunks;
+	if (chunk != NULL) {
+		link->free_chunks = chunk->next;
+	}
+	pthread_mutex_unlock(&link->lock);
+
+	if (chunk == NULL) {
+		chunk = (stage_chunk*)malloc(sizeof(stage_chunk));
+		if (chunk == NULL) {
+			fprintf(stderr, "Cannot allocate memory\n");
+			return NULL;
+		}
+		memset(chunk, 0, sizeof(stage_chunk));
+	}
+
+	chunk->next = NULL;
+	chunk->data.length = 0;
+	return chunk;
+}
+
+static void free_chunk_list(stage_chunk *chunk)
+{
+	stage_chunk *next;
+
+	while (chunk != NULL) {
+		next = chunk->next;
+		free(chunk->data.data);
+		free(chunk);
+		chunk = next;
+	}
+}
+
+static void *stage_thread(void *data)
+{
+	stage_link *link = (stage_link*)data;
+	stage_chunk *chunk;
+
+	while (1) {
+		pthread_mutex_lock(&link->lock);
+		while (link->queue_first == NULL && !link->finished) {
+			pthread_cond_wait(&link->cond, &link->lock);
+		}
+
+		chunk = link->queue_first;
+		if (chunk == NULL) {
+			pthread_mutex_unlock(&link->lock);
+			break;
+		}
+
+		link->queue_first = chunk->next;
+		if (link->queue_first == NULL) {
+			link->queue_last = NULL;
+		}
+		link->queue_length--;
+		pthread_cond_broadcast(&link->cond);
+		pthread_mutex_unlock(&link->lock);
+
+		if (chunk->data.length > 0) {
+			pcresp_match_buffer(link->next, chunk->data.data, chunk->data.length);
+		}
+
+		pthread_mutex_lock(&link->lock);
+		chunk->next = link->free_chunks;
+		link->free_chunks = chunk;
+		pthread_mutex_unlock(&link->lock);
+	}
+
+	pcresp_flush(link->next);
+	return NULL;
+}
+
+/* Passes the chunk to the stage thread. Returns with zero on error. */
+static int queue_chunk(stage_link *link, stage_chunk *chunk)
+{
+	if (!link->thread_started) {
+		link->finished = 0;
+		if (pthread_create(&link->thread, NULL, stage_thread, link) != 0) {
+			fprintf(stderr, "Cannot create thread\n");
+			return 0;
+		}
+		link->thread_started = 1;
+	}
+
+	pthread_mutex_lock(&link->lock);
+	while (link->queue_length >= STAGE_QUEUE_LENGTH) {
+		pthread_cond_wait(&link->cond, &link->lock);
+	}
+
+	if (link->queue_last == NULL) {
+		link->queue_first = chunk;
+	}
+	else {
+		link->queue_last->next = chunk;
+	}
+	link->queue_last = chunk;
+	link->queue_length++;
+	pthread_cond_broadcast(&link->cond);
+	pthread_mutex_unlock(&link->lock);
+	return 1;
+}
+
+/* Passes the complete lines of the current chunk to the next stage,
+ * and the incomplete last line is moved to a new chunk. */
+static int pass_lines(stage_link *link)
+{
+	stage_chunk *current = link->current;
+	stage_chunk *chunk;
+	char *data = current->data.data;
+	size_t length = current->data.length;
+
+	while (length > 0 && data[length - 1] != '\n') {
+		length--;
+	}
+
+	if (length == 0) {
+		/* A line longer than the chunk. */
+		return 1;
+	}
+
+	chunk = get_chunk(link);
+	if (chunk == NULL || !buffer_append(&chunk->data, data + length, current->data.length - length)) {
+		return 0;
+	}
+
+	current->data.length = length;
+	link->current = chunk;
+	return queue_chunk(link, current);
+}
+
+static ssize_t stage_write(void *cookie, const char *data, size_t size)
+{
+	stage_link *link = (stage_link*)cookie;
+
+	/* The next stage does not read more input. */
+	if (INPUT_CANCELLED(link->next)) {
+		return 0;
+	}
+
+	if (!buffer_append(&link->current->data, data, size)) {
+		return 0;
+	}
+
+	/* A line longer than the chunk is only searched again for
+	 * a newline when the written data has one. */
+	if (link->streaming && link->current->data.length >= STAGE_CHUNK_SIZE
+			&& (link->current->data.length - size < STAGE_CHUNK_SIZE || memchr(data, '\n', size) != NULL)
+			&& !pass_lines(link)) {
+		return 0;
+	}
+	return (ssize_t)size;
+}
+
+int pcresp_add_stage(pcresp_ctx *ctx, pcresp_ctx *next)
+{
+	cookie_io_functions_t functions;
+	stage_link *link;
+
+	if (ctx->next_stage != NULL) {
+		fprintf(stderr, "The next stage has been added\n");
+		return 0;
+	}
+
+	link = (stage_link*)malloc(sizeof(stage_link));
+	if (link == NULL) {
+		fprintf(stderr, "Cannot allocate memory\n");
+		return 0;
+	}
+
+	memset(link, 0, sizeof(stage_link));
+	pthread_mutex_init(&link->lock, NULL);
+	pthread_cond_init(&link->cond, NULL);
+	link->next = next;
+	link->current = get_chunk(link);
+
+	memset(&functions, 0, sizeof(functions));
+	functions.write = stage_write;
+
+	ctx->output = (link->current != NULL) ? fopencookie(link, "w", functions) : NULL;
+
+	if (ctx->output == NULL) {
+		fprintf(stderr, "Cannot create output stream\n");
+		ctx->output = stdout;
+		free_chunk_list(link->current);
+		pthread_mutex_destroy(&link->lock);
+		pthread_cond_destroy(&link->cond);
+		free(link);
+		return 0;
+	}
+
+	setvbuf(ctx->output, NULL, _IOFBF, STAGE_STREAM_BUFFER_SIZE);
+	ctx->next_stage = link;
+	return 1;
+}
+
+void pcresp_set_streaming(pcresp_ctx *ctx, int enable)
+{
+	while (ctx->next_stage != NULL) {
+		ctx->next_stage->streaming = enable;
+		ctx = ctx->next_stage->next;
+	}
+}
+
+void flush_stages(pcresp_ctx *ctx)
+{
+	stage_link *link = ctx->next_stage;
+	stage_chunk *current;
+
+	if (link == NULL) {
+		return;
+	}
+
+	current = link->current;
+
+	if (!link->streaming) {
+		if (current->data.length > 0) {
+			pcresp_match_buffer(link->next, current->data.data, current->data.length);
+			current->data.length = 0;
+		}
+		pcresp_flush(link->next);
+		return;
+	}
+
+	/* The rest of the output including the incomplete last line. */
+	link->current = get_chunk(link);
+	if (link->current == NULL) {
+		link->current = current;
+		current = NULL;
+	}
+
+	if (current != NULL && !queue_chunk(link, current)) {
+		free_chunk_list(current);
+	}
+
+	if (!link->thread_started) {
+		pcresp_flush(link->next);
+		return;
+	}
+
+	pthread_mutex_lock(&link->lock);
+	link->finished = 1;
+	pthread_cond_broadcast(&link->cond);
+	pthread_mutex_unlock(&link->lock);
+
+	pthread_join(link->thread, NULL);
+	link->thread_started = 0;
+}
+
+void free_stages(pcresp_ctx *ctx)
+{
+	stage_link *link = ctx->next_stage;
+
+	if (link == NULL) {
+		return;
+	}
+
+	fclose(ctx->output);
+	ctx->output = stdout;
+	ctx->next_stage = NULL;
+
+	free_chunk_list(link->current);
+	free_chunk_list(link->queue_first);
+	free_chunk_list(link->free_chunks);
+	pthread_mutex_destroy(&link->lock);
+	pthread_cond_destroy(&link->cond);
+
+	pcresp_ctx_free(link->next);
+	free(link);
+}
@@ -0,0 +1,415 @@
+/*
+ *    Stream processing tool
+ *
+ *    Copyright 2016 Zoltan Herczeg (hzmester@freemail.hu). All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are
+ * permitted provided that the following conditions are met:
+ *
+ *   1. Redistributions of source code must retain the above copyright notice, this list of
+ *      conditions and the following disclaimer.
+ *
+ *   2. Redistributions in binary form must reproduce the above copyright notice, this list
+ *      of conditions and the following disclaimer in the documentation and/or other materials
+ *      provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDER(S) AND CONTRIBUTORS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT
+ * SHALL THE COPYRIGHT HOLDER(S) OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "pcresp.h"
+
+/* Templates are hash mark sequences compiled into a list of
+ * items, which can be expanded without parsing the source again.
+ * Unlike scripts, templates are not split into arguments. */
+
+uint32_t hash_bytes(const char *data, size_t length)
+{
+	/* FNV-1a */
+	uint32_t hash = 2166136261u;
+	const char *end = data + length;
+
+	while (data < end) {
+		hash = (hash ^ (uint8_t)*data++) * 16777619u;
+	}
+	return hash;
+}
+
+int buffer_append(string_buffer *buffer, const char *data, size_t length)
+{
+	size_t new_max;
+	char *new_data;
+
+	/* The data may be NULL for empty strings. */
+	if (length == 0) {
+		return 1;
+	}
+
+	if (buffer->length + length > buffer->max) {
+		new_max = buffer->max > 0 ? buffer->max * 2 : 256;
+		while (new_max < buffer->length + length) {
+			new_max *= 2;
+		}
+
+		new_data = (char*)realloc(buffer->data, new_max);
+		if (new_data == NULL) {
+			fprintf(stderr, "Cannot allocate memory\n");
+			return 0;
+		}
+
+		buffer->data = new_data;
+		buffer->max = new_max;
+	}
+
+	memcpy(buffer->data + buffer->length, data, length);
+	buffer->length += length;
+	return 1;
+}
+
+/* Sets msg on error. */
+static const char *parse_decimal(const char *src, const char *src_end, PCRE2_SIZE *value, char **msg)
+{
+	*value = 0;
+
+	if (src >= src_end || *src < '0' || *src > '9') {
+		*msg = "a decimal number between 0 and 65535 is required";
+		return src;
+	}
+
+	do {
+		*value = *value * 10 + (*src - '0');
+		if (*value > 65535) {
+			*msg = "a decimal number between 0 and 65535 is required";
+			return src;
+		}
+		src++;
+	} while (src < src_end && *src >= '0' && *src <= '9');
+
+	return src;
+}
+
+const char *parse_hash_reference(const char *src, const char *src_end, hash_reference *reference, char **msg)
+{
+	const char *name;
+
+	reference->capture_id = PCRE2_UNSET;
+	reference->transforms = 0;
+	reference->name = NULL;
+	reference->name_length = 0;
+
+	if (*src == '[') {
+		name = ++src;
+		while (src < src_end && *src != ']') {
+			src++;
+		}
+		if (src == name) {
+			*msg = "string name cannot be empty";
+			return src;
+		}
+		if (src >= src_end) {
+			*msg = "string name is not terminated by ']'";
+			return src;
+		}
+
+		reference->name = name;
+		reference->name_length = (size_t)(src - name);
+		return src + 1;
+	}
+
+	if (*src != '{') {
+		return parse_decimal(src, src_end, &reference->capture_id, msg);
+	}
+
+	src = parse_decimal(src + 1, src_end, &reference->capture_id, msg);
+	if (*msg != NULL) {
+		return src;
+	}
+
+	if (src < src_end && *src == ':') {
+		src = parse_transforms(src, src_end, &reference->transforms, msg);
+		if (*msg != NULL) {
+			return src;
+		}
+	}
+
+	if (src < src_end && *src == ',') {
+		name = ++src;
+		while (src < src_end && *src != '}') {
+			src++;
+		}
+		if (src == name) {
+			*msg = "string name cannot be empty";
+			return src;
+		}
+
+		reference->name = name;
+		reference->name_length = (size_t)(src - name);
+	}
+
+	if (src >= src_end || *src != '}') {
+		*msg = "capture reference is not terminated by '}'";
+		return src;
+	}
+	return src + 1;
+}
+
+static const char *do_compile_template(pcresp_ctx *ctx, const char *src, size_t length,
+	template_item *items, char *chars, size_t *item_count, char **msg)
+{
+	const char *src_end = src + length;
+	hash_reference reference;
+	ext_string *string;
+	PCRE2_SIZE capture_id;
+	size_t count = 0;
+	char literal;
+
+	while (src < src_end) {
+		if (*src != '#') {
+			literal = *src++;
+		}
+		else {
+			src++;
+
+			if (src >= src_end) {
+				*msg = "a character must be present after # (hash mark)";
+				return src;
+			}
+
+			switch (*src) {
+			case '#':
+			case '<':
+			case '>':
+				literal = *src++;
+				break;
+			case 'n':
+				literal = '\n';
+				src++;
+				break;
+			case 'M':
+				items[count].type = TEMPLATE_MARK;
+				count++;
+				src++;
+				continue;
+			case 'L':
+			case 'C':
+				items[count].type = (*src == 'L') ? TEMPLATE_LINE : TEMPLATE_COLUMN;
+				ctx->line_positions = 1;
+				count++;
+				src++;
+				continue;
+			case '[':
+				src = parse_hash_reference(src, src_end, &reference, msg);
+				if (*msg != NULL) {
+					return src;
+				}
+
+				string = get_ext_string(ctx, reference.name, reference.name_length);
+				if (string != NULL && string->chars_length > 0) {
+					items[count].type = TEMPLATE_STRING;
+					items[count].chars = string->chars;
+					items[count].length = string->chars_length;
+					count++;
+				}
+				continue;
+			case '^':
+			case '$':
+				items[count].type = (*src == '^') ? TEMPLATE_START_OFFSET : TEMPLATE_END_OFFSET;
+				src++;
+
+				if (src < src_end && *src == '{') {
+					src = parse_decimal(src + 1, src_end, &capture_id, msg);
+					if (*msg != NULL) {
+						return src;
+					}
+
+					if (src >= src_end || *src != '}') {
+						*msg = "capture reference is not terminated by '}'";
+						return src;
+					}
+					src++;
+				}
+				else {
+					src = parse_decimal(src, src_end, &capture_id, msg);
+					if (*msg != NULL) {
+						return src;
+					}
+				}
+
+				items[count].capture_id = capture_id;
+				items[count].transforms = 0;
+				items[count].chars = NULL;
+				items[count].length = 0;
+				count++;
+				continue;
+			default:
+				if (*src != '{' && (*src < '0' || *src > '9')) {
+					*msg = "invalid # (hash mark) sequence";
+					return src;
+				}
+
+				src = parse_hash_reference(src, src_end, &reference, msg);
+				if (*msg != NULL) {
+					return src;
+				}
+
+				items[count].type = TEMPLATE_CAPTURE;
+				items[count].capture_id = reference.capture_id;
+				items[count].transforms = reference.transforms;
+				items[count].chars = NULL;
+				items[count].length = 0;
+
+				/* Fallback string of #{idx,name}. */
+				if (reference.name != NULL) {
+					string = get_ext_string(ctx, reference.name, reference.name_length);
+					if (string != NULL) {
+						items[count].chars = string->chars;
+						items[count].length = string->chars_length;
+					}
+				}
+				count++;
+				continue;
+			}
+		}
+
+		/* Consecutive literal characters are merged. */
+		*chars = literal;
+
+		if (count > 0 && items[count - 1].type == TEMPLATE_LITERAL
+				&& items[count - 1].chars + items[count - 1].length == chars) {
+			items[count - 1].length++;
+		}
+		else {
+			items[count].type = TEMPLATE_LITERAL;
+			items[count].chars = chars;
+			items[count].length = 1;
+			count++;
+		}
+		chars++;
+	}
+
+	*item_count = count;
+	return NULL;
+}
+
+hash_template *compile_template(pcresp_ctx *ctx, const char *src, size_t length)
+{
+	char *err_msg = NULL;
+	const char *err_pos;
+	size_t err_offs;
+	hash_template *result;
+
+	/* Each source character generates at most one item and one character. */
+	result = (hash_template*)malloc(sizeof(hash_template) + length * (sizeof(template_item) + 1));
+
+	if (result == NULL) {
+		fprintf(stderr, "Cannot allocate memory\n");
+		return NULL;
+	}
+
+	result->item_count = 0;
+	err_pos = do_compile_template(ctx, src, length, result->items,
+		(char*)(result->items + length), &result->item_count, &err_msg);
+
+	if (err_pos != NULL) {
+		err_offs = err_pos - src;
+
+		fprintf(stderr, "Cannot compile: ");
+		fwrite(src, 1, err_offs, stderr);
+		fprintf(stderr, "<< SYNTAX ERROR HERE >>");
+		fwrite(err_pos, 1, length - err_offs, stderr);
+		fprintf(stderr, "\n    Error at offset %d : %s\n", (int)err_offs, err_msg);
+		free(result);
+		return NULL;
+	}
+
+	return result;
+}
+
+int expand_template(pcresp_ctx *ctx, hash_template *tpl, const char *subject,
+	PCRE2_SIZE *ovector, const char *mark, string_buffer *buffer)
+{
+	template_item *item = tpl->items;
+	template_item *end = tpl->items + tpl->item_count;
+	PCRE2_SIZE capture_id;
+	const char *data;
+	char number[32];
+	size_t length;
+
+	buffer->length = 0;
+
+	while (item < end) {
+		switch (item->type) {
+		case TEMPLATE_LITERAL:
+		case TEMPLATE_STRING:
+			if (!buffer_append(buffer, item->chars, item->length)) {
+				return 0;
+			}
+			break;
+		case TEMPLATE_MARK:
+			if (mark != NULL && !buffer_append(buffer, mark, strlen(mark))) {
+				return 0;
+			}
+			break;
+		case TEMPLATE_CAPTURE:
+			capture_id = item->capture_id * 2;
+
+			if (item->capture_id >= ctx->ovector_size || ovector[capture_id] == PCRE2_UNSET) {
+				/* Fallback string. */
+				if (!buffer_append(buffer, item->chars, item->length)) {
+					return 0;
+				}
+				break;
+			}
+
+			length = ovector[capture_id + 1] > ovector[capture_id]
+				? ovector[capture_id + 1] - ovector[capture_id] : 0;
+			data = subject + ovector[capture_id];
+
+			if (item->transforms != 0) {
+				data = apply_transforms(ctx, item->transforms, data, &length);
+				if (data == NULL) {
+					return 0;
+				}
+			}
+
+			if (length > 0 && !buffer_append(buffer, data, length)) {
+				return 0;
+			}
+			break;
+		case TEMPLATE_START_OFFSET:
+		case TEMPLATE_END_OFFSET:
+			capture_id = item->capture_id * 2;
+
+			if (item->capture_id >= ctx->ovector_size || ovector[capture_id] == PCRE2_UNSET) {
+				break;
+			}
+
+			if (item->type == TEMPLATE_END_OFFSET) {
+				capture_id++;
+			}
+
+			length = (size_t)sprintf(number, "%lu", (unsigned long)ovector[capture_id]);
+			if (!buffer_append(buffer, number, length)) {
+				return 0;
+			}
+			break;
+		case TEMPLATE_LINE:
+		case TEMPLATE_COLUMN:
+			length = (size_t)sprintf(number, "%lu", (unsigned long)(item->type == TEMPLATE_LINE
+				? ctx->line_number : ctx->column));
+			if (!buffer_append(buffer, number, length)) {
+				return 0;
+			}
+			break;
+		}
+		item++;
+	}
+	return 1;
+}
@@ -0,0 +1,241 @@
+/*
+ *    Stream processing tool
+ *
+ *    Copyright 2016 Zoltan Herczeg (hzmester@freemail.hu). All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are
+ * permitted provided that the following conditions are met:
+ *
+ *   1. Redistributions of source code must retain the above copyright notice, this list of
+ *      conditions and the following disclaimer.
+ *
+ *   2. Redistributions in binary form must reproduce the above copyright notice, this list
+ *      of conditions and the following disclaimer in the documentation and/or other materials
+ *      provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDER(S) AND CONTRIBUTORS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT
+ * SHALL THE COPYRIGHT HOLDER(S) OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifdef __linux__
+#define _GNU_SOURCE
+#endif
+
+#include "pcresp.h"
+
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+
+/* Timeline of the processing in Chrome trace event format, which can
+ * be opened by Perfetto or chrome://tracing. Each context has its own
+ * event buffer, which is written to the file when it is full and when
+ * the context is freed. The thread using a context may change (e.g.
+ * the matching thread of --pipeline), so each event records its
+ * thread id. */
+
+#define TRACE_BUFFER_SIZE 4096
+
+typedef struct trace_event {
+	int type;
+	uint64_t start;
+	uint64_t end;
+	/* Offset of the label in the trace labels buffer or -1. */
+	long label;
+	long value1;
+	long value2;
+	long tid;
+} trace_event;
+
+struct trace_buffer {
+	FILE *file;
+	long pid;
+	/* The thread which recorded the last event. */
+	pthread_t thread;
+	long tid;
+	int first;
+	size_t count;
+	string_buffer labels;
+	trace_event events[TRACE_BUFFER_SIZE];
+};
+
+static const char *trace_names[] = {
+	"file", "load", "match", "callout", "script"
+};
+
+static const char *trace_arg_names[][2] = {
+	{ NULL, NULL },
+	{ "bytes", NULL },
+	{ "offset", "result" },
+	{ "number", "offset" },
+	{ "pid", "status" },
+};
+
+uint64_t trace_time(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000000 + (uint64_t)now.tv_nsec;
+}
+
+int pcresp_set_trace(pcresp_ctx *ctx, const char *file_name)
+{
+	trace_buffer *trace;
+
+	if (ctx->trace != NULL) {
+		close_trace(ctx);
+	}
+
+	trace = (trace_buffer*)malloc(sizeof(trace_buffer));
+	if (trace == NULL) {
+		fprintf(stderr, "Cannot allocate memory\n");
+		return 0;
+	}
+
+	memset(trace, 0, sizeof(trace_buffer));
+	trace->file = fopen(file_name, "w");
+	if (trace->file == NULL) {
+		fprintf(stderr, "Cannot create trace file: %s\n", file_name);
+		free(trace);
+		return 0;
+	}
+
+	trace->pid = (long)getpid();
+	trace->tid = -1;
+	trace->first = 1;
+
+	fputs("[\n", trace->file);
+	ctx->trace = trace;
+	return 1;
+}
+
+static void write_label(FILE *file, const char *chars)
+{
+	const char *start;
+
+	fputc('"', file);
+
+	while (*chars != '\0') {
+		start = chars;
+		while (*chars != '\0' && *chars != '"' && *chars != '\\' && (uint8_t)*chars >= 0x20) {
+			chars++;
+		}
+
+		fwrite(start, 1, (size_t)(chars - start), file);
+
+		if (*chars == '\0') {
+			break;
+		}
+
+		fprintf(file, "\\u%04x", (unsigned)(uint8_t)*chars);
+		chars++;
+	}
+
+	fputc('"', file);
+}
+
+static void write_events(trace_buffer *trace)
+{
+	trace_event *event = trace->events;
+	trace_event *end = event + trace->count;
+	const char **arg_names;
+
+	while (event < end) {
+		/* Microseconds with nanosecond precision. */
+		fprintf(trace->file, "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%ld,\"tid\":%ld,"
+			"\"ts\":%llu.%03u,\"dur\":%llu.%03u,\"args\":{",
+			trace->first ? "" : ",\n", trace_names[event->type], trace->pid, event->tid,
+			(unsigned long long)(event->start / 1000), (unsigned)(event->start % 1000),
+			(unsigned long long)((event->end - event->start) / 1000),
+			(unsigned)((event->end - event->start) % 1000));
+		trace->first = 0;
+
+		arg_names = trace_arg_names[event->type];
+
+		if (event->label >= 0) {
+			fputs("\"name\":", trace->file);
+			write_label(trace->file, trace->labels.data + event->label);
+		}
+		else if (arg_names[0] != NULL) {
+			fprintf(trace->file, "\"%s\":%ld", arg_names[0], event->value1);
+			if (arg_names[1] != NULL) {
+				fprintf(trace->file, ",\"%s\":%ld", arg_names[1], event->value2);
+			}
+		}
+
+		fputs("}}", trace->file);
+		event++;
+	}
+
+	trace->count = 0;
+	trace->labels.length = 0;
+}
+
+void trace_event_end(pcresp_ctx *ctx, int type, uint64_t start, const char *label, long value1, long value2)
+{
+	trace_buffer *trace = ctx->trace;
+	trace_event *event;
+
+	if (trace->count >= TRACE_BUFFER_SIZE) {
+		write_events(trace);
+	}
+
+	/* The thread id is only requested when the thread changes. */
+	if (trace->tid < 0 || !pthread_equal(trace->thread, pthread_self())) {
+		trace->thread = pthread_self();
+#ifdef __linux__
+		trace->tid = (long)syscall(SYS_gettid);
+#else
+		trace->tid = trace->pid;
+#endif
+	}
+
+	event = trace->events + trace->count;
+	event->type = type;
+	event->start = start;
+	event->end = trace_time();
+	event->label = -1;
+	event->value1 = value1;
+	event->value2 = value2;
+	event->tid = trace->tid;
+
+	if (label != NULL) {
+		event->label = (long)trace->labels.length;
+		if (!buffer_append(&trace->labels, label, strlen(label) + 1)) {
+			event->label = -1;
+		}
+	}
+
+	trace->count++;
+}
+
+void close_trace(pcresp_ctx *ctx)
+{
+	trace_buffer *trace = ctx->trace;
+
+	if (trace == NULL) {
+		return;
+	}
+
+	write_events(trace);
+	fputs("\n]\n", trace->file);
+
+	if (fclose(trace->file) != 0) {
+		fprintf(stderr, "Cannot write trace file\n");
+	}
+
+	free(trace->labels.data);
+	free(trace);
+	ctx->trace = NULL;
+}
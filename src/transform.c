@@ -0,0 +1,202 @@
+/*
+ *    Stream processing tool
+ *
+ *    Copyright 2016 Zoltan Herczeg (hzmester@freemail.hu). All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are
+ * permitted provided that the following conditions are met:
+ *
+ *   1. Redistributions of source code must retain the above copyright notice, this list of
+ *      conditions and the following disclaimer.
+ *
+ *   2. Redistributions in binary form must reproduce the above copyright notice, this list
+ *      of conditions and the following disclaimer in the documentation and/or other materials
+ *      provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDER(S) AND CONTRIBUTORS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT
+ * SHALL THE COPYRIGHT HOLDER(S) OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "pcresp.h"
+
+/* Transforms of the captures in hash sequences, e.g. #{1:trim:lower}.
+ * The transforms are applied in order. Each of them writes its result
+ * into one of the two transform buffers of the context, which are
+ * used alternately, so the input of a transform is never overwritten. */
+
+typedef struct transform_name {
+	const char *name;
+	size_t length;
+	uint32_t code;
+} transform_name;
+
+static const transform_name transform_names[] = {
+	{ "upper", 5, TRANSFORM_UPPER },
+	{ "lower", 5, TRANSFORM_LOWER },
+	{ "hex", 3, TRANSFORM_HEX },
+	{ "urldecode", 9, TRANSFORM_URLDECODE },
+	{ "trim", 4, TRANSFORM_TRIM },
+};
+
+#define TRANSFORM_NAME_COUNT (sizeof(transform_names) / sizeof(transform_name))
+
+static const char hex_digits[] = "0123456789abcdef";
+
+const char *parse_transforms(const char *src, const char *src_end, uint32_t *transforms, char **msg)
+{
+	const char *name;
+	size_t i, length;
+	int count = 0;
+
+	*transforms = 0;
+
+	while (src < src_end && *src == ':') {
+		name = ++src;
+		while (src < src_end && *src != ':' && *src != ',' && *src != '}') {
+			src++;
+		}
+
+		length = (size_t)(src - name);
+		for (i = 0; i < TRANSFORM_NAME_COUNT; i++) {
+			if (transform_names[i].length == length && memcmp(transform_names[i].name, name, length) == 0) {
+				break;
+			}
+		}
+
+		if (i >= TRANSFORM_NAME_COUNT) {
+			*msg = "unknown transform (upper, lower, hex, urldecode and trim are supported)";
+			return name;
+		}
+
+		if (count >= TRANSFORM_MAX) {
+			*msg = "maximum 10 transforms are allowed";
+			return name;
+		}
+
+		*transforms |= transform_names[i].code << (count * TRANSFORM_BITS);
+		count++;
+	}
+
+	if (src >= src_end || (*src != ',' && *src != '}')) {
+		*msg = "capture reference is not terminated by '}'";
+	}
+	return src;
+}
+
+static int hex_value(char chr)
+{
+	if (chr >= '0' && chr <= '9') {
+		return chr - '0';
+	}
+	if (chr >= 'a' && chr <= 'f') {
+		return chr - 'a' + 10;
+	}
+	if (chr >= 'A' && chr <= 'F') {
+		return chr - 'A' + 10;
+	}
+	return -1;
+}
+
+static int is_trimmed(char chr)
+{
+	return chr == ' ' || chr == '\t' || chr == '\n' || chr == '\r' || chr == '\v' || chr == '\f';
+}
+
+const char *apply_transforms(pcresp_ctx *ctx, uint32_t transforms, const char *data, size_t *length)
+{
+	string_buffer *buffer;
+	size_t size = *length;
+	size_t i;
+	char *dst;
+	int current = 0, high, low;
+
+	for (; transforms != 0; transforms >>= TRANSFORM_BITS) {
+		if ((transforms & TRANSFORM_MASK) == TRANSFORM_TRIM) {
+			while (size > 0 && is_trimmed(*data)) {
+				data++;
+				size--;
+			}
+			while (size > 0 && is_trimmed(data[size - 1])) {
+				size--;
+			}
+			continue;
+		}
+
+		buffer = ctx->transform_buffers + current;
+		buffer->length = 0;
+		current ^= 1;
+
+		/* The data is copied first, and transformed in place. */
+		if (!buffer_append(buffer, data, size)) {
+			return NULL;
+		}
+
+		if (size == 0) {
+			continue;
+		}
+
+		dst = buffer->data;
+
+		switch (transforms & TRANSFORM_MASK) {
+		case TRANSFORM_UPPER:
+			for (i = 0; i < size; i++) {
+				if (dst[i] >= 'a' && dst[i] <= 'z') {
+					dst[i] = (char)(dst[i] - 'a' + 'A');
+				}
+			}
+			break;
+		case TRANSFORM_LOWER:
+			for (i = 0; i < size; i++) {
+				if (dst[i] >= 'A' && dst[i] <= 'Z') {
+					dst[i] = (char)(dst[i] - 'A' + 'a');
+				}
+			}
+			break;
+		case TRANSFORM_HEX:
+			/* Each byte is doubled. */
+			if (!buffer_append(buffer, data, size)) {
+				return NULL;
+			}
+			dst = buffer->data;
+			for (i = 0; i < size; i++) {
+				dst[i * 2] = hex_digits[(uint8_t)data[i] >> 4];
+				dst[i * 2 + 1] = hex_digits[(uint8_t)data[i] & 0xf];
+			}
+			size *= 2;
+			break;
+		case TRANSFORM_URLDECODE:
+			buffer->length = 0;
+			for (i = 0; i < size; i++) {
+				if (data[i] == '+') {
+					dst[buffer->length++] = ' ';
+					continue;
+				}
+
+				/* Invalid escapes are kept. */
+				high = (data[i] == '%' && i + 2 < size) ? hex_value(data[i + 1]) : -1;
+				low = (high >= 0) ? hex_value(data[i + 2]) : -1;
+
+				if (low >= 0) {
+					dst[buffer->length++] = (char)((high << 4) | low);
+					i += 2;
+					continue;
+				}
+				dst[buffer->length++] = data[i];
+			}
+			size = buffer->length;
+			break;
+		}
+
+		data = buffer->data;
+	}
+
+	*length = size;
+	return data;
+}
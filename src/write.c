@@ -0,0 +1,285 @@
+/*
+ *    Stream processing tool
+ *
+ *    Copyright 2016 Zoltan Herczeg (hzmester@freemail.hu). All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are
+ * permitted provided that the following conditions are met:
+ *
+ *   1. Redistributions of source code must retain the above copyright notice, this list of
+ *      conditions and the following disclaimer.
+ *
+ *   2. Redistributions in binary form must reproduce the above copyright notice, this list
+ *      of conditions and the following disclaimer in the documentation and/or other materials
+ *      provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDER(S) AND CONTRIBUTORS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT
+ * SHALL THE COPYRIGHT HOLDER(S) OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "pcresp.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+/* Output files of the *write flag. The most recently used file
+ * is the first item of the list, and the last item is closed
+ * when the number of open files reaches the limit. The files are
+ * found by a hash table, which has a chain for each bucket. */
+
+#define WRITE_BUFFER_SIZE (16 * 1024)
+
+struct write_file {
+	struct write_file *next;
+	struct write_file *prev;
+	struct write_file *hash_next;
+	int fd;
+	uint32_t hash;
+	size_t used;
+	char *path;
+	char buffer[WRITE_BUFFER_SIZE];
+};
+
+static void write_all(write_file *file, const char *data, size_t length)
+{
+	ssize_t result;
+
+	if (file->fd < 0) {
+		return;
+	}
+
+	while (length > 0) {
+		result = write(file->fd, data, length);
+
+		if (result < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			fprintf(stderr, "Write error when processing '%s'\n", file->path);
+			close(file->fd);
+			file->fd = -1;
+			return;
+		}
+
+		data += result;
+		length -= (size_t)result;
+	}
+}
+
+static void flush_file(write_file *file)
+{
+	if (file->used > 0) {
+		write_all(file, file->buffer, file->used);
+		file->used = 0;
+	}
+}
+
+static void append_data(write_file *file, const char *data, size_t length)
+{
+	if (file->used + length > WRITE_BUFFER_SIZE) {
+		flush_file(file);
+
+		if (length > WRITE_BUFFER_SIZE) {
+			write_all(file, data, length);
+			return;
+		}
+	}
+
+	memcpy(file->buffer + file->used, data, length);
+	file->used += length;
+}
+
+static void unlink_file(pcresp_ctx *ctx, write_file *file)
+{
+	if (file->prev != NULL) {
+		file->prev->next = file->next;
+	}
+	else {
+		ctx->write_files = file->next;
+	}
+
+	if (file->next != NULL) {
+		file->next->prev = file->prev;
+	}
+	else {
+		ctx->write_files_last = file->prev;
+	}
+}
+
+static void close_file(write_file *file)
+{
+	flush_file(file);
+
+	if (file->fd >= 0) {
+		close(file->fd);
+	}
+	free(file->path);
+	free(file);
+}
+
+static int create_table(pcresp_ctx *ctx, int max_open_files)
+{
+	uint32_t size = 16;
+
+	/* At least twice as many buckets as files. */
+	while (size < (uint32_t)max_open_files * 2) {
+		size *= 2;
+	}
+
+	ctx->write_table = (write_file**)malloc(size * sizeof(write_file*));
+	if (ctx->write_table == NULL) {
+		fprintf(stderr, "Cannot allocate memory\n");
+		return 0;
+	}
+
+	memset(ctx->write_table, 0, size * sizeof(write_file*));
+	ctx->write_table_mask = size - 1;
+	return 1;
+}
+
+static void evict_file(pcresp_ctx *ctx, write_file *file)
+{
+	write_file **bucket = ctx->write_table + (file->hash & ctx->write_table_mask);
+
+	while (*bucket != file) {
+		bucket = &(*bucket)->hash_next;
+	}
+
+	*bucket = file->hash_next;
+	unlink_file(ctx, file);
+	close_file(file);
+	ctx->write_file_count--;
+}
+
+static write_file *open_file(pcresp_ctx *ctx, const char *path)
+{
+	uint32_t hash = hash_bytes(path, strlen(path));
+	int max_open_files = ctx->max_open_files > 0 ? ctx->max_open_files : 64;
+	write_file **bucket;
+	write_file *file;
+	int fd;
+
+	if (ctx->write_table == NULL && !create_table(ctx, max_open_files)) {
+		return NULL;
+	}
+
+	bucket = ctx->write_table + (hash & ctx->write_table_mask);
+	file = *bucket;
+
+	while (file != NULL) {
+		if (file->hash == hash && strcmp(file->path, path) == 0) {
+			if (file->prev != NULL) {
+				/* Move to the front. */
+				unlink_file(ctx, file);
+				file->prev = NULL;
+				file->next = ctx->write_files;
+				ctx->write_files->prev = file;
+				ctx->write_files = file;
+			}
+			return file;
+		}
+
+		file = file->hash_next;
+	}
+
+	if (ctx->write_file_count >= max_open_files) {
+		/* The least recently used file. */
+		evict_file(ctx, ctx->write_files_last);
+	}
+
+	/* Evicted files can be opened again, so the data is always
+	 * appended to the file. The scripts do not inherit the file. */
+	fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0666);
+
+	if (fd < 0) {
+		fprintf(stderr, "Cannot open file: %s\n", path);
+		return NULL;
+	}
+
+	file = (write_file*)malloc(sizeof(write_file));
+	if (file != NULL) {
+		file->path = (char*)malloc(strlen(path) + 1);
+		if (file->path == NULL) {
+			free(file);
+			file = NULL;
+		}
+	}
+
+	if (file == NULL) {
+		fprintf(stderr, "Cannot allocate memory\n");
+		close(fd);
+		return NULL;
+	}
+
+	strcpy(file->path, path);
+	file->fd = fd;
+	file->hash = hash;
+	file->used = 0;
+
+	file->hash_next = *bucket;
+	*bucket = file;
+
+	file->prev = NULL;
+	file->next = ctx->write_files;
+	if (ctx->write_files != NULL) {
+		ctx->write_files->prev = file;
+	}
+	else {
+		ctx->write_files_last = file;
+	}
+	ctx->write_files = file;
+	ctx->write_file_count++;
+	return file;
+}
+
+void write_to_file(pcresp_ctx *ctx, const char *path, char **args, int newline)
+{
+	write_file *file = open_file(ctx, path);
+	char **arg = args;
+
+	if (file == NULL || file->fd < 0) {
+		return;
+	}
+
+	while (*arg != NULL) {
+		if (arg != args) {
+			append_data(file, " ", 1);
+		}
+
+		append_data(file, *arg, strlen(*arg));
+		arg++;
+	}
+
+	if (newline) {
+		append_data(file, "\n", 1);
+	}
+}
+
+void close_write_files(pcresp_ctx *ctx)
+{
+	write_file *file = ctx->write_files;
+	write_file *next;
+
+	while (file != NULL) {
+		next = file->next;
+		close_file(file);
+		file = next;
+	}
+
+	if (ctx->write_table != NULL) {
+		free(ctx->write_table);
+	}
+
+	ctx->write_files = NULL;
+	ctx->write_files_last = NULL;
+	ctx->write_table = NULL;
+	ctx->write_file_count = 0;
+}
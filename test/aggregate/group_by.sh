@@ -0,0 +1,42 @@
+#!/bin/bash
+
+CWD=`pwd`
+if [ -f "../../bin/pcresp" ]; then
+    PATH="$CWD/../../bin":$PATH
+else
+  if [ -f "../bin/pcresp" ]; then
+      PATH="$CWD/../bin":$PATH
+  else
+      echo "Cannot find pcresp build directory"
+      exit
+  fi
+fi
+
+INPUT='GET /a 10
+POST /b 5
+GET /a 7
+GET /c 1
+POST /b x'
+
+echo "pcresp -m '^(\w+) (\S+) (\S+)$' --group-by '#1 #2' --sum '#3' --min '#3' --max '#3'"
+echo "$INPUT" | pcresp -m '^(\w+) (\S+) (\S+)$' --group-by '#1 #2' --sum '#3' --min '#3' --max '#3'
+echo
+
+echo "pcresp -m '^(\w+) (\S+) (\S+)$' --group-by '#1' --sort count"
+echo "$INPUT" | pcresp -m '^(\w+) (\S+) (\S+)$' --group-by '#1' --sort count
+echo
+
+echo "pcresp -m '^(\w+) (\S+) (\S+)$' --group-by '#2' --sum '#3' --sort sum"
+echo "$INPUT" | pcresp -m '^(\w+) (\S+) (\S+)$' --group-by '#2' --sum '#3' --sort sum
+echo
+
+echo "pcresp -m '^(\w+) (\S+)' --unique '#2'"
+echo "$INPUT" | pcresp -m '^(\w+) (\S+)' --unique '#2'
+echo
+
+# Errors
+echo "pcresp '.' --group-by '#a'"
+echo "$INPUT" | pcresp '.' --group-by '#a'
+echo "pcresp '.' --sum '#0'"
+echo "$INPUT" | pcresp '.' --sum '#0'
+echo
@@ -0,0 +1,52 @@
+#!/bin/bash
+
+CWD=`pwd`
+if [ -f "../../bin/pcresp" ]; then
+    PATH="$CWD/../../bin":$PATH
+else
+  if [ -f "../bin/pcresp" ]; then
+      PATH="$CWD/../bin":$PATH
+  else
+      echo "Cannot find pcresp build directory"
+      exit
+  fi
+fi
+
+DIR=`mktemp -d`
+trap 'rm -rf "$DIR"' EXIT
+cd "$DIR"
+
+# Key n appears about 2000/n times, and there are many rare keys,
+# which replace each other in the smallest counters.
+awk 'BEGIN { for (n = 1; n <= 400; n++) for (i = 0; i < 2000 / n; i++) print "ip" n " user" (i % 50) }' > access.log
+
+echo "pcresp '(\w+) (\w+)' --top-k 5 '#1' --distinct '#2'"
+pcresp '(\w+) (\w+)' --top-k 5 '#1' --distinct '#2' access.log
+echo
+
+echo "pcresp '(\w+) (\w+)' --group-by '#1' --sort count | head -5"
+pcresp '(\w+) (\w+)' --group-by '#1' --sort count access.log | head -5
+echo
+
+echo "pcresp '(\w+) (\w+)' --distinct '#1'"
+pcresp '(\w+) (\w+)' --distinct '#1' access.log
+echo
+
+echo "pcresp '^ip(1|2)\b' -m --top-k 2 'ip#1' --report-every 1200"
+pcresp '^ip(1|2)\b' -m --top-k 2 'ip#1' --report-every 1200 access.log
+echo
+
+# Scripts are executed as well.
+echo "printf 'a\nb\na\n' | pcresp '\w' --top-k 1 '#0' -s '*print #0'"
+printf 'a\nb\na\n' | pcresp '\w' --top-k 1 '#0' -s '*print #0'
+echo
+
+echo "pcresp 'x' --top-k 3 '#0' --group-by '#0'"
+pcresp 'x' --top-k 3 '#0' --group-by '#0' access.log
+echo "status: $?"
+echo "pcresp 'x' --report-every 3"
+pcresp 'x' --report-every 3 access.log
+echo "status: $?"
+echo "pcresp 'x' --top-k 0 '#0'"
+pcresp 'x' --top-k 0 '#0' access.log
+echo "status: $?"
@@ -0,0 +1,55 @@
+#!/bin/bash
+
+# Benchmark workloads used for training the profile guided optimization
+# of 'make release' and for comparing the speed of two builds.
+#
+# Usage: benchmark.sh pcresp_binary [repeat]
+#   Runs each workload repeat times (default: 1), and prints
+#   the total elapsed time in seconds.
+
+if [ ! -x "$1" ]; then
+    echo "Usage: benchmark.sh pcresp_binary [repeat]"
+    exit 2
+fi
+
+PCRESP="$1"
+REPEAT="${2:-1}"
+
+DIR=`mktemp -d`
+trap 'rm -rf "$DIR"' EXIT
+
+# Deterministic access log like input (about 16 MiB).
+awk 'BEGIN {
+    split("GET POST PUT DELETE HEAD", method, " ")
+    split("200 200 200 304 404 500", status, " ")
+    seed = 1
+    for (i = 0; i < 200000; i++) {
+        seed = (seed * 1103515245 + 12345) % 2147483648
+        printf "10.%d.%d.%d - user%d [19/Oct/2026:%02d:%02d:%02d] \"%s /item/%d?id=%d HTTP/1.1\" %s %d \"agent-%d\"\n", \
+            seed % 256, int(seed / 256) % 256, int(seed / 65536) % 256, seed % 97, \
+            int(i / 3600) % 24, int(i / 60) % 60, i % 60, method[seed % 5 + 1], \
+            seed % 5000, seed % 100000, status[seed % 6 + 1], seed % 65536, seed % 13
+    }
+}' > "$DIR/access.log"
+
+printf 'DELETE\n/item/42?\nagent-7\nuser13 \n' > "$DIR/keywords.txt"
+
+run_workloads()
+{
+    "$PCRESP" '" (\d{3}) ' "$DIR/access.log"
+    "$PCRESP" -p 'user(\d+)' -s '*print <[#1]>' "$DIR/access.log"
+    "$PCRESP" '^(\S+) .*?"(\w+) (\S+)' -m -s '*print #2 #3 from #1' "$DIR/access.log"
+    "$PCRESP" '"(\w+) /item/(\d+)' --group-by '#1' --sum '#2' --sort count "$DIR/access.log"
+    "$PCRESP" '(?<method>GET|POST) (?<path>\S+)' --format jsonl "$DIR/access.log"
+    "$PCRESP" -f "$DIR/keywords.txt" "$DIR/access.log"
+    "$PCRESP" -i 'agent-1[0-2]|delete' --engine dfa "$DIR/access.log"
+    "$PCRESP" -u '\[(\d+)/(\w+)/(\d+):' -s '*print #3-#2-#1' "$DIR/access.log"
+}
+
+START=`date +%s.%N`
+for (( i = 0; i < REPEAT; i++ )); do
+    run_workloads > /dev/null
+done
+END=`date +%s.%N`
+
+awk -v start="$START" -v end="$END" 'BEGIN { printf "%.3f\n", end - start }'
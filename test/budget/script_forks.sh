@@ -0,0 +1,19 @@
+#!/bin/bash
+
+CWD=`pwd`
+if [ -f "../../bin/pcresp" ]; then
+    PATH="$CWD/../../bin":$PATH
+else
+  if [ -f "../bin/pcresp" ]; then
+      PATH="$CWD/../bin":$PATH
+  else
+      echo "Cannot find pcresp build directory"
+      exit
+  fi
+fi
+
+# *print does not start processes, and *batch starts one per batch.
+echo "seq 1 1000 | pcresp '\d+' -s '*print n: #0' | tail -1"
+seq 1 1000 | pcresp '\d+' -s '*print n: #0' | tail -1
+echo "seq 1 1000 | pcresp '\d+' -s '*batch:100 /bin/true'"
+seq 1 1000 | pcresp '\d+' -s '*batch:100 /bin/true'
@@ -0,0 +1,17 @@
+#!/bin/bash
+
+CWD=`pwd`
+if [ -f "../../bin/pcresp" ]; then
+    PATH="$CWD/../../bin":$PATH
+else
+  if [ -f "../bin/pcresp" ]; then
+      PATH="$CWD/../bin":$PATH
+  else
+      echo "Cannot find pcresp build directory"
+      exit
+  fi
+fi
+
+# Input read from a pipe (32 MiB) is buffered in memory once.
+echo "yes 0123456789abcdef0123456789abcde | head -c 33554432 | pcresp --limit 2 '\w+'"
+yes 0123456789abcdef0123456789abcde | head -c 33554432 | pcresp --limit 2 '\w+'
@@ -0,0 +1,56 @@
+#!/bin/bash
+
+CWD=`pwd`
+if [ -f "../../bin/pcresp" ]; then
+    PATH="$CWD/../../bin":$PATH
+else
+  if [ -f "../bin/pcresp" ]; then
+      PATH="$CWD/../bin":$PATH
+  else
+      echo "Cannot find pcresp build directory"
+      exit
+  fi
+fi
+
+DIR=`mktemp -d`
+printf 'a1 b22 c333\n' > $DIR/input1
+printf 'none\n' > $DIR/input2
+
+echo "pcresp --cache-dir cache '(\\w)(\\d+)' -s '*print #1 #2' input1 input2"
+pcresp --cache-dir $DIR/cache '(\w)(\d+)' -s '*print #1 #2' $DIR/input1 $DIR/input2
+echo
+
+echo "(replayed from the cache)"
+pcresp --verbose --cache-dir $DIR/cache '(\w)(\d+)' -s '*print #1 #2' $DIR/input1 $DIR/input2 2>$DIR/log | grep -v Verbose
+grep cached $DIR/log
+echo
+
+echo "(different pattern)"
+pcresp --verbose --cache-dir $DIR/cache '(\w)(\d)' -s '*print #1 #2' $DIR/input1 $DIR/input2 2>$DIR/log | grep -v Verbose
+grep cached $DIR/log
+echo
+
+echo "(modified input)"
+printf 'd4444\n' > $DIR/input1
+touch -d '2000-01-01' $DIR/input1
+pcresp --verbose --cache-dir $DIR/cache '(\w)(\d+)' -s '*print #1 #2' $DIR/input1 $DIR/input2 2>$DIR/log | grep -v Verbose
+grep cached $DIR/log
+echo
+
+echo "pcresp --cache-dir cache --cache-size 1 'x' input1 input2"
+pcresp --cache-dir $DIR/cache --cache-size 1 'x' $DIR/input1 $DIR/input2
+ls $DIR/cache | wc -l
+
+echo
+
+# Callout scripts are not run by replayed matches.
+printf '29 30 31\n' > $DIR/input3
+echo "pcresp --cache-dir cache '(\\d+)(?C^ *print callout #1 ^)' input3"
+pcresp --cache-dir $DIR/cache '(\d+)(?C^ *print callout #1 ^)' $DIR/input3
+echo "status: $?"
+echo "(run again)"
+pcresp --cache-dir $DIR/cache '(\d+)(?C^ *print callout #1 ^)' $DIR/input3
+echo "status: $?"
+pcresp --verbose --cache-dir $DIR/cache '(\d+)(?C^ *print callout #1 ^)' $DIR/input3 2>&1 >/dev/null | grep 'cache'
+
+rm -rf $DIR
@@ -0,0 +1,58 @@
+#!/bin/bash
+
+CWD=`pwd`
+if [ -f "../../bin/pcresp" ]; then
+    PATH="$CWD/../../bin":$PATH
+else
+  if [ -f "../bin/pcresp" ]; then
+      PATH="$CWD/../bin":$PATH
+  else
+      echo "Cannot find pcresp build directory"
+      exit
+  fi
+fi
+
+DIR=`mktemp -d`
+trap 'rm -rf "$DIR"' EXIT
+cd "$DIR"
+
+seq 1 200000 > numbers.txt
+printf 'a1\n' > small.txt
+
+# The processing stops on EPIPE instead of being killed by SIGPIPE.
+echo "pcresp '\d+' numbers.txt | head -2"
+pcresp '\d+' numbers.txt | head -2
+echo "status: ${PIPESTATUS[0]}"
+echo "pcresp '\d+' -s '*print n=#0' numbers.txt | head -2"
+pcresp '\d+' -s '*print n=#0' numbers.txt | head -2
+echo "status: ${PIPESTATUS[0]}"
+echo
+
+# The files after the total limit are not opened.
+echo "pcresp --total-limit 3 '\d+' numbers.txt missing.txt"
+pcresp --total-limit 3 '\d+' numbers.txt missing.txt
+echo "status: $?"
+echo "pcresp --total-limit 2 -p '\d' small.txt small.txt small.txt"
+pcresp --total-limit 2 -p '\d' small.txt small.txt small.txt
+echo
+
+# The limit applies to each input.
+echo "pcresp --limit 2 '\d+' numbers.txt small.txt numbers.txt"
+pcresp --limit 2 '\d+' numbers.txt small.txt numbers.txt
+echo "status: $?"
+echo "pcresp --limit 1 --total-limit 2 '\d+' numbers.txt small.txt numbers.txt"
+pcresp --limit 1 --total-limit 2 '\d+' numbers.txt small.txt numbers.txt
+echo "status: $?"
+echo
+
+# SIGTERM stops reading the input.
+echo "pcresp '\d+' < fifo & kill -TERM"
+mkfifo fifo
+exec 3<>fifo
+pcresp '\d+' < fifo &
+PID=$!
+sleep 0.2
+kill -TERM $PID
+wait $PID
+echo "status: $?"
+exec 3>&-
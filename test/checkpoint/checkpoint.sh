@@ -0,0 +1,48 @@
+#!/bin/bash
+
+CWD=`pwd`
+if [ -f "../../bin/pcresp" ]; then
+    PATH="$CWD/../../bin":$PATH
+else
+  if [ -f "../bin/pcresp" ]; then
+      PATH="$CWD/../bin":$PATH
+  else
+      echo "Cannot find pcresp build directory"
+      exit
+  fi
+fi
+
+DIR=`mktemp -d`
+printf 'a1\nb2\nc' > $DIR/log
+
+echo "printf 'a1\\nb2\\nc' > log; pcresp --checkpoint state '\\w\\d' log"
+pcresp --checkpoint $DIR/state '\w\d' $DIR/log
+cut -d ' ' -f 2 $DIR/state
+echo
+
+echo "printf '3\\nd4\\n' >> log; pcresp --format tsv --checkpoint state '\\w\\d' log"
+printf '3\nd4\n' >> $DIR/log
+pcresp --format tsv --checkpoint $DIR/state '\w\d' $DIR/log | cut -f 2-
+cut -d ' ' -f 2 $DIR/state
+echo
+
+echo "pcresp --checkpoint state '\\w\\d' log (no new data)"
+pcresp --checkpoint $DIR/state '\w\d' $DIR/log
+cut -d ' ' -f 2 $DIR/state
+echo
+
+echo "printf 'x9\\n' > log; pcresp --checkpoint state '\\w\\d' log (truncated)"
+printf 'x9\n' > $DIR/log
+pcresp --checkpoint $DIR/state '\w\d' $DIR/log
+cut -d ' ' -f 2 $DIR/state
+echo
+
+# Long *print outputs are written by writev, bypassing the stream.
+echo "pcresp --checkpoint full '(.+)' -s '*print #1' long > /dev/full"
+head -c 20000 /dev/zero | tr '\0' 'a' > $DIR/long
+echo >> $DIR/long
+pcresp --checkpoint $DIR/full '(.+)' -s '*print #1' $DIR/long 2>&1 > /dev/full
+echo "status: $?"
+test -f $DIR/full || echo "no checkpoint"
+
+rm -rf $DIR
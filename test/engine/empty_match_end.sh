@@ -0,0 +1,24 @@
+#!/bin/bash
+
+CWD=`pwd`
+if [ -f "../../bin/pcresp" ]; then
+    PATH="$CWD/../../bin":$PATH
+else
+  if [ -f "../bin/pcresp" ]; then
+      PATH="$CWD/../bin":$PATH
+  else
+      echo "Cannot find pcresp build directory"
+      exit
+  fi
+fi
+
+# An empty match at the end of the subject ends the matching, and no
+# further match is attempted after the end.
+for ENGINE in backtrack dfa auto; do
+    echo "printf 'abc' | pcresp --engine $ENGINE -s '*print [#^0]' 'x?'"
+    printf 'abc' | pcresp --engine $ENGINE -s '*print [#^0]' 'x?' 2>&1
+    echo "status: $?"
+    echo "printf 'ab\n' | pcresp --engine $ENGINE -s '*print [#^0]' '$'"
+    printf 'ab\n' | pcresp --engine $ENGINE -s '*print [#^0]' '$' 2>&1
+    echo "status: $?"
+done
@@ -0,0 +1,44 @@
+#!/bin/bash
+
+CWD=`pwd`
+if [ -f "../../bin/pcresp" ]; then
+    PATH="$CWD/../../bin":$PATH
+else
+  if [ -f "../bin/pcresp" ]; then
+      PATH="$CWD/../bin":$PATH
+  else
+      echo "Cannot find pcresp build directory"
+      exit
+  fi
+fi
+
+# A long run of 'a' characters before the match makes the backtracking
+# engine reach its match limit at the first offset.
+INPUT="`printf 'a%.0s' $(seq 1 40)`!x"
+PATTERN='(a+)+[bc]|(?=!)!x'
+
+for ENGINE in backtrack dfa auto; do
+    echo "echo a...a!x | pcresp --engine $ENGINE -s '*print [#0] [#1]' '$PATTERN'"
+    echo "$INPUT" | pcresp --engine $ENGINE -s '*print [#0] [#1]' "$PATTERN" 2>&1
+    echo "status: $?"
+done
+
+# The limits of the backtracking engine do not apply to the fallback.
+for LIMIT in 1 50; do
+    echo "echo a...a!x | pcresp --engine auto --match-limit $LIMIT -s '*print [#0] [#1]' '$PATTERN'"
+    echo "$INPUT" | pcresp --engine auto --match-limit $LIMIT -s '*print [#0] [#1]' "$PATTERN" 2>&1
+    echo "status: $?"
+done
+
+# The limits apply to the DFA engine when it is selected.
+echo "echo a...a!x | pcresp --engine dfa --match-limit 50 '$PATTERN'"
+echo "$INPUT" | pcresp --engine dfa --match-limit 50 "$PATTERN" 2>&1
+echo "status: $?"
+
+echo "echo a...a!x | pcresp --engine auto --verbose '$PATTERN' | grep DFA"
+echo "$INPUT" | pcresp --engine auto --verbose "$PATTERN" 2>&1 | grep DFA
+
+# Captures are set by the backtracking engine when the limit is not reached.
+echo "echo 'aab' | pcresp --engine auto -s '*print [#0] [#1]' '$PATTERN'"
+echo 'aab' | pcresp --engine auto -s '*print [#0] [#1]' "$PATTERN"
+echo "status: $?"
@@ -0,0 +1,34 @@
+#!/bin/bash
+
+CWD=`pwd`
+if [ -f "../../bin/pcresp" ]; then
+    PATH="$CWD/../../bin":$PATH
+else
+  if [ -f "../bin/pcresp" ]; then
+      PATH="$CWD/../bin":$PATH
+  else
+      echo "Cannot find pcresp build directory"
+      exit
+  fi
+fi
+
+echo "printf 'k=v\\\\1\\tx \"q\"\\n' | pcresp --format jsonl '(?<key>\\w+)=(\\S+)(z)?'"
+printf 'k=v\\1\tx "q"\n' | pcresp --format jsonl '(?<key>\w+)=(\S+)(z)?'
+echo
+
+echo "printf 'a\\001b\\n' | pcresp --format jsonl '(*MARK:M)a.b'"
+printf 'a\001b\n' | pcresp --format jsonl '(*MARK:M)a.b'
+echo
+
+# Invalid UTF-8 bytes are replaced, valid characters are kept.
+echo "printf 'a\\xff\\xfeb \\xc3\\xa9\\xe2\\x82\\n' | pcresp --format jsonl '\\S+'"
+printf 'a\xff\xfeb \xc3\xa9\xe2\x82\n' | pcresp --format jsonl '\S+'
+echo
+
+echo "printf 'k=v\\\\1\\tx\\n' | pcresp --format tsv '(\\w+)=(\\S+)(z)?'"
+printf 'k=v\\1\tx\n' | pcresp --format tsv '(\w+)=(\S+)(z)?'
+echo
+
+echo "printf 'ab cd' | pcresp --format nul '(\\w)\\w' | tr '\\0' '|'"
+printf 'ab cd' | pcresp --format nul '(\w)\w' | tr '\0' '|'
+echo
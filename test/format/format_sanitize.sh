@@ -0,0 +1,46 @@
+#!/bin/bash
+
+# Runs formats and aggregates with a sanitizer build, which aborts
+# on the first invalid memory access or undefined behavior.
+
+CWD=`pwd`
+if [ -f "../../Makefile" ]; then
+    ROOT="$CWD/../.."
+else
+  if [ -f "../Makefile" ]; then
+      ROOT="$CWD/.."
+  else
+      echo "Cannot find pcresp source directory"
+      exit
+  fi
+fi
+
+# The sanitizer build is made by 'make check'.
+if [ ! -x "$ROOT/bin/sanitize/pcresp" ]; then
+    echo "bin/sanitize/pcresp is not built, run 'make sanitize' or 'make check'"
+    exit 77
+fi
+PATH="$ROOT/bin/sanitize":$PATH
+
+DIR=`mktemp -d`
+trap 'rm -rf "$DIR"' EXIT
+cd "$DIR"
+
+# Unset captures and empty keys are appended as empty strings.
+echo "printf 'ab cd' | pcresp --format nul '(\w)(z)?\w' | tr '\0' '|'"
+printf 'ab cd' | pcresp --format nul '(\w)(z)?\w' > out.txt
+echo "status: $?"
+tr '\0' '|' < out.txt
+echo
+
+echo "printf 'ab cd' | pcresp --format tsv '(\w)(z)?\w'"
+printf 'ab cd' | pcresp --format tsv '(\w)(z)?\w'
+echo "status: $?"
+
+echo "printf 'a1\nb\nc2\n' | pcresp -m '^\w(\d)?' --group-by '#1'"
+printf 'a1\nb\nc2\n' | pcresp -m '^\w(\d)?' --group-by '#1'
+echo "status: $?"
+
+echo "printf 'a1\nb\nc2\nd\n' | pcresp -m '^\w(\d)?' --unique '#1'"
+printf 'a1\nb\nc2\nd\n' | pcresp -m '^\w(\d)?' --unique '#1'
+echo "status: $?"
@@ -0,0 +1,1153 @@
+/*
+ *    Stream processing tool
+ *
+ *    Copyright 2016 Zoltan Herczeg (hzmester@freemail.hu). All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are
+ * permitted provided that the following conditions are met:
+ *
+ *   1. Redistributions of source code must retain the above copyright notice, this list of
+ *      conditions and the following disclaimer.
+ *
+ *   2. Redistributions in binary form must reproduce the above copyright notice, this list
+ *      of conditions and the following disclaimer in the documentation and/or other materials
+ *      provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDER(S) AND CONTRIBUTORS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT
+ * SHALL THE COPYRIGHT HOLDER(S) OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* Differential fuzz target of the optimized paths.
+ *
+ * Each input is decoded into a random configuration: a pattern (or a
+ * list of fixed strings) with optional *print callouts, a script built
+ * from the # sequences and the *flags, or aggregates, sketches and
+ * formats, an optional second stage and an input split into files,
+ * which is sometimes larger than a chunk of the streaming stages. The
+ * configuration is executed with the optimized paths (JIT, mapped files
+ * with zero-copy passthrough, the *print template, pipeline, streaming
+ * stages, match cache and the fixed string matcher), and with the
+ * reference paths (interpreter, files read by stdio, run_script, no
+ * cache, the whole output matched by the next stage and regular
+ * expressions instead of fixed strings). Patterns with callouts use
+ * the same matcher on both paths. The outputs and the exit statuses
+ * must be identical.
+ *
+ * Built by 'make fuzz': a libFuzzer target when clang is available,
+ * otherwise a standalone driver:
+ *
+ *   differential [-seed=n] [-runs=n] [file...]
+ *
+ * which replays the files, or runs random inputs when no files are
+ * specified. The input of a failing run is saved to the current
+ * directory as differential-<seed>-<run>.bin. */
+
+#include "pcresp.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define MAX_FILES 3
+#define MAX_DEPTH 2
+
+#define MODE_DEFAULT 0
+#define MODE_SCRIPT 1
+#define MODE_FORMAT 2
+#define MODE_AGGREGATE 3
+#define MODE_SKETCH 4
+
+#define LOAD_STREAM 0
+#define LOAD_FILE 1
+#define LOAD_FILES 2
+#define LOAD_FD 3
+
+/* Position sequences allowed in scripts and templates. */
+#define POSITIONS_NONE 0
+#define POSITIONS_LINES 1
+#define POSITIONS_ALL 2
+
+/* Size of the chunks of streaming stages (STAGE_CHUNK_SIZE). */
+#define CHUNK_SIZE (256 * 1024)
+
+typedef struct fuzz_input {
+	const uint8_t *data;
+	size_t size;
+} fuzz_input;
+
+typedef struct stage_spec {
+	string_buffer pattern;
+	/* Regular expression matching the same as the fixed strings. */
+	string_buffer reference_pattern;
+	string_buffer script;
+	string_buffer templates[2];
+	int keywords;
+	uint32_t options;
+	uint32_t capture_count;
+	int mode;
+	int aggregate_types[2];
+	int sort;
+	int format;
+	size_t top_k;
+	uint64_t report_every;
+	int print_text;
+	int line_number;
+	int limit;
+} stage_spec;
+
+typedef struct fuzz_case {
+	stage_spec stages[2];
+	int stage_count;
+	string_buffer input;
+	size_t repeat;
+	size_t file_sizes[MAX_FILES];
+	int file_count;
+	/* Optimized paths. */
+	int jit;
+	int engine;
+	int load;
+	int hugepages;
+	int cache;
+} fuzz_case;
+
+typedef struct run_result {
+	string_buffer output;
+	int status;
+} run_result;
+
+typedef struct pattern_state {
+	fuzz_input *input;
+	string_buffer *pattern;
+	uint32_t capture_count;
+	/* Backreferences can refer to the groups after this one. */
+	uint32_t backref_base;
+	/* Unbounded quantifiers left, which limits the backtracking. */
+	int unbounded;
+	/* Callouts left. */
+	int callouts;
+	/* The pattern of a streaming stage cannot match newlines and
+	 * empty strings, and has no anchors, since the chunks are matched
+	 * separately. */
+	int line_safe;
+} pattern_state;
+
+/* The first LINE_SAFE_ATOMS atoms match a single non-newline character,
+ * and the first QUANTIFIED_ATOMS atoms can be quantified. */
+static const char *const atoms[] = {
+	"a", "b", "c", "A", "1", "-", "=", "%", " ", "\\d", "\\w", "[a-c]", "[0-9A-F]", ".", "\\x{e9}",
+	"\\n", "\\s", "\\W", "[^b]", "\\R",
+	"^", "$", "\\b", "\\B", "\\A", "\\z", "(*MARK:m)", "(*MARK:n)", "(?<=a)", "(?!b)",
+};
+
+#define ATOM_COUNT (sizeof(atoms) / sizeof(atoms[0]))
+#define LINE_SAFE_ATOMS 15
+#define QUANTIFIED_ATOMS 20
+
+static const char *const quantifiers[] = {
+	"", "", "", "?", "{1,3}", "{2}", "??", "?+", "*", "+", "*?", "+?", "*+",
+};
+
+#define QUANTIFIER_COUNT (sizeof(quantifiers) / sizeof(quantifiers[0]))
+#define BOUNDED_QUANTIFIERS 8
+
+static const char *const transform_list[] = {
+	"upper", "lower", "hex", "urldecode", "trim",
+};
+
+static const char *const literals[] = {
+	"x", "ab", "=", "-", "[", "]", ":", "%41",
+};
+
+static const char *const input_words[] = {
+	"a", "b", "c", "ab", "abc", "A", "B", "1", "42", "-", "=", "%41", "%zz", "+", " ", "  ",
+	"\t", "\n", "\n", "\r\n", "x=1&y=%20b", "GET /a?b=1", "\xc3\xa9", "#", "<>", "AbC",
+};
+
+static const char keyword_chars[] = "abcAB-1";
+
+static char work_dir[] = "/tmp/pcresp-fuzz-XXXXXX";
+static int work_dir_created;
+
+/* Returns with a number between 0 and limit - 1. The missing bytes of
+ * short inputs are zero, which selects the simplest choices. */
+static unsigned choose(fuzz_input *input, unsigned limit)
+{
+	unsigned value = 0;
+
+	if (input->size > 0) {
+		value = *input->data++;
+		input->size--;
+	}
+	return value % limit;
+}
+
+/* Returns with non-zero for one of limit values. */
+static int rarely(fuzz_input *input, unsigned limit)
+{
+	return choose(input, limit) == limit - 1;
+}
+
+static void append(string_buffer *buffer, const char *str)
+{
+	if (!buffer_append(buffer, str, strlen(str))) {
+		abort();
+	}
+}
+
+static void append_number(string_buffer *buffer, const char *format, unsigned value)
+{
+	char number[32];
+
+	snprintf(number, sizeof(number), format, value);
+	append(buffer, number);
+}
+
+/* Terminates the string without changing its length. */
+static void terminate(string_buffer *buffer)
+{
+	if (!buffer_append(buffer, "", 1)) {
+		abort();
+	}
+	buffer->length--;
+}
+
+static void generate_alternation(pattern_state *state, int depth);
+static void generate_piece(fuzz_input *input, string_buffer *dst, uint32_t capture_count, int positions);
+
+/* Callout with a *print script. The callouts are not replayed
+ * from the match cache, and cannot use #L and #C. */
+static void generate_callout(pattern_state *state)
+{
+	unsigned pieces = 1 + choose(state->input, 2);
+
+	append(state->pattern, "(?C`*print callout");
+	while (pieces-- > 0) {
+		append(state->pattern, " ");
+		generate_piece(state->input, state->pattern, state->capture_count, POSITIONS_NONE);
+	}
+	append(state->pattern, "`)");
+}
+
+static void generate_item(pattern_state *state, int depth)
+{
+	fuzz_input *input = state->input;
+	unsigned kind = choose(input, depth < MAX_DEPTH ? 11 : 8);
+	const char *quantifier;
+	unsigned atom, type;
+
+	if (kind == 10) {
+		if (state->callouts > 0) {
+			state->callouts--;
+			generate_callout(state);
+			return;
+		}
+		kind = 0;
+	}
+
+	if (kind < 7) {
+		atom = choose(input, state->line_safe ? LINE_SAFE_ATOMS : ATOM_COUNT);
+		append(state->pattern, atoms[atom]);
+		if (atom >= QUANTIFIED_ATOMS) {
+			return;
+		}
+	}
+	else if (kind == 7) {
+		if (state->capture_count == state->backref_base) {
+			append(state->pattern, "c");
+		}
+		else {
+			append_number(state->pattern, "\\g{%u}", state->backref_base + 1
+				+ choose(input, state->capture_count - state->backref_base));
+		}
+	}
+	else {
+		type = choose(input, state->line_safe ? 4 : 6);
+		switch (type) {
+		case 0:
+			append(state->pattern, "(");
+			state->capture_count++;
+			break;
+		case 1:
+			state->capture_count++;
+			append_number(state->pattern, "(?<g%u>", state->capture_count);
+			break;
+		case 2:
+			append(state->pattern, "(?:");
+			break;
+		case 3:
+			append(state->pattern, "(?>");
+			break;
+		case 4:
+			append(state->pattern, "(?=");
+			break;
+		default:
+			append(state->pattern, "(?<!");
+			break;
+		}
+
+		if (type >= 4) {
+			/* Lookbehinds must have fixed length. */
+			append(state->pattern, atoms[choose(input, LINE_SAFE_ATOMS)]);
+			append(state->pattern, ")");
+			return;
+		}
+
+		generate_alternation(state, depth + 1);
+		append(state->pattern, ")");
+	}
+
+	quantifier = quantifiers[choose(input, QUANTIFIER_COUNT)];
+	if (quantifier[0] == '*' || quantifier[0] == '+') {
+		if (state->unbounded == 0) {
+			quantifier = quantifiers[choose(input, BOUNDED_QUANTIFIERS)];
+		}
+		else {
+			state->unbounded--;
+		}
+	}
+	append(state->pattern, quantifier);
+}
+
+static void generate_alternation(pattern_state *state, int depth)
+{
+	unsigned count = 1 + choose(state->input, depth == 0 ? 4 : 3);
+	uint32_t base;
+
+	while (count-- > 0) {
+		generate_item(state, depth);
+	}
+
+	if (depth < MAX_DEPTH && rarely(state->input, 4)) {
+		/* The JIT compiler of pcre2 10.42 may keep the captures of a
+		 * failed alternative (e.g. c()*+\d|\1), so the alternatives
+		 * only refer to their own groups. */
+		base = state->backref_base;
+		state->backref_base = state->capture_count;
+		append(state->pattern, "|");
+		generate_alternation(state, MAX_DEPTH);
+		state->backref_base = base;
+	}
+}
+
+static void generate_pattern(fuzz_input *input, stage_spec *stage, int line_safe, int bounded)
+{
+	pattern_state state;
+
+	state.input = input;
+	state.pattern = &stage->pattern;
+	state.capture_count = 0;
+	state.backref_base = 0;
+	state.unbounded = bounded ? 0 : 2;
+	/* The matches of the chunks of streaming stages are the same, but
+	 * the start optimizations of pcre2 (e.g. the search of a required
+	 * character) may try different positions, so the callouts differ. */
+	state.callouts = line_safe ? 0 : 2;
+	state.line_safe = line_safe;
+
+	if (line_safe) {
+		/* The first character is mandatory, so empty strings are not matched. */
+		append(&stage->pattern, atoms[choose(input, LINE_SAFE_ATOMS)]);
+		generate_item(&state, 0);
+	}
+	else {
+		generate_alternation(&state, 0);
+	}
+
+	terminate(&stage->pattern);
+	stage->capture_count = state.capture_count;
+}
+
+/* The leftmost longest keyword is matched by an alternation
+ * of the keywords ordered by decreasing length. */
+static void generate_keywords(fuzz_input *input, stage_spec *stage)
+{
+	char keywords[4][4];
+	unsigned count = 1 + choose(input, 4);
+	unsigned i, j, length;
+
+	for (i = 0; i < count; i++) {
+		length = 1 + choose(input, 3);
+		for (j = 0; j < length; j++) {
+			keywords[i][j] = keyword_chars[choose(input, sizeof(keyword_chars) - 1)];
+		}
+		keywords[i][length] = '\0';
+
+		if (i > 0) {
+			append(&stage->pattern, "\n");
+		}
+		append(&stage->pattern, keywords[i]);
+	}
+
+	for (length = 3; length > 0; length--) {
+		for (i = 0; i < count; i++) {
+			if (strlen(keywords[i]) != length) {
+				continue;
+			}
+
+			if (stage->reference_pattern.length > 0) {
+				append(&stage->reference_pattern, "|");
+			}
+			append(&stage->reference_pattern, "\\Q");
+			append(&stage->reference_pattern, keywords[i]);
+			append(&stage->reference_pattern, "\\E");
+		}
+	}
+
+	terminate(&stage->pattern);
+	terminate(&stage->reference_pattern);
+	stage->keywords = 1;
+	stage->capture_count = 0;
+}
+
+/* Appends a # sequence or a literal. The offsets depend on the chunks
+ * of streaming stages, while the chunks contain complete lines, so the
+ * line numbers and columns do not. */
+static void generate_piece(fuzz_input *input, string_buffer *dst, uint32_t capture_count, int positions)
+{
+	unsigned capture_id = choose(input, capture_count + 1);
+	unsigned kind = choose(input, 18);
+
+	if ((positions < POSITIONS_ALL && kind >= 8 && kind <= 9)
+			|| (positions == POSITIONS_NONE && kind >= 10 && kind <= 11)) {
+		kind = 17;
+	}
+
+	switch (kind) {
+	case 0:
+		append_number(dst, "#%u", capture_id);
+		break;
+	case 1:
+		append_number(dst, "#{%u}", capture_id);
+		break;
+	case 2:
+		append_number(dst, "#{%u,d}", capture_id);
+		break;
+	case 3:
+	case 4:
+		append_number(dst, "#{%u", capture_id);
+		append(dst, ":");
+		append(dst, transform_list[choose(input, 5)]);
+		if (choose(input, 2)) {
+			append(dst, ":");
+			append(dst, transform_list[choose(input, 5)]);
+		}
+		append(dst, kind == 3 ? "}" : ",d}");
+		break;
+	case 5:
+		append(dst, "#[d]");
+		break;
+	case 6:
+		append(dst, "#M");
+		break;
+	case 7:
+		append(dst, "##");
+		break;
+	case 8:
+		append_number(dst, "#^%u", capture_id);
+		break;
+	case 9:
+		append_number(dst, "#${%u}", capture_id);
+		break;
+	case 10:
+		append(dst, "#L");
+		break;
+	case 11:
+		append(dst, "#C");
+		break;
+	case 12:
+		append(dst, "#<");
+		break;
+	case 13:
+		append(dst, "#>");
+		break;
+	case 14:
+		append(dst, "#n");
+		break;
+	default:
+		append(dst, literals[choose(input, sizeof(literals) / sizeof(literals[0]))]);
+		break;
+	}
+}
+
+static void generate_template(fuzz_input *input, string_buffer *dst, uint32_t capture_count, int positions)
+{
+	unsigned count = 1 + choose(input, 2);
+
+	while (count-- > 0) {
+		generate_piece(input, dst, capture_count, positions);
+	}
+	terminate(dst);
+}
+
+/* External programs are only executed for small inputs. */
+static void generate_script(fuzz_input *input, stage_spec *stage, int external, int positions)
+{
+	string_buffer *dst = &stage->script;
+	unsigned flags = choose(input, external ? 8 : 6);
+	unsigned count, pieces;
+
+	if (flags < 5) {
+		append(dst, "*print ");
+	}
+	else if (flags == 5) {
+		append(dst, "*print *!nl ");
+	}
+	else if (flags == 6) {
+		append_number(dst, "*batch:%u /bin/echo ", 1 + choose(input, 3));
+	}
+	else {
+		append(dst, "/bin/echo ");
+	}
+
+	count = 1 + choose(input, 3);
+	while (count-- > 0) {
+		if (rarely(input, 4)) {
+			append(dst, "<");
+			pieces = 1 + choose(input, 3);
+			while (pieces-- > 0) {
+				generate_piece(input, dst, stage->capture_count, positions);
+				if (rarely(input, 2)) {
+					append(dst, " ");
+				}
+			}
+			append(dst, ">");
+		}
+		else {
+			pieces = 1 + choose(input, 2);
+			while (pieces-- > 0) {
+				generate_piece(input, dst, stage->capture_count, positions);
+			}
+		}
+		append(dst, count > 0 ? " " : "");
+	}
+	terminate(dst);
+}
+
+static void generate_stage(fuzz_input *input, stage_spec *stage, int is_first, int external, int bounded)
+{
+	static const int aggregate_types[] = { PCRESP_SUM, PCRESP_MIN, PCRESP_MAX };
+	static const int sort_orders[] = { PCRESP_SORT_SUM, PCRESP_SORT_MIN, PCRESP_SORT_MAX };
+	int positions = is_first ? POSITIONS_ALL : POSITIONS_LINES;
+	unsigned options, type;
+
+	/* The second stage is streamed, so its matches must
+	 * be the same when the output is split into chunks. */
+	if (is_first && rarely(input, 4)) {
+		generate_keywords(input, stage);
+		stage->options = choose(input, 2) ? PCRESP_CASELESS : 0;
+	}
+	else {
+		generate_pattern(input, stage, !is_first, bounded);
+		options = choose(input, 32);
+		stage->options = (options & 0x1) ? PCRESP_CASELESS : 0;
+		if (is_first) {
+			stage->options |= (options & 0x2) ? PCRESP_MULTILINE : 0;
+			stage->options |= (options & 0x1c) == 0x04 ? PCRESP_DOTALL : 0;
+			stage->options |= (options & 0x1c) == 0x08 ? PCRESP_EXTENDED : 0;
+			stage->options |= (options & 0x1c) == 0x0c ? PCRESP_UTF : 0;
+		}
+	}
+
+	stage->mode = choose(input, is_first ? 5 : 4);
+	if (!is_first && stage->mode == MODE_FORMAT) {
+		stage->mode = MODE_DEFAULT;
+	}
+
+	switch (stage->mode) {
+	case MODE_SCRIPT:
+		generate_script(input, stage, external, positions);
+		break;
+	case MODE_FORMAT:
+		stage->format = 1 + choose(input, 3);
+		break;
+	case MODE_AGGREGATE:
+		stage->aggregate_types[0] = rarely(input, 4) ? PCRESP_UNIQUE : PCRESP_GROUP_BY;
+		generate_template(input, &stage->templates[0], stage->capture_count, positions);
+		if (stage->aggregate_types[0] == PCRESP_GROUP_BY && choose(input, 2)) {
+			type = choose(input, 3);
+			stage->aggregate_types[1] = aggregate_types[type];
+			generate_template(input, &stage->templates[1], stage->capture_count, positions);
+			stage->sort = choose(input, 2) ? sort_orders[type] : (int)choose(input, 2);
+		}
+		else {
+			stage->sort = choose(input, 2);
+		}
+		break;
+	case MODE_SKETCH:
+		stage->top_k = choose(input, 4);
+		generate_template(input, &stage->templates[0], stage->capture_count, positions);
+		if (stage->top_k == 0 || choose(input, 2)) {
+			generate_template(input, &stage->templates[1], stage->capture_count, positions);
+		}
+		stage->report_every = choose(input, 4);
+		break;
+	}
+
+	stage->print_text = rarely(input, 4);
+	stage->line_number = rarely(input, 4);
+	stage->limit = rarely(input, 4) ? 1 + (int)choose(input, 5) : 0;
+}
+
+static int uses_lines(stage_spec *stage)
+{
+	const string_buffer *buffers[3];
+	int i;
+
+	buffers[0] = &stage->script;
+	buffers[1] = &stage->templates[0];
+	buffers[2] = &stage->templates[1];
+
+	for (i = 0; i < 3; i++) {
+		if (buffers[i]->data != NULL && (strstr(buffers[i]->data, "#L") != NULL
+				|| strstr(buffers[i]->data, "#C") != NULL)) {
+			return 1;
+		}
+	}
+	return stage->line_number;
+}
+
+static int runs_programs(stage_spec *stage)
+{
+	return stage->script.data != NULL && strncmp(stage->script.data, "*print", 6) != 0;
+}
+
+static void generate_case(fuzz_input *input, fuzz_case *fuzz)
+{
+	unsigned count, i;
+	size_t size, split;
+	/* The quantifiers of the patterns matching inputs larger than
+	 * a chunk are bounded, since the backtracking of unbounded
+	 * quantifiers can take quadratic time on long lines. */
+	int chunked = rarely(input, 4);
+
+	memset(fuzz, 0, sizeof(fuzz_case));
+
+	/* Large inputs start the background JIT compilation of the auto mode. */
+	fuzz->repeat = rarely(input, 8) ? 1 + choose(input, 4) * 200 : 1;
+
+	generate_stage(input, &fuzz->stages[0], 1, fuzz->repeat == 1, chunked);
+	fuzz->stage_count = 1;
+	if (rarely(input, 4)) {
+		generate_stage(input, &fuzz->stages[1], 0, 0, chunked);
+		fuzz->stage_count = 2;
+	}
+
+	count = choose(input, 48);
+	for (i = 0; i < count; i++) {
+		append(&fuzz->input, input_words[choose(input, sizeof(input_words) / sizeof(input_words[0]))]);
+	}
+
+	/* Inputs larger than a chunk check that the line positions
+	 * continue across the chunks of streaming stages. The periodic
+	 * reports would print the whole sketch many times. */
+	if (chunked && fuzz->input.length > 0 && !runs_programs(&fuzz->stages[0]) && fuzz->stages[0].report_every == 0
+			&& (uses_lines(&fuzz->stages[0]) || (fuzz->stage_count > 1 && uses_lines(&fuzz->stages[1])))) {
+		fuzz->repeat = CHUNK_SIZE / fuzz->input.length + 1;
+	}
+
+	size = fuzz->input.length * fuzz->repeat;
+	fuzz->file_count = 1 + choose(input, MAX_FILES);
+	for (i = 0; i + 1 < (unsigned)fuzz->file_count; i++) {
+		split = size * choose(input, 256) / 256;
+		fuzz->file_sizes[i] = split;
+		size -= split;
+	}
+	fuzz->file_sizes[i] = size;
+
+	fuzz->jit = choose(input, 2) ? PCRESP_JIT_ALWAYS : PCRESP_JIT_AUTO;
+	fuzz->engine = choose(input, 2) ? PCRESP_ENGINE_AUTO : PCRESP_ENGINE_BACKTRACK;
+	fuzz->load = LOAD_FILE + choose(input, 3);
+	fuzz->hugepages = rarely(input, 4);
+	fuzz->cache = rarely(input, 4);
+}
+
+static void free_case(fuzz_case *fuzz)
+{
+	stage_spec *stage;
+	int i;
+
+	for (i = 0; i < 2; i++) {
+		stage = fuzz->stages + i;
+		free(stage->pattern.data);
+		free(stage->reference_pattern.data);
+		free(stage->script.data);
+		free(stage->templates[0].data);
+		free(stage->templates[1].data);
+	}
+	free(fuzz->input.data);
+}
+
+static void remove_files(const char *dir_name)
+{
+	DIR *dir = opendir(dir_name);
+	struct dirent *entry;
+
+	if (dir == NULL) {
+		return;
+	}
+
+	while ((entry = readdir(dir)) != NULL) {
+		if (strcmp(entry->d_name, ".") != 0 && strcmp(entry->d_name, "..") != 0) {
+			unlinkat(dirfd(dir), entry->d_name, 0);
+		}
+	}
+	closedir(dir);
+}
+
+static void remove_work_dir(void)
+{
+	char path[64];
+
+	snprintf(path, sizeof(path), "%s/cache", work_dir);
+	remove_files(path);
+	rmdir(path);
+	remove_files(work_dir);
+	rmdir(work_dir);
+}
+
+static void get_path(char *path, const char *name, int index)
+{
+	snprintf(path, 64, "%s/%s%d", work_dir, name, index);
+}
+
+static int write_inputs(fuzz_case *fuzz)
+{
+	const char *data = fuzz->input.data;
+	size_t length = fuzz->input.length;
+	size_t position = 0, size;
+	char path[64];
+	int i, fd;
+
+	for (i = 0; i < fuzz->file_count; i++) {
+		get_path(path, "input", i);
+		fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+		if (fd < 0) {
+			return 0;
+		}
+
+		for (size = fuzz->file_sizes[i]; size > 0; size -= length) {
+			length = fuzz->input.length - position % fuzz->input.length;
+			if (length > size) {
+				length = size;
+			}
+			if (write(fd, data + position % fuzz->input.length, length) != (ssize_t)length) {
+				close(fd);
+				return 0;
+			}
+			position += length;
+		}
+		close(fd);
+	}
+	return 1;
+}
+
+static int read_output(const char *path, string_buffer *output)
+{
+	char buffer[4096];
+	ssize_t length;
+	int fd = open(path, O_RDONLY);
+
+	if (fd < 0) {
+		return 0;
+	}
+
+	while ((length = read(fd, buffer, sizeof(buffer))) > 0) {
+		if (!buffer_append(output, buffer, (size_t)length)) {
+			abort();
+		}
+	}
+	close(fd);
+	return length == 0;
+}
+
+static int setup_stage(pcresp_ctx *ctx, stage_spec *stage, fuzz_case *fuzz, int optimized)
+{
+	char path[64];
+	/* The JIT compiler and the interpreter may call the callouts at
+	 * different positions, so only the other paths are compared. */
+	int same_matcher = optimized || strstr(stage->pattern.data, "(?C") != NULL;
+
+	pcresp_add_string(ctx, "d", "-");
+	pcresp_set_print_text(ctx, stage->print_text);
+	pcresp_set_line_number(ctx, stage->line_number);
+	pcresp_set_limit(ctx, stage->limit);
+	pcresp_set_jit(ctx, same_matcher ? fuzz->jit : PCRESP_JIT_NEVER);
+	pcresp_set_engine(ctx, same_matcher ? fuzz->engine : PCRESP_ENGINE_BACKTRACK);
+
+	if (stage->mode == MODE_SCRIPT && !pcresp_set_script(ctx, stage->script.data)) {
+		return 0;
+	}
+
+	if (stage->mode == MODE_FORMAT) {
+		pcresp_set_format(ctx, stage->format);
+	}
+
+	if (stage->mode == MODE_AGGREGATE) {
+		if (!pcresp_add_aggregate(ctx, stage->aggregate_types[0], stage->templates[0].data)
+				|| (stage->templates[1].data != NULL
+					&& !pcresp_add_aggregate(ctx, stage->aggregate_types[1], stage->templates[1].data))
+				|| !pcresp_set_aggregate_sort(ctx, stage->sort)) {
+			return 0;
+		}
+	}
+
+	if (stage->mode == MODE_SKETCH) {
+		if ((stage->top_k > 0 && !pcresp_add_top_k(ctx, stage->top_k, stage->templates[0].data))
+				|| (stage->templates[1].data != NULL && !pcresp_add_distinct(ctx, stage->templates[1].data))
+				|| !pcresp_set_report_every(ctx, stage->report_every)) {
+			return 0;
+		}
+	}
+
+	if (stage == fuzz->stages && optimized) {
+		pcresp_set_hugepages(ctx, fuzz->hugepages);
+		pcresp_set_pipeline(ctx, fuzz->load == LOAD_FILES && fuzz->stage_count == 1);
+
+		if (fuzz->cache) {
+			snprintf(path, sizeof(path), "%s/cache", work_dir);
+			if (!pcresp_set_cache_dir(ctx, path)) {
+				return 0;
+			}
+		}
+	}
+
+	if (stage->keywords && optimized) {
+		if (!pcresp_compile_keywords(ctx, stage->pattern.data, stage->pattern.length, stage->options)) {
+			return 0;
+		}
+	}
+	else if (!pcresp_compile(ctx, stage->keywords ? stage->reference_pattern.data : stage->pattern.data,
+			stage->options, -1, -1)) {
+		return 0;
+	}
+
+	/* The scripts are executed by run_script. */
+	if (!optimized) {
+		free_print_script(ctx);
+	}
+	return 1;
+}
+
+static void match_inputs(pcresp_ctx *ctx, fuzz_case *fuzz, int load)
+{
+	char paths[MAX_FILES][64];
+	const char *file_names[MAX_FILES];
+	FILE *f;
+	int i, fd;
+
+	for (i = 0; i < fuzz->file_count; i++) {
+		get_path(paths[i], "input", i);
+		file_names[i] = paths[i];
+	}
+
+	if (load == LOAD_FILES) {
+		pcresp_match_files(ctx, file_names, (size_t)fuzz->file_count);
+		return;
+	}
+
+	for (i = 0; i < fuzz->file_count; i++) {
+		switch (load) {
+		case LOAD_STREAM:
+			f = fopen(file_names[i], "r");
+			if (f != NULL) {
+				pcresp_match_stream(ctx, f, file_names[i]);
+				fclose(f);
+			}
+			break;
+		case LOAD_FILE:
+			pcresp_match_file(ctx, file_names[i]);
+			break;
+		default:
+			fd = open(file_names[i], O_RDONLY);
+			if (fd >= 0) {
+				pcresp_match_fd(ctx, fd, file_names[i]);
+				close(fd);
+			}
+			break;
+		}
+	}
+}
+
+/* Runs the configuration with the optimized or the reference paths,
+ * and collects the output written to stdout (including the output
+ * of the executed programs). The status is the same as the exit
+ * status of pcresp. */
+static int run(fuzz_case *fuzz, int optimized, run_result *result)
+{
+	pcresp_ctx *first, *last;
+	char path[64];
+	int saved_fd, fd, compiled;
+
+	memset(result, 0, sizeof(run_result));
+	get_path(path, "output", optimized);
+
+	fflush(stdout);
+	fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	saved_fd = dup(STDOUT_FILENO);
+	if (fd < 0 || saved_fd < 0 || dup2(fd, STDOUT_FILENO) < 0) {
+		fprintf(stderr, "Cannot redirect stdout\n");
+		abort();
+	}
+	close(fd);
+
+	first = last = pcresp_ctx_create();
+	if (first == NULL) {
+		abort();
+	}
+
+	compiled = setup_stage(first, fuzz->stages, fuzz, optimized);
+
+	if (compiled && fuzz->stage_count > 1) {
+		last = pcresp_ctx_create();
+		if (last == NULL || !pcresp_add_stage(first, last)) {
+			abort();
+		}
+		compiled = setup_stage(last, fuzz->stages + 1, fuzz, optimized);
+		pcresp_set_streaming(first, optimized);
+	}
+
+	result->status = 2;
+	if (compiled) {
+		match_inputs(first, fuzz, optimized ? fuzz->load : LOAD_STREAM);
+		pcresp_flush(first);
+		result->status = !pcresp_match_found(last);
+	}
+	pcresp_ctx_free(first);
+
+	fflush(stdout);
+	dup2(saved_fd, STDOUT_FILENO);
+	close(saved_fd);
+
+	return read_output(path, &result->output);
+}
+
+static void print_escaped(const char *data, size_t length)
+{
+	size_t i;
+
+	fputc('"', stderr);
+	for (i = 0; i < length && i < 512; i++) {
+		if (data[i] == '\n') {
+			fputs("\\n", stderr);
+		}
+		else if (data[i] == '"' || data[i] == '\\') {
+			fprintf(stderr, "\\%c", data[i]);
+		}
+		else if ((unsigned char)data[i] < 0x20 || (unsigned char)data[i] >= 0x7f) {
+			fprintf(stderr, "\\x%02x", (unsigned char)data[i]);
+		}
+		else {
+			fputc(data[i], stderr);
+		}
+	}
+	fputs(i < length ? "\"...\n" : "\"\n", stderr);
+}
+
+static void print_stage(stage_spec *stage, int index)
+{
+	fprintf(stderr, "Stage %d: %s ", index, stage->keywords ? "keywords" : "pattern");
+	print_escaped(stage->pattern.data, stage->pattern.length);
+	fprintf(stderr, "  options: 0x%x, mode: %d, format: %d, aggregate: %d %d, sort: %d, top-k: %d,"
+		" report every: %d\n  print text: %d, line number: %d, limit: %d\n",
+		(unsigned)stage->options, stage->mode, stage->format, stage->aggregate_types[0], stage->aggregate_types[1], stage->sort,
+		(int)stage->top_k, (int)stage->report_every, stage->print_text, stage->line_number, stage->limit);
+	if (stage->script.data != NULL) {
+		fprintf(stderr, "  script: ");
+		print_escaped(stage->script.data, stage->script.length);
+	}
+	if (stage->templates[0].data != NULL) {
+		fprintf(stderr, "  template: ");
+		print_escaped(stage->templates[0].data, stage->templates[0].length);
+	}
+	if (stage->templates[1].data != NULL) {
+		fprintf(stderr, "  template: ");
+		print_escaped(stage->templates[1].data, stage->templates[1].length);
+	}
+}
+
+static void print_difference(fuzz_case *fuzz, int pass, run_result *reference, run_result *optimized)
+{
+	static const char *const load_names[] = { "stream", "file", "files", "fd" };
+	size_t offset = 0;
+	int i;
+
+	fprintf(stderr, "\nThe optimized and the reference paths differ\n");
+	for (i = 0; i < fuzz->stage_count; i++) {
+		print_stage(fuzz->stages + i, i + 1);
+	}
+
+	fprintf(stderr, "Optimized: jit %d, engine %d, load %s, hugepages %d, cache %d (pass %d)\n",
+		fuzz->jit, fuzz->engine, load_names[fuzz->load], fuzz->hugepages, fuzz->cache, pass + 1);
+	fprintf(stderr, "Input: %d file(s) of", fuzz->file_count);
+	for (i = 0; i < fuzz->file_count; i++) {
+		fprintf(stderr, " %d", (int)fuzz->file_sizes[i]);
+	}
+	fprintf(stderr, " bytes, repeated %d times: ", (int)fuzz->repeat);
+	print_escaped(fuzz->input.data, fuzz->input.length);
+
+	while (offset < reference->output.length && offset < optimized->output.length
+			&& reference->output.data[offset] == optimized->output.data[offset]) {
+		offset++;
+	}
+	offset = (offset > 64) ? offset - 64 : 0;
+
+	fprintf(stderr, "Reference: status %d, %d bytes, from offset %d: ", reference->status,
+		(int)reference->output.length, (int)offset);
+	print_escaped(reference->output.data + offset, reference->output.length - offset);
+	fprintf(stderr, "Optimized: status %d, %d bytes, from offset %d: ", optimized->status,
+		(int)optimized->output.length, (int)offset);
+	print_escaped(optimized->output.data + offset, optimized->output.length - offset);
+}
+
+/* Returns with zero if the outputs are different. */
+static int run_differential(const uint8_t *data, size_t size)
+{
+	fuzz_input input;
+	fuzz_case fuzz;
+	run_result reference, optimized;
+	char path[64];
+	int pass, passes, same = 1;
+
+	if (!work_dir_created) {
+		if (mkdtemp(work_dir) == NULL) {
+			fprintf(stderr, "Cannot create temporary directory\n");
+			abort();
+		}
+		work_dir_created = 1;
+		atexit(remove_work_dir);
+	}
+
+	input.data = data;
+	input.size = size;
+	generate_case(&input, &fuzz);
+
+	snprintf(path, sizeof(path), "%s/cache", work_dir);
+	remove_files(path);
+
+	if (!write_inputs(&fuzz) || !run(&fuzz, 0, &reference)) {
+		fprintf(stderr, "Cannot write the temporary files\n");
+		abort();
+	}
+
+	/* The second pass replays the cached matches. */
+	passes = fuzz.cache ? 2 : 1;
+	for (pass = 0; pass < passes && same; pass++) {
+		if (!run(&fuzz, 1, &optimized)) {
+			fprintf(stderr, "Cannot read the output\n");
+			abort();
+		}
+
+		same = (reference.status == optimized.status && reference.output.length == optimized.output.length
+			&& (reference.output.length == 0
+				|| memcmp(reference.output.data, optimized.output.data, reference.output.length) == 0));
+
+		if (!same) {
+			print_difference(&fuzz, pass, &reference, &optimized);
+		}
+		free(optimized.output.data);
+	}
+
+	free(reference.output.data);
+	free_case(&fuzz);
+	return same;
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+	if (!run_differential(data, size)) {
+		abort();
+	}
+	return 0;
+}
+
+#ifndef PCRESP_LIBFUZZER
+
+static uint64_t next_random(uint64_t *state)
+{
+	uint64_t value = (*state += 0x9e3779b97f4a7c15ull);
+
+	value = (value ^ (value >> 30)) * 0xbf58476d1ce4e5b9ull;
+	value = (value ^ (value >> 27)) * 0x94d049bb133111ebull;
+	return value ^ (value >> 31);
+}
+
+static int replay_file(const char *file_name)
+{
+	string_buffer data;
+	int result;
+
+	memset(&data, 0, sizeof(data));
+	if (!read_output(file_name, &data)) {
+		fprintf(stderr, "Cannot read file: %s\n", file_name);
+		return 0;
+	}
+
+	result = run_differential((const uint8_t*)data.data, data.length);
+	free(data.data);
+	return result;
+}
+
+int main(int argc, char *argv[])
+{
+	uint64_t seed = 1, runs = 1000, run_index, state;
+	uint8_t data[512];
+	char file_name[64];
+	size_t size, i;
+	int arg_index, file_count = 0;
+	FILE *f;
+
+	/* Unknown options are ignored, as the
+	 * libFuzzer options are not supported. */
+	for (arg_index = 1; arg_index < argc; arg_index++) {
+		if (strncmp(argv[arg_index], "-seed=", 6) == 0) {
+			seed = strtoull(argv[arg_index] + 6, NULL, 10);
+		}
+		else if (strncmp(argv[arg_index], "-runs=", 6) == 0) {
+			runs = strtoull(argv[arg_index] + 6, NULL, 10);
+		}
+		else if (argv[arg_index][0] != '-') {
+			if (!replay_file(argv[arg_index])) {
+				return 1;
+			}
+			file_count++;
+		}
+	}
+
+	if (file_count > 0) {
+		printf("%d file(s), no differences\n", file_count);
+		return 0;
+	}
+
+	for (run_index = 0; run_index < runs; run_index++) {
+		state = seed * 0x100000000ull + run_index;
+		size = 16 + (size_t)(next_random(&state) % (sizeof(data) - 16));
+		for (i = 0; i < size; i++) {
+			data[i] = (uint8_t)next_random(&state);
+		}
+
+		if (!run_differential(data, size)) {
+			snprintf(file_name, sizeof(file_name), "differential-%llu-%llu.bin",
+				(unsigned long long)seed, (unsigned long long)run_index);
+			f = fopen(file_name, "wb");
+			if (f != NULL) {
+				fwrite(data, 1, size, f);
+				fclose(f);
+				fprintf(stderr, "Input saved to %s\n", file_name);
+			}
+			return 1;
+		}
+	}
+
+	printf("%llu runs, no differences\n", (unsigned long long)runs);
+	return 0;
+}
+
+#endif /* !PCRESP_LIBFUZZER */
@@ -0,0 +1,34 @@
+#!/bin/bash
+
+# Runs the standalone driver of the differential fuzz target, which
+# checks that the optimized and the reference paths produce the same
+# output for a fixed set of random configurations.
+
+CWD=`pwd`
+if [ -f "../../Makefile" ]; then
+    ROOT="$CWD/../.."
+else
+  if [ -f "../Makefile" ]; then
+      ROOT="$CWD/.."
+  else
+      echo "Cannot find pcresp source directory"
+      exit
+  fi
+fi
+
+# The driver is built by 'make check'.
+if [ ! -x "$ROOT/bin/fuzz/differential" ]; then
+    echo "bin/fuzz/differential is not built, run 'make fuzz' or 'make check'"
+    exit 77
+fi
+
+DIR=`mktemp -d`
+trap 'rm -rf "$DIR"' EXIT
+
+# The details of a difference are printed to stderr.
+"$ROOT/bin/fuzz/differential" -seed=1 -runs=300 2> "$DIR/stderr.txt"
+STATUS=$?
+echo "status: $STATUS"
+if [ $STATUS -ne 0 ]; then
+    sed -n '/paths differ/,$p' "$DIR/stderr.txt"
+fi
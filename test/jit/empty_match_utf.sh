@@ -0,0 +1,24 @@
+#!/bin/bash
+
+CWD=`pwd`
+if [ -f "../../bin/pcresp" ]; then
+    PATH="$CWD/../../bin":$PATH
+else
+  if [ -f "../bin/pcresp" ]; then
+      PATH="$CWD/../bin":$PATH
+  else
+      echo "Cannot find pcresp build directory"
+      exit
+  fi
+fi
+
+# The JIT code does not check UTF after the first match, so an empty
+# match must not move the start offset into a UTF-8 character.
+for MODE in never always; do
+    echo "printf '\xc3\xa9-\xc3\xa9\n' | pcresp --jit $MODE -u -s '*print #^0' '\b'"
+    printf '\xc3\xa9-\xc3\xa9\n' | pcresp --jit $MODE -u -s '*print #^0' '\b'
+    echo "status: $?"
+    echo "printf '\xe2\x82\xac\xe2\x82\xac' | pcresp --jit $MODE -u -s '*print <#^0>' '(?=\x{20ac})'"
+    printf '\xe2\x82\xac\xe2\x82\xac' | pcresp --jit $MODE -u -s '*print <#^0>' '(?=\x{20ac})'
+    echo "status: $?"
+done
@@ -0,0 +1,41 @@
+#!/bin/bash
+
+CWD=`pwd`
+if [ -f "../../bin/pcresp" ]; then
+    PATH="$CWD/../../bin":$PATH
+else
+  if [ -f "../bin/pcresp" ]; then
+      PATH="$CWD/../bin":$PATH
+  else
+      echo "Cannot find pcresp build directory"
+      exit
+  fi
+fi
+
+DIR=`mktemp -d`
+trap 'rm -rf "$DIR"' EXIT
+cd "$DIR"
+
+printf 'a1 b22\nc333\n' > small.txt
+# Larger than the input size which starts the background compilation.
+seq 1 50000 | sed 's/^/item /' > large.txt
+
+for MODE in auto always never; do
+    echo "pcresp --jit $MODE '(\w)(\d+)' -s '*print #2#1' small.txt"
+    pcresp --jit $MODE '(\w)(\d+)' -s '*print #2#1' small.txt
+    # The JIT code may be used from any match on.
+    echo "pcresp --jit $MODE '^item (\d*?)(9+)$' -m -s '*print #L #1 #2' large.txt | md5sum"
+    pcresp --jit $MODE '^item (\d*?)(9+)$' -m -s '*print #L #1 #2' large.txt | md5sum
+    echo "pcresp --jit $MODE '(?:a|b|c)\d' --engine dfa --verbose small.txt"
+    pcresp --jit $MODE '(?:a|b|c)\d' --engine dfa --verbose small.txt
+    echo
+done
+
+echo "pcresp --verbose 'item' large.txt small.txt"
+pcresp --verbose 'item' large.txt small.txt 2>&1 | grep 'JIT compilation started'
+echo "pcresp --verbose 'item' small.txt small.txt"
+pcresp --verbose 'item' small.txt small.txt 2>&1 | grep -c 'JIT'
+
+echo "pcresp --jit sometimes 'x'"
+pcresp --jit sometimes 'x'
+echo "status: $?"
@@ -0,0 +1,38 @@
+#!/bin/bash
+
+CWD=`pwd`
+if [ -f "../../bin/pcresp" ]; then
+    PATH="$CWD/../../bin":$PATH
+else
+  if [ -f "../bin/pcresp" ]; then
+      PATH="$CWD/../bin":$PATH
+  else
+      echo "Cannot find pcresp build directory"
+      exit
+  fi
+fi
+
+echo "echo 'she sells seashells' | pcresp -F 'he
+she
+hell
+shells'"
+echo 'she sells seashells' | pcresp -F 'he
+she
+hell
+shells'
+echo
+
+KEYWORDS=`mktemp`
+printf 'abc\nbcd\r\n\nbc\nABCDE\n' > $KEYWORDS
+
+echo "(keywords: abc, bcd with CRLF, empty line, bc, ABCDE)"
+echo
+
+echo "echo 'xabcde xbcdx' | pcresp -f words -s '*print #0 #^0 #\$0'"
+echo 'xabcde xbcdx' | pcresp -f $KEYWORDS -s '*print #0 #^0 #$0'
+echo
+
+echo "echo 'xabcde xbcdx' | pcresp -i -f words -p"
+echo 'xabcde xbcdx' | pcresp -i -f $KEYWORDS -p
+
+rm -f $KEYWORDS
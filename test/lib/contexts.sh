@@ -0,0 +1,121 @@
+#!/bin/bash
+
+CWD=`pwd`
+if [ -f "../../Makefile" ]; then
+    ROOT="$CWD/../.."
+else
+  if [ -f "../Makefile" ]; then
+      ROOT="$CWD/.."
+  else
+      echo "Cannot find pcresp source directory"
+      exit
+  fi
+fi
+
+DIR=`mktemp -d`
+trap 'rm -rf "$DIR"' EXIT
+cd "$DIR"
+
+# Two contexts used by two threads at the same time, each one
+# receiving its matches by its own callback.
+cat > contexts.c <<'END'
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "libpcresp.h"
+
+struct result {
+	pcresp_ctx *ctx;
+	const char *file_name;
+	char text[256];
+	size_t length;
+};
+
+static int collect(void *user_data, const char *subject, size_t subject_size,
+	const size_t *ovector, uint32_t pair_count, const char *mark)
+{
+	struct result *result = (struct result *)user_data;
+	size_t size = ovector[1] - ovector[0];
+
+	(void)subject_size;
+	(void)pair_count;
+	(void)mark;
+
+	if (result->length + size + 1 < sizeof(result->text)) {
+		memcpy(result->text + result->length, subject + ovector[0], size);
+		result->length += size;
+		result->text[result->length++] = ' ';
+	}
+	return 0;
+}
+
+static void *run(void *arg)
+{
+	struct result *result = (struct result *)arg;
+
+	pcresp_match_file(result->ctx, result->file_name);
+	return NULL;
+}
+
+static pcresp_ctx *create(const char *pattern, struct result *result)
+{
+	pcresp_ctx *ctx = pcresp_ctx_create();
+
+	if (ctx == NULL) {
+		exit(1);
+	}
+	pcresp_set_match_callback(ctx, collect, result);
+	if (!pcresp_compile(ctx, pattern, 0, -1, -1)) {
+		exit(1);
+	}
+	result->ctx = ctx;
+	return ctx;
+}
+
+int main(int argc, char *argv[])
+{
+	struct result first = { NULL, NULL, "", 0 };
+	struct result second = { NULL, NULL, "", 0 };
+	pthread_t first_thread, second_thread;
+
+	if (argc != 3) {
+		return 1;
+	}
+
+	first.file_name = argv[1];
+	second.file_name = argv[2];
+	create("[a-z]\\d", &first);
+	create("\\d+", &second);
+
+	if (pthread_create(&first_thread, NULL, run, &first) != 0
+			|| pthread_create(&second_thread, NULL, run, &second) != 0) {
+		return 1;
+	}
+	pthread_join(first_thread, NULL);
+	pthread_join(second_thread, NULL);
+
+	printf("first: %.*s\n", (int)first.length, first.text);
+	printf("second: %.*s\n", (int)second.length, second.text);
+	printf("matches: %d %d\n", pcresp_match_found(first.ctx), pcresp_match_found(second.ctx));
+
+	pcresp_ctx_free(first.ctx);
+	pcresp_ctx_free(second.ctx);
+	return 0;
+}
+END
+
+# The static library is built by 'make check'.
+if [ ! -f "$ROOT/bin/libpcresp.a" ]; then
+    echo "bin/libpcresp.a is not built, run 'make static' or 'make check'"
+    exit 77
+fi
+${CC:-cc} $CPPFLAGS $CFLAGS -I"$ROOT/src" contexts.c "$ROOT/bin/libpcresp.a" \
+	$LDFLAGS -lpcre2-8 -lpthread -ldl -lm -o contexts
+echo "compile status: $?"
+
+printf 'a1 b2 c3\n' > input1.txt
+printf 'x 10 y 20\n30\n' > input2.txt
+echo "./contexts input1.txt input2.txt"
+./contexts input1.txt input2.txt
+echo "status: $?"
@@ -0,0 +1,85 @@
+#!/bin/bash
+
+CWD=`pwd`
+if [ -f "../../Makefile" ]; then
+    ROOT="$CWD/../.."
+else
+  if [ -f "../Makefile" ]; then
+      ROOT="$CWD/.."
+  else
+      echo "Cannot find pcresp source directory"
+      exit
+  fi
+fi
+
+DIR=`mktemp -d`
+trap 'rm -rf "$DIR"' EXIT
+cd "$DIR"
+
+# Two contexts in one process, each writing to its own output. The
+# second one writes its output by the pipeline writer thread.
+cat > output.c <<'END'
+#include <stdio.h>
+#include <stdlib.h>
+#include "libpcresp.h"
+
+static pcresp_ctx *create(const char *pattern, const char *script, FILE *output)
+{
+	pcresp_ctx *ctx = pcresp_ctx_create();
+
+	if (ctx == NULL || !pcresp_set_output(ctx, output)
+			|| (script != NULL && !pcresp_set_script(ctx, script))
+			|| !pcresp_compile(ctx, pattern, 0, -1, -1)) {
+		exit(1);
+	}
+	return ctx;
+}
+
+int main(int argc, char *argv[])
+{
+	FILE *first_output = fopen("first.txt", "w");
+	FILE *second_output = fopen("second.txt", "w");
+	pcresp_ctx *first, *second;
+
+	if (first_output == NULL || second_output == NULL) {
+		return 1;
+	}
+
+	first = create("(\\w)(\\d)", "*print #2#1", first_output);
+	second = create("\\d+", NULL, second_output);
+	pcresp_set_pipeline(second, 1);
+
+	pcresp_match_buffer(first, "a1 b2", 5);
+	pcresp_match_files(second, (const char *const *)argv + 1, (size_t)(argc - 1));
+	pcresp_match_buffer(first, "c3", 2);
+
+	pcresp_flush(first);
+	pcresp_flush(second);
+	printf("matches: %d %d\n", pcresp_match_found(first), pcresp_match_found(second));
+
+	pcresp_ctx_free(first);
+	pcresp_ctx_free(second);
+	fclose(first_output);
+	fclose(second_output);
+	return 0;
+}
+END
+
+# The static library is built by 'make check'.
+if [ ! -f "$ROOT/bin/libpcresp.a" ]; then
+    echo "bin/libpcresp.a is not built, run 'make static' or 'make check'"
+    exit 77
+fi
+${CC:-cc} $CPPFLAGS $CFLAGS -I"$ROOT/src" output.c "$ROOT/bin/libpcresp.a" \
+	$LDFLAGS -lpcre2-8 -lpthread -ldl -lm -o output
+echo "compile status: $?"
+
+printf 'x 10 y 20\n' > input1.txt
+printf '30\n' > input2.txt
+echo "./output input1.txt input2.txt"
+./output input1.txt input2.txt
+echo "status: $?"
+echo "first.txt:"
+cat first.txt
+echo "second.txt:"
+cat second.txt
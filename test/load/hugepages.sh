@@ -0,0 +1,47 @@
+#!/bin/bash
+
+CWD=`pwd`
+if [ -f "../../bin/pcresp" ]; then
+    PATH="$CWD/../../bin":$PATH
+else
+  if [ -f "../bin/pcresp" ]; then
+      PATH="$CWD/../bin":$PATH
+  else
+      echo "Cannot find pcresp build directory"
+      exit
+  fi
+fi
+
+DIR=`mktemp -d`
+trap 'rm -rf "$DIR"' EXIT
+cd "$DIR"
+
+# The large file is larger than the step of releasing the scanned parts
+# of mapped files (16 MiB), and the small one is larger than a page but
+# smaller than a huge page. The lookbehind reads the text before the
+# match, which may be in a released part.
+seq 1 3000000 > large.txt
+seq 1 30000 > small.txt
+PATTERN='(?m)(?<=^2)(\d*)9999$'
+
+# Compares the output with and without --hugepages for mapped files
+# and for input read from a pipe into an anonymous buffer.
+compare() {
+    FILE=$1
+    shift
+    echo "pcresp --hugepages $* '$PATTERN' $FILE"
+    pcresp "$@" "$PATTERN" $FILE > plain.txt
+    pcresp --hugepages "$@" "$PATTERN" $FILE > mapped.txt
+    cmp plain.txt mapped.txt && echo "mapped: identical, `wc -l < mapped.txt` lines"
+    cat $FILE | pcresp --hugepages "$@" "$PATTERN" > stdin.txt
+    cmp plain.txt stdin.txt && echo "stdin: identical, `wc -l < stdin.txt` lines"
+}
+
+for FILE in large.txt small.txt; do
+    compare $FILE -s '*print [#1]'
+    compare $FILE -p
+done
+
+# Huge pages are either used or the buffer falls back to normal pages.
+echo "cat large.txt | pcresp --hugepages --verbose '$PATTERN'"
+cat large.txt | pcresp --hugepages --verbose "$PATTERN" 2>&1 > /dev/null | grep -c 'input buffer uses\|huge pages are not available'
@@ -0,0 +1,40 @@
+#!/bin/bash
+
+CWD=`pwd`
+if [ -f "../../bin/pcresp" ]; then
+    PATH="$CWD/../../bin":$PATH
+else
+  if [ -f "../bin/pcresp" ]; then
+      PATH="$CWD/../bin":$PATH
+  else
+      echo "Cannot find pcresp build directory"
+      exit
+  fi
+fi
+
+DIR=`mktemp -d`
+for i in 1 2 3 4 5 6; do
+	printf "file$i: a1 b2\nc3\n" > $DIR/input$i
+done
+
+echo "pcresp --pipeline -p '\\b([a-z])(\\d)' -s '/bin/echo <#2#1>' input1 ... input6"
+pcresp --pipeline -p '\b([a-z])(\d)' -s '/bin/echo <#2#1>' $DIR/input1 $DIR/input2 $DIR/input3 \
+	$DIR/input4 $DIR/input5 $DIR/input6
+echo
+
+echo "pcresp --pipeline --group-by '#2' '\\b([a-z])(\\d)' input1 ... input6"
+pcresp --pipeline --group-by '#2' '\b([a-z])(\d)' $DIR/input1 $DIR/input2 $DIR/input3 \
+	$DIR/input4 $DIR/input5 $DIR/input6
+
+echo
+
+# Write errors of the writer thread keep the checkpoint unchanged.
+printf 'a1\nb2\n' > $DIR/log
+echo "pcresp --pipeline --checkpoint state '\\w\\d' log > /dev/full"
+pcresp --pipeline --checkpoint $DIR/state '\w\d' $DIR/log > /dev/full
+test -f $DIR/state && echo "state file created"
+echo "pcresp --pipeline --checkpoint state '\\w\\d' log"
+pcresp --pipeline --checkpoint $DIR/state '\w\d' $DIR/log
+test -f $DIR/state && echo "state file created"
+
+rm -rf $DIR
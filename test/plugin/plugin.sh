@@ -0,0 +1,80 @@
+#!/bin/bash
+
+CWD=`pwd`
+if [ -f "../../bin/pcresp" ]; then
+    PATH="$CWD/../../bin":$PATH
+else
+  if [ -f "../bin/pcresp" ]; then
+      PATH="$CWD/../bin":$PATH
+  else
+      echo "Cannot find pcresp build directory"
+      exit
+  fi
+fi
+
+DIR=`mktemp -d`
+cat > $DIR/plugin.c <<'END'
+#include <stdio.h>
+#include <stdlib.h>
+#include "libpcresp.h"
+
+void *count_init(void)
+{
+	return calloc(1, sizeof(int));
+}
+
+void count_fini(void *state)
+{
+	printf("total: %d\n", *(int*)state);
+	free(state);
+}
+
+int count(pcresp_plugin_call *call)
+{
+	int i;
+
+	(*(int*)call->state)++;
+	printf("match %.*s at %d:", (int)(call->ovector[1] - call->ovector[0]),
+		call->subject + call->ovector[0], (int)call->ovector[0]);
+	for (i = 0; i < call->argc; i++) {
+		printf(" [%s]", call->argv[i]);
+	}
+	printf(" mark: %s\n", call->mark != NULL ? call->mark : "none");
+	return 0;
+}
+
+/* Rejects odd numbers. */
+int even(pcresp_plugin_call *call)
+{
+	return (call->subject[call->ovector[3] - 1] - '0') & 0x1;
+}
+END
+
+SRC_DIR=`command -v pcresp`
+SRC_DIR=`dirname $SRC_DIR`/../src
+
+if ! ${CC:-cc} -shared -fPIC -I$SRC_DIR -o $DIR/plugin.so $DIR/plugin.c; then
+	echo "Cannot compile plugin"
+	rm -rf $DIR
+	exit 1
+fi
+
+cd $DIR
+
+echo "echo 'a1 b22 c3' | pcresp '(*MARK:M)(\w)(\d+)' -s '*dl ./plugin.so:count #1 <#2 x>'"
+echo 'a1 b22 c3' | pcresp '(*MARK:M)(\w)(\d+)' -s "*dl ./plugin.so:count #1 <#2 x>"
+echo
+
+echo "echo '11 24 37 40' | pcresp '(\d+)(?C\"*dl ./plugin.so:even\")'"
+echo '11 24 37 40' | pcresp "(\d+)(?C\"*dl ./plugin.so:even\")"
+echo
+
+echo "echo 'a' | pcresp 'a' -s '*dl ./plugin.so:#0'"
+echo 'a' | pcresp 'a' -s "*dl ./plugin.so:#0" 2>&1
+echo
+
+echo "echo 'a' | pcresp 'a' -s '*dl ./plugin.so:missing'"
+echo 'a' | pcresp 'a' -s "*dl ./plugin.so:missing" 2>&1
+
+cd "$CWD"
+rm -rf $DIR
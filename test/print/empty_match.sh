@@ -0,0 +1,33 @@
+#!/bin/bash
+
+CWD=`pwd`
+if [ -f "../../bin/pcresp" ]; then
+    PATH="$CWD/../../bin":$PATH
+else
+  if [ -f "../bin/pcresp" ]; then
+      PATH="$CWD/../bin":$PATH
+  else
+      echo "Cannot find pcresp build directory"
+      exit
+  fi
+fi
+
+DIR=`mktemp -d`
+trap 'rm -rf "$DIR"' EXIT
+cd "$DIR"
+
+# The unmatched text is printed completely around empty matches, both
+# for stdin and for mapped input files.
+printf 'aXbXc\n' > input.txt
+
+echo "printf 'abc' | pcresp -p -s '*print [#0]' 'x?'"
+printf 'abc' | pcresp -p -s '*print [#0]' 'x?'
+echo "status: $?"
+
+echo "pcresp -p -s '*print [#0]' 'X?' input.txt"
+pcresp -p -s '*print [#0]' 'X?' input.txt
+echo "status: $?"
+
+echo "printf 'a\xc3\xa9b' | pcresp -u -p -s '*print <#^0>' '\b|\B'"
+printf 'a\xc3\xa9b' | pcresp -u -p -s '*print <#^0>' '\b|\B'
+echo "status: $?"
@@ -0,0 +1,69 @@
+#!/bin/bash
+
+CWD=`pwd`
+if [ -f "../../bin/pcresp" ]; then
+    PATH="$CWD/../../bin":$PATH
+else
+  if [ -f "../bin/pcresp" ]; then
+      PATH="$CWD/../bin":$PATH
+  else
+      echo "Cannot find pcresp build directory"
+      exit
+  fi
+fi
+
+# Lines longer than the 8 byte words of the newline counter.
+INPUT='ab x\nxx\n\nc\xc3\xa1 x\n0123456789012345678901234567890123456789 x\n'
+
+echo "printf '$INPUT' | pcresp 'x' -s '*print #L:#C'"
+printf "$INPUT" | pcresp 'x' -s '*print #L:#C'
+echo
+
+echo "printf '$INPUT' | pcresp -u 'x' -s '*print #L:#C'"
+printf "$INPUT" | pcresp -u 'x' -s '*print #L:#C'
+echo
+
+echo "printf '$INPUT' | pcresp 'x' -s '/bin/echo #L #C'"
+printf "$INPUT" | pcresp 'x' -s '/bin/echo #L #C'
+echo
+
+echo "printf '$INPUT' | pcresp 'x+' --line-number"
+printf "$INPUT" | pcresp 'x+' --line-number
+echo
+
+echo "printf '$INPUT' | pcresp 'x' --group-by '#L' --sort key"
+printf "$INPUT" | pcresp 'x' --group-by '#L' --sort key
+echo
+
+echo "printf '$INPUT' | pcresp 'x+' --line-number --format jsonl"
+printf "$INPUT" | pcresp 'x+' --line-number --format jsonl
+echo
+
+echo "printf '$INPUT' | pcresp 'x+' --line-number --format tsv"
+printf "$INPUT" | pcresp 'x+' --line-number --format tsv
+echo
+
+echo "printf '$INPUT' | pcresp '(x)(?C\"/bin/echo #L\")'"
+printf "$INPUT" | pcresp '(x)(?C"/bin/echo #L")'
+echo
+
+# The lines are counted from the start of each input.
+echo "seq 1 100000 | pcresp '^\d*777$' -m -s '*print #L' | tail -2"
+seq 1 100000 | pcresp '^\d*777$' -m -s '*print #L' | tail -2
+echo
+
+# The chunks of a streamed stage continue the line numbers.
+echo "seq 1 100000 | pcresp --stream '.+' --then '^(99999|7)$' -m --line-number"
+seq 1 100000 | pcresp --stream '.+' --then '^(99999|7)$' -m --line-number
+echo
+
+echo "seq 1 100000 | pcresp --stream '.+' --then '^\d*777$' -m -s '*print #L:#C' | tail -2"
+seq 1 100000 | pcresp --stream '.+' --then '^\d*777$' -m -s '*print #L:#C' | tail -2
+echo
+
+echo "printf 'a\\nbx\\n' > in1; printf 'x\\n' > in2; pcresp 'x' --line-number in1 in2"
+DIR=`mktemp -d`
+printf 'a\nbx\n' > $DIR/in1
+printf 'x\n' > $DIR/in2
+pcresp 'x' --line-number $DIR/in1 $DIR/in2
+rm -rf $DIR
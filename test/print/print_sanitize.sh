@@ -0,0 +1,46 @@
+#!/bin/bash
+
+# Runs print scripts with a sanitizer build, which aborts on the
+# first invalid memory access.
+
+CWD=`pwd`
+if [ -f "../../Makefile" ]; then
+    ROOT="$CWD/../.."
+else
+  if [ -f "../Makefile" ]; then
+      ROOT="$CWD/.."
+  else
+      echo "Cannot find pcresp source directory"
+      exit
+  fi
+fi
+
+# The sanitizer build is made by 'make check'.
+if [ ! -x "$ROOT/bin/sanitize/pcresp" ]; then
+    echo "bin/sanitize/pcresp is not built, run 'make sanitize' or 'make check'"
+    exit 77
+fi
+PATH="$ROOT/bin/sanitize":$PATH
+
+# The #n is appended to scripts which do not end with *!nl.
+echo "echo A | pcresp '(.)' -s '*print #1'"
+echo A | pcresp '(.)' -s '*print #1'
+echo "status: $?"
+
+echo "echo AB | pcresp '(.)(.)' -s '*print #2#1'"
+echo AB | pcresp '(.)(.)' -s '*print #2#1'
+echo "status: $?"
+
+echo "echo AB | pcresp '(.)' -s '*print'"
+echo AB | pcresp '(.)' -s '*print'
+echo "status: $?"
+
+echo "echo AB | pcresp '(.)' -s '*print *!nl #1'"
+echo AB | pcresp '(.)' -s '*print *!nl #1'
+echo
+echo "status: $?"
+echo
+
+echo "echo A7 BB29 x C | pcresp '([A-Z]+)(\d+)?' -d x X -s '*print <a b> #{2,x}#[x] #^1-#\$1 ## #< #>'"
+echo A7 BB29 x C | pcresp '([A-Z]+)(\d+)?' -d x X -s '*print <a b> #{2,x}#[x] #^1-#$1 ## #< #>'
+echo "status: $?"
@@ -0,0 +1,30 @@
+#!/bin/bash
+
+CWD=`pwd`
+if [ -f "../../bin/pcresp" ]; then
+    PATH="$CWD/../../bin":$PATH
+else
+  if [ -f "../bin/pcresp" ]; then
+      PATH="$CWD/../bin":$PATH
+  else
+      echo "Cannot find pcresp build directory"
+      exit
+  fi
+fi
+
+echo "echo A7 BB29 x C | pcresp '([A-Z]+)(\d+)?' -d x X -s '*print   <a  b>   #{2,x}#[x]  #^1-#\$1 ## #< #>'"
+echo A7 BB29 x C | pcresp '([A-Z]+)(\d+)?' -d x X -s '*print   <a  b>   #{2,x}#[x]  #^1-#$1 ## #< #>'
+echo
+
+echo "echo AB1 B2 | pcresp -p '(?:(A)|B)(*MARK:mk)\d' -s '*print *!nl [#M|#1|#0]'"
+echo AB1 B2 | pcresp -p '(?:(A)|B)(*MARK:mk)\d' -s '*print *!nl [#M|#1|#0]'
+echo
+
+# Captures containing NUL characters are printed as well.
+echo 'printf "a\0b c\n" | pcresp "\S+" -s "*print [#0]" | od -c'
+printf 'a\0b c\n' | pcresp '\S+' -s '*print [#0]' | od -c
+echo
+
+# Long outputs are written by writev.
+echo "seq 1 20000 | pcresp '(?s).+' -s '*print #0 #0' | wc -lc"
+seq 1 20000 | pcresp '(?s).+' -s '*print #0 #0' | wc -lc
@@ -0,0 +1,40 @@
+#!/bin/bash
+
+CWD=`pwd`
+if [ -f "../../bin/pcresp" ]; then
+    PATH="$CWD/../../bin":$PATH
+else
+  if [ -f "../bin/pcresp" ]; then
+      PATH="$CWD/../bin":$PATH
+  else
+      echo "Cannot find pcresp build directory"
+      exit
+  fi
+fi
+
+INPUT='id=  Hello%20World+x%zz%4  ;\nid=AbC;\nid=;\n'
+
+echo "printf '%b' '$INPUT' | pcresp 'id=([^;]*);' -s '*print [#{1:trim:urldecode}] [#{1:upper}] [#{1:lower:trim}]'"
+printf '%b' "$INPUT" | pcresp 'id=([^;]*);' -s '*print [#{1:trim:urldecode}] [#{1:upper}] [#{1:lower:trim}]'
+echo
+
+echo "printf '%b' '$INPUT' | pcresp 'id=(\w+)?' -d none - -s '/bin/echo #{1:hex,none} <#{1:upper:hex}#{1:hex:upper}>'"
+printf '%b' "$INPUT" | pcresp 'id=(\w+)?' -d none - -s '/bin/echo #{1:hex,none} <#{1:upper:hex}#{1:hex:upper}>'
+echo
+
+echo "printf '%b' '$INPUT' | pcresp 'id=(\w*)' --group-by '#{1:lower}' --sort count"
+printf '%b' "$INPUT" | pcresp 'id=(\w*)' --group-by '#{1:lower}' --sort count
+echo
+
+# The expanded arguments can be longer or shorter than the capture.
+echo "printf '%%41%%42%%43 abc\n' | pcresp '(\S+) (\S+)' -s '*batch:4 /bin/echo #{1:urldecode} #{2:hex:hex}'"
+printf '%%41%%42%%43 abc\n' | pcresp '(\S+) (\S+)' -s '*batch:4 /bin/echo #{1:urldecode} #{2:hex:hex}'
+echo
+
+echo "pcresp 'x' -s '*print #{0:title}'"
+pcresp 'x' -s '*print #{0:title}'
+echo "pcresp 'x' -s '*print #{0:trim'"
+pcresp 'x' -s '*print #{0:trim'
+echo "pcresp 'x' --group-by '#^{0:trim}'"
+pcresp 'x' --group-by '#^{0:trim}'
+echo "status: $?"
@@ -0,0 +1,54 @@
+#!/bin/bash
+
+CWD=`pwd`
+if [ -f "../../bin/pcresp" ]; then
+    PATH="$CWD/../../bin":$PATH
+else
+  if [ -f "../bin/pcresp" ]; then
+      PATH="$CWD/../bin":$PATH
+  else
+      echo "Cannot find pcresp build directory"
+      exit
+  fi
+fi
+
+DIR=`mktemp -d`
+trap 'rm -rf "$DIR"' EXIT
+cd "$DIR"
+
+# The unmatched text between the matches is longer than the minimum
+# size of the zero-copy passthrough.
+seq 1 300000 > input.txt
+PATTERN='(?m)^(\d*)0000$'
+
+# Input from a pipe is written by the buffered path.
+echo "cat input.txt | pcresp -p -s '*print [#1]' '$PATTERN' > buffered.txt"
+cat input.txt | pcresp -p -s '*print [#1]' "$PATTERN" > buffered.txt
+echo "status: $?"
+wc -l < buffered.txt
+grep -c '^\[' buffered.txt
+
+# Pipe output of a mapped file is written by splice.
+echo "pcresp --verbose -p -s '*print [#1]' '$PATTERN' input.txt | cat > /dev/null"
+pcresp --verbose -p -s '*print [#1]' "$PATTERN" input.txt 2> verbose.txt | cat > /dev/null
+grep 'zero-copy' verbose.txt
+echo "pcresp -p -s '*print [#1]' '$PATTERN' input.txt | cat > splice.txt"
+pcresp -p -s '*print [#1]' "$PATTERN" input.txt | cat > splice.txt
+echo "status: ${PIPESTATUS[0]}"
+cmp buffered.txt splice.txt && echo "splice output is identical"
+
+# Regular file output is written by copy_file_range.
+echo "pcresp --verbose -p -s '*print [#1]' '$PATTERN' input.txt > copy.txt"
+pcresp --verbose -p -s '*print [#1]' "$PATTERN" input.txt 2>&1 > copy.txt | grep 'zero-copy'
+echo "pcresp -p -s '*print [#1]' '$PATTERN' input.txt > copy.txt"
+pcresp -p -s '*print [#1]' "$PATTERN" input.txt > copy.txt
+echo "status: $?"
+cmp buffered.txt copy.txt && echo "copy_file_range output is identical"
+
+# copy_file_range fails for O_APPEND files, and the data is written by
+# the buffered path after the existing data.
+echo "pcresp -p -s '*print [#1]' '$PATTERN' input.txt >> append.txt"
+printf 'header\n' > append.txt
+pcresp -p -s '*print [#1]' "$PATTERN" input.txt >> append.txt
+echo "status: $?"
+(printf 'header\n'; cat buffered.txt) | cmp - append.txt && echo "appended output is identical"
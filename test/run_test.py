@@ -24,7 +24,23 @@
 # CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
 # ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
+# Each test is a <name>.sh script, and its output is compared to
+# <name>_expected.txt. An optional <name>_budget.txt file declares
+# resource limits of the whole test script, one per line:
+#
+#   max_rss <KiB>          - peak resident set size of any process
+#   processes <n>          - number of processes forked by the script,
+#                            threads are not counted (needs strace)
+#   syscall <name> <n>     - number of <name> system calls (needs strace)
+#
+# Large inputs of budget tests should be generated by the script.
+#
+# A test exits with status 77 when it is skipped (e.g. a binary built
+# by 'make check' is missing), and its first output line is the reason.
+
 import os
+import re
+import shutil
 import subprocess
 import sys
 
@@ -34,6 +50,8 @@ if len(sys.argv) >= 2 and sys.argv[1] == "-v":
 
 passed = 0
 failed = 0
+skipped = 0
+skipped_budgets = set()
 base = "."
 base_len = len(base) + 1
 
@@ -41,9 +59,103 @@ red = "\033[31m"
 green = "\033[32m"
 default = "\033[0m"
 
+strace = shutil.which("strace")
+
+def read_budget(file_name):
+    budget = { "syscall": {} }
+    with open(file_name) as infile:
+        for line in infile:
+            words = line.split("#")[0].split()
+            if len(words) == 0:
+                continue
+            if words[0] == "syscall" and len(words) == 3:
+                budget["syscall"][words[1]] = int(words[2])
+            elif words[0] in ("max_rss", "processes") and len(words) == 2:
+                budget[words[0]] = int(words[1])
+            else:
+                raise ValueError("invalid line in %s: %s" % (file_name, line.strip()))
+    return budget
+
+def count_syscalls(file_name, names):
+    counts = dict.fromkeys(names, 0)
+    # Format: pid name(args) = result, or <... name resumed> for
+    # the second half of interrupted calls, which are not counted.
+    pattern = re.compile(r"^\d+\s+(\w+)\(")
+    with open(file_name) as infile:
+        for line in infile:
+            match = pattern.match(line)
+            if match and match.group(1) in counts:
+                counts[match.group(1)] += 1
+    return counts
+
+def count_processes(file_name):
+    # Processes are created by fork, vfork, and clone or clone3 without
+    # CLONE_THREAD. The first half of interrupted calls has the flags.
+    count = 0
+    pattern = re.compile(r"^\d+\s+(fork|vfork|clone|clone3)\((.*)")
+    with open(file_name) as infile:
+        for line in infile:
+            match = pattern.match(line)
+            if (match and "CLONE_THREAD" not in match.group(2)
+                    and re.search(r"\) = -1 ", match.group(2)) is None):
+                count += 1
+    return count
+
+def run_budget_test(test_name, budget, outfile):
+    # Returns with the exit code and the list of exceeded limits.
+    args = [test_name]
+    trace_file = "current_strace.txt"
+    syscalls = list(budget["syscall"].keys())
+    if "processes" in budget:
+        syscalls += ["%process"]
+    use_strace = len(syscalls) > 0 and strace is not None
+
+    if "processes" in budget and not use_strace:
+        skipped_budgets.add("processes (strace is not available)")
+    if len(budget["syscall"]) > 0 and not use_strace:
+        skipped_budgets.add("syscall (strace is not available)")
+
+    if use_strace:
+        args = [strace, "-f", "-qq", "-o", trace_file, "-e", "trace=" + ",".join(syscalls)] + args
+
+    process = subprocess.Popen(["timeout", "20"] + args, stdout=outfile, stderr=outfile)
+    pid, status, usage = os.wait4(process.pid, 0)
+    if os.WIFEXITED(status):
+        process.returncode = os.WEXITSTATUS(status)
+    else:
+        process.returncode = 128 + os.WTERMSIG(status)
+
+    measured = {}
+    exceeded = []
+
+    if "max_rss" in budget:
+        measured["max_rss"] = usage.ru_maxrss
+        if usage.ru_maxrss > budget["max_rss"]:
+            exceeded.append("peak RSS %d KiB > %d KiB" % (usage.ru_maxrss, budget["max_rss"]))
+
+    if use_strace and "processes" in budget:
+        processes = count_processes(trace_file)
+        measured["processes"] = processes
+        if processes > budget["processes"]:
+            exceeded.append("processes %d > %d" % (processes, budget["processes"]))
+
+    if use_strace:
+        counts = count_syscalls(trace_file, budget["syscall"].keys())
+        os.remove(trace_file)
+        for name, limit in budget["syscall"].items():
+            measured[name] = counts[name]
+            if counts[name] > limit:
+                exceeded.append("%s calls %d > %d" % (name, counts[name], limit))
+
+    if verbose:
+        print("Budget of %s: %s" % (test_name[base_len:],
+              ", ".join("%s %d" % item for item in measured.items())))
+    return process.returncode, exceeded
+
 def do_test(path):
     global passed
     global failed
+    global skipped
     global base
 
     for test_name in os.listdir(path):
@@ -56,24 +168,45 @@ def do_test(path):
         if not test_name.endswith(".sh") or path == base:
             continue
 
+        budget_name = test_name[0:-3] + "_budget.txt"
+        exceeded = []
+
         with open("current.txt", "w") as outfile:
-            test_retval = subprocess.call(["timeout", "20", test_name], stdout=outfile, stderr=outfile);
+            if os.path.exists(budget_name):
+                test_retval, exceeded = run_budget_test(test_name, read_budget(budget_name), outfile)
+            else:
+                test_retval = subprocess.call(["timeout", "20", test_name], stdout=outfile, stderr=outfile);
+
+        if test_retval == 77:
+            with open("current.txt") as infile:
+                reason = infile.readline().strip()
+            print("Test %s skipped: %s" % (test_name[base_len:], reason))
+            skipped += 1
+            continue
 
         expected = test_name[0:-3] + "_expected.txt"
         with open("/dev/null", "w") as outfile:
             diff_retval = subprocess.call(["diff", "-q", expected, "current.txt"], stdout=outfile)
 
-        if test_retval == 0 and diff_retval == 0:
+        if test_retval == 0 and diff_retval == 0 and len(exceeded) == 0:
             passed += 1
         else:
             print("%sTest %s failed.%s" % (red, test_name[base_len:], default))
             failed += 1
+            for message in exceeded:
+                print("%s    Budget exceeded: %s%s" % (red, message, default))
             if verbose:
                 subprocess.call(["diff", "-Nu", expected, "current.txt"])
 
 do_test(base)
 os.remove("current.txt")
 
+for name in sorted(skipped_budgets):
+    print("Budget not checked: %s" % name)
+
+if skipped > 0:
+    print("Number of tests skipped: %d" % skipped)
+
 if failed > 0:
     print("\n%sNumber of tests passed: %d%s" % (green, passed, default))
     print("%sNumber of tests failed: %d%s" % (red, failed, default))
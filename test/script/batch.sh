@@ -0,0 +1,28 @@
+#!/bin/bash
+
+CWD=`pwd`
+if [ -f "../../bin/pcresp" ]; then
+    PATH="$CWD/../../bin":$PATH
+else
+  if [ -f "../bin/pcresp" ]; then
+      PATH="$CWD/../bin":$PATH
+  else
+      echo "Cannot find pcresp build directory"
+      exit
+  fi
+fi
+
+echo "seq 1 10 | pcresp '\d+' -s '*batch:4 /bin/echo n: #0'"
+seq 1 10 | pcresp '\d+' -s '*batch:4 /bin/echo n: #0'
+echo
+
+echo "seq 1 10 | pcresp '(\d)(\d)?' -s '*batch:100 /bin/echo#2 #1'"
+seq 1 10 | pcresp '(\d)(\d)?' -s '*batch:100 /bin/echo#2 #1'
+echo
+
+# Syntax errors
+echo "echo A | pcresp '(?C^*batch:2 /bin/echo^)A'"
+echo A | pcresp '(?C^*batch:2 /bin/echo^)A'
+echo "echo A | pcresp '.' -s '*batch:0 /bin/echo'"
+echo A | pcresp '.' -s '*batch:0 /bin/echo'
+echo
@@ -0,0 +1,32 @@
+#!/bin/bash
+
+CWD=`pwd`
+if [ -f "../../bin/pcresp" ]; then
+    PATH="$CWD/../../bin":$PATH
+else
+  if [ -f "../bin/pcresp" ]; then
+      PATH="$CWD/../bin":$PATH
+  else
+      echo "Cannot find pcresp build directory"
+      exit
+  fi
+fi
+
+echo "echo key=value | pcresp '(\w+)=(\w+)' -s '*stdin:2,1 /bin/cat'"
+echo key=value | pcresp '(\w+)=(\w+)' -s '*stdin:2,1 /bin/cat'
+echo
+
+echo "echo key=value | pcresp '(\w+)=(\w+)' -s '*print #^1 #\$1 #^{2} #\${2}'"
+echo key=value | pcresp '(\w+)=(\w+)' -s '*print #^1 #$1 #^{2} #${2}'
+echo
+
+echo "echo key=value | pcresp '(\w+)=(\w+)' -s '*memfd /bin/sh -c <tail -c +\$((\$1+1)) \$0> #F #\$1'"
+echo key=value | pcresp '(\w+)=(\w+)' -s '*memfd /bin/sh -c <tail -c +$(($1+1)) $0> #F #$1'
+echo
+
+# Syntax errors
+echo "echo A | pcresp '.' -s '*stdin:1x /bin/cat'"
+echo A | pcresp '.' -s '*stdin:1x /bin/cat'
+echo "echo A | pcresp '.' -s '/bin/cat #F'"
+echo A | pcresp '.' -s '/bin/cat #F'
+echo
@@ -0,0 +1,49 @@
+#!/bin/bash
+
+CWD=`pwd`
+if [ -f "../../bin/pcresp" ]; then
+    PATH="$CWD/../../bin":$PATH
+else
+  if [ -f "../bin/pcresp" ]; then
+      PATH="$CWD/../bin":$PATH
+  else
+      echo "Cannot find pcresp build directory"
+      exit
+  fi
+fi
+
+DIR=`mktemp -d`
+trap 'rm -rf "$DIR"' EXIT
+cd "$DIR"
+
+# The path is expanded from the captures.
+echo "printf 'a1 b2 a3 c4\n' | pcresp '(\w)(\d)' -s '*write out_#1.txt #2 #0'"
+printf 'a1 b2 a3 c4\n' | pcresp '(\w)(\d)' -s '*write out_#1.txt #2 #0'
+for FILE in out_a.txt out_b.txt out_c.txt; do
+    echo "$FILE:"
+    cat $FILE
+done
+echo
+
+# Evicted files are opened again and appended.
+echo "printf 'a1 b2 a3 b4 a5\n' | pcresp --max-open-files 1 '(\w)(\d)' -s '*write lru_#1.txt #2'"
+printf 'a1 b2 a3 b4 a5\n' | pcresp --max-open-files 1 '(\w)(\d)' -s '*write lru_#1.txt #2'
+for FILE in lru_a.txt lru_b.txt; do
+    echo "$FILE:"
+    cat $FILE
+done
+echo
+
+echo "printf 'a1 a2 a3\n' | pcresp '\w(\d)' -s '*write *!nl nl.txt #1'"
+printf 'a1 a2 a3\n' | pcresp '\w(\d)' -s '*write *!nl nl.txt #1'
+cat nl.txt
+echo
+echo
+
+# Writes to unwritable paths are not dropped silently, and the other
+# files are still written.
+echo "printf 'a1 b2 a3\n' | pcresp '(\w)(\d)' -s '*write dir_#1/out.txt #2'"
+mkdir dir_b
+printf 'a1 b2 a3\n' | pcresp '(\w)(\d)' -s '*write dir_#1/out.txt #2'
+echo "status: $?"
+cat dir_b/out.txt
@@ -0,0 +1,45 @@
+#!/bin/bash
+
+CWD=`pwd`
+if [ -f "../../bin/pcresp" ]; then
+    PATH="$CWD/../../bin":$PATH
+else
+  if [ -f "../bin/pcresp" ]; then
+      PATH="$CWD/../bin":$PATH
+  else
+      echo "Cannot find pcresp build directory"
+      exit
+  fi
+fi
+
+DIR=`mktemp -d`
+trap 'rm -rf "$DIR"' EXIT
+cd "$DIR"
+
+printf 'GET /a 200\nPOST /b 404\nGET /c 200\nGET /b 500\nPUT /a 200\n' > access.log
+# Long enough to be passed in several chunks in streaming mode.
+seq 1 300000 | sed 's/^/item /' > items.txt
+
+for MODE in "" "--stream"; do
+    echo "pcresp $MODE '(\w+) (\S+) (\d+)' -s '*print #3 #2' --then '^200 (\S+)' -m"
+    pcresp $MODE '(\w+) (\S+) (\d+)' -s '*print #3 #2' --then '^200 (\S+)' -m access.log
+    echo "status: $?"
+
+    echo "pcresp $MODE '(\w+) (\S+)' -s '*print #2' --then '\S+' --group-by '#0' --sort count"
+    pcresp $MODE '(\w+) (\S+)' -s '*print #2' --then '\S+' --group-by '#0' --sort count access.log
+
+    echo "pcresp $MODE 'GET (\S+)' -s '*print #1' --then 'x'"
+    pcresp $MODE 'GET (\S+)' -s '*print #1' --then 'x' access.log
+    echo "status: $?"
+
+    # Scripts of intermediate stages write their output to the next stage.
+    echo "pcresp $MODE -m '(\d{3})$' -s '/bin/echo code #1' --then 'code (5\d\d)' -s '*print <[#1]>'"
+    pcresp $MODE -m '(\d{3})$' -s '/bin/echo code #1' --then 'code (5\d\d)' -s '*print <[#1]>' access.log
+
+    echo "pcresp $MODE 'item (\d+)' -s '*print #1' --then '^\d*7$' -m --then '(\d\d)$' -m --group-by '#1' --sort count --then '^(\d+)\t(\d+)' -m -s '*print #1 #2' --limit 3"
+    pcresp $MODE 'item (\d+)' -s '*print #1' --then '^\d*7$' -m --then '(\d\d)$' -m --group-by '#1' --sort count --then '^(\d+)\t(\d+)' -m -s '*print #1 #2' --limit 3 items.txt
+
+    echo "pcresp $MODE 'item \d+' --then '\d+' --limit 3"
+    pcresp $MODE 'item \d+' --then '\d+' --limit 3 items.txt
+    echo
+done
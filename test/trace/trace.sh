@@ -0,0 +1,25 @@
+#!/bin/bash
+
+CWD=`pwd`
+if [ -f "../../bin/pcresp" ]; then
+    PATH="$CWD/../../bin":$PATH
+else
+  if [ -f "../bin/pcresp" ]; then
+      PATH="$CWD/../bin":$PATH
+  else
+      echo "Cannot find pcresp build directory"
+      exit
+  fi
+fi
+
+TRACE=`mktemp`
+
+echo "printf 'a1 b2\\nc3\\n' | pcresp --trace trace.json '(\\w)(?C\"/bin/true\")(\\d)' -s '/bin/sh -c <exit #2>'"
+printf 'a1 b2\nc3\n' | pcresp --trace $TRACE '(\w)(?C"/bin/true")(\d)' -s '/bin/sh -c <exit #2>'
+echo "events:"
+grep -o '"name":"[a-z]*","ph":"X"' $TRACE | sort | uniq -c
+grep -o '"status":[0-9]*' $TRACE
+head -n 1 $TRACE
+tail -n 1 $TRACE
+
+rm -f $TRACE